@@ -0,0 +1,568 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+/*
+** The attachment manifest.
+**
+** parsemail() records every attachment it stores in the attachments
+** list of its message, so the attachment index can be written without
+** looking at the attachment directories. With attachmentsindex set,
+** the lists are saved in ATTACHMENT_MANIFEST in the archive directory
+** and read back with the old headers by the next incremental update.
+** An archive that doesn't have a manifest yet gets its lists from the
+** attachment directories, once.
+**
+** The manifest has one line per attachment, in the order they were
+** stored, with these fields separated by tabs:
+**
+**   msgnum  size  stored-as  content-type  name  description
+**
+** Tabs, newlines and backslashes in the fields are escaped with a
+** backslash, and an empty field stands for an unknown value.
+**
+** With the attachment_store option, each distinct attachment is also
+** kept once in ATTACHMENT_STORE, named after a hash of its content and
+** its size, and the files in the attachment directories are links to
+** it. A stored copy is only ever shared after comparing it with the
+** new attachment byte for byte, so a hash collision costs a copy, not
+** a wrong file.
+*/
+
+#include "hypermail.h"
+#include "setup.h"
+#include "struct.h"
+#include "parse.h"
+#include "attach.h"
+#include "output.h"
+
+#ifdef HAVE_DIRENT_H
+#ifdef __LCC__
+#include "../lcc/dirent.h"
+#else
+#include <dirent.h>
+#endif
+#else
+#ifdef __LCC__
+#include <direct.h>
+#else
+#include <sys/dir.h>
+#endif
+#endif
+
+#define MANIFEST_HEADER "# hypermail attachment manifest 1\n"
+
+#define FNV64_INIT  0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+/*
+** Adds an attachment that has just been stored as storedas, in the
+** attachment directory of the message, to the end of a list.
+*/
+
+struct attach *attach_add(struct attach **listp, const char *storedas,
+			  const char *name, const char *type,
+			  const char *descr)
+{
+    struct attach *ap = (struct attach *)emalloc(sizeof(struct attach));
+
+    ap->storedas = strsav(storedas);
+    ap->name = (name && *name) ? strsav(name) : NULL;
+    ap->contenttype = (type && *type) ? strsav(type) : NULL;
+    ap->descr = (descr && *descr) ? strsav(descr) : NULL;
+    ap->id = NULL;
+    ap->size = 0;
+    ap->next = NULL;
+    while (*listp)
+	listp = &(*listp)->next;
+    *listp = ap;
+    return ap;
+}
+
+static void attach_free_one(struct attach *ap)
+{
+    free(ap->storedas);
+    if (ap->name)
+	free(ap->name);
+    if (ap->contenttype)
+	free(ap->contenttype);
+    if (ap->descr)
+	free(ap->descr);
+    if (ap->id)
+	free(ap->id);
+    free(ap);
+}
+
+void attach_free(struct attach *ap)
+{
+    while (ap) {
+	struct attach *next = ap->next;
+	attach_free_one(ap);
+	ap = next;
+    }
+}
+
+/*
+** The stored file filename (a path) has been removed again; forget it.
+*/
+
+void attach_drop(struct attach **listp, const char *filename)
+{
+    const char *base = strrchr(filename, PATH_SEPARATOR);
+    struct attach *ap;
+
+    base = base ? base + 1 : filename;
+    for (; (ap = *listp) != NULL; listp = &ap->next)
+	if (!strcmp(ap->storedas, base)) {
+	    *listp = ap->next;
+	    attach_free_one(ap);
+	    return;
+	}
+}
+
+/*
+** Gives a message the attachments parsemail() stored for it.
+*/
+
+void attach_set(struct emailinfo *email, struct attach *list)
+{
+    attach_free(email->attachments);
+    email->attachments = list;
+}
+
+/*
+** Returns a table of the messages by number, built without touching
+** them (hashnumlookup() gives bodyless messages an empty body).
+*/
+
+static struct emailinfo **messages_by_num(void)
+{
+    struct emailinfo **table;
+    struct hashemail *hp;
+    int i;
+
+    table = (struct emailinfo **)emalloc((max_msgnum + 1)
+					 * sizeof(struct emailinfo *));
+    memset(table, 0, (max_msgnum + 1) * sizeof(struct emailinfo *));
+    for (i = 0; i < HASHSIZE; i++)
+	for (hp = etable[i]; hp != NULL; hp = hp->next)
+	    if (hp->data && hp->data->msgnum >= 0
+		&& hp->data->msgnum <= max_msgnum)
+		table[hp->data->msgnum] = hp->data;
+    return table;
+}
+
+static char *manifest_name(char *dir)
+{
+    char *name;
+
+    trio_asprintf(&name, (dir[strlen(dir) - 1] == PATH_SEPARATOR)
+		  ? "%s%s" : "%s/%s", dir, ATTACHMENT_MANIFEST);
+    return name;
+}
+
+/*
+** Builds the list of a message that was stored before there was a
+** manifest from its attachment directory. The order of the files is
+** the one they were stored in, as far as their names can tell.
+*/
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void attach_scan(char *dir, struct emailinfo *email)
+{
+    char *attdir;
+    DIR *dirp;
+#ifdef HAVE_DIRENT_H
+    struct dirent *entry;
+#else
+    struct direct *entry;
+#endif
+    char **names = NULL;
+    int count = 0, max = 0, i;
+
+    trio_asprintf(&attdir, "%s%c" DIR_PREFIXER "%s", dir, PATH_SEPARATOR,
+		  message_name(email));
+    if ((dirp = opendir(attdir)) == NULL) {
+	free(attdir);
+	return;
+    }
+    while ((entry = readdir(dirp))) {
+	if (entry->d_name[0] == '.')	/* ".", ".." and META_DIR */
+	    continue;
+	if (count == max) {
+	    char **more;
+	    max = max ? max * 2 : 8;
+	    more = (char **)emalloc(max * sizeof(char *));
+	    if (count)
+		memcpy(more, names, count * sizeof(char *));
+	    if (names)
+		free(names);
+	    names = more;
+	}
+	names[count++] = strsav(entry->d_name);
+    }
+    closedir(dirp);
+    if (count)
+	qsort(names, count, sizeof(char *), compare_names);
+
+    for (i = 0; i < count; i++) {
+	struct attach *ap;
+	struct stat stbuf;
+	char *filename;
+	const char *name = strchr(names[i], '-');
+
+	ap = attach_add(&email->attachments, names[i],
+			name ? name + 1 : names[i], NULL, NULL);
+	trio_asprintf(&filename, "%s%c%s", attdir, PATH_SEPARATOR, names[i]);
+	ap->size = stat(filename, &stbuf) ? -1 : (long)stbuf.st_size;
+	free(filename);
+	free(names[i]);
+    }
+    if (names)
+	free(names);
+    free(attdir);
+}
+
+/*
+** Splits the next tab separated field off a manifest line and removes
+** its escapes, in place. Returns NULL if there is none.
+*/
+
+static char *next_field(char **linep)
+{
+    char *field = *linep, *in, *out;
+
+    if (field == NULL)
+	return NULL;
+    for (in = out = field; *in && *in != '\t' && *in != '\n'; in++) {
+	if (*in == '\\' && in[1]) {
+	    ++in;
+	    *out++ = (*in == 't') ? '\t' : (*in == 'n') ? '\n' : *in;
+	}
+	else
+	    *out++ = *in;
+    }
+    *linep = (*in == '\t') ? in + 1 : NULL;
+    *out = '\0';
+    return field;
+}
+
+/*
+** Reads the attachments of the messages loaded from an existing
+** archive.
+*/
+
+void attach_load(char *dir)
+{
+    char *filename = manifest_name(dir);
+    FILE *fp = fopen(filename, "r");
+    struct emailinfo **messages;
+    char line[MAXLINE * 2];
+    int i;
+
+    if (max_msgnum < 0) {
+	if (fp)
+	    fclose(fp);
+	free(filename);
+	return;
+    }
+    messages = messages_by_num();
+    if (fp == NULL || !fgets(line, sizeof(line), fp)
+	|| strcmp(line, MANIFEST_HEADER)) {
+	if (fp)
+	    fclose(fp);
+	free(filename);
+	for (i = 0; i <= max_msgnum; i++)
+	    if (messages[i] && !messages[i]->attachments)
+		attach_scan(dir, messages[i]);
+	free(messages);
+	return;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+	struct attach *ap;
+	char *rest = line;
+	char *num = next_field(&rest);
+	char *size = next_field(&rest);
+	char *storedas = next_field(&rest);
+	char *type = next_field(&rest);
+	char *name = next_field(&rest);
+	char *descr = next_field(&rest);
+	int n = atoi(num);
+
+	if (!storedas || !*storedas || n < 0 || n > max_msgnum
+	    || !messages[n])
+	    continue;
+	ap = attach_add(&messages[n]->attachments, storedas, name, type,
+			descr);
+	ap->size = atol(size);
+    }
+    fclose(fp);
+    free(messages);
+    free(filename);
+}
+
+static void put_field(struct Push *buff, const char *field)
+{
+    if (field == NULL)
+	return;
+    for (; *field; field++) {
+	if (*field == '\t')
+	    PushString(buff, "\\t");
+	else if (*field == '\n')
+	    PushString(buff, "\\n");
+	else if (*field == '\\')
+	    PushString(buff, "\\\\");
+	else
+	    PushByte(buff, *field);
+    }
+}
+
+/*
+** Saves the attachments of all the messages in the archive, or removes
+** the manifest when it isn't kept up to date, so that it gets rebuilt
+** from the attachment directories the next time it's needed.
+*/
+
+void attach_save(char *dir)
+{
+    char *filename = manifest_name(dir);
+    struct emailinfo **messages;
+    struct Push buff;
+    char numbuf[64];
+    int i, rc;
+
+    if (!set_attachmentsindex) {
+	unlink(filename);
+	free(filename);
+	return;
+    }
+
+    INIT_PUSH(buff);
+    PushString(&buff, MANIFEST_HEADER);
+    messages = max_msgnum >= 0 ? messages_by_num() : NULL;
+    for (i = 0; i <= max_msgnum; i++) {
+	struct attach *ap;
+
+	if (!messages[i])
+	    continue;
+	for (ap = messages[i]->attachments; ap; ap = ap->next) {
+	    sprintf(numbuf, "%d\t%ld\t", i, ap->size);
+	    PushString(&buff, numbuf);
+	    put_field(&buff, ap->storedas);
+	    PushByte(&buff, '\t');
+	    put_field(&buff, ap->contenttype);
+	    PushByte(&buff, '\t');
+	    put_field(&buff, ap->name);
+	    PushByte(&buff, '\t');
+	    put_field(&buff, ap->descr);
+	    PushByte(&buff, '\n');
+	}
+    }
+    if (messages)
+	free(messages);
+    rc = output_replace(filename, PUSH_STRING(buff), PUSH_STRLEN(buff),
+			set_filemode);
+    if (rc) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %s.",
+		 lang[MSG_COULD_NOT_WRITE], filename, strerror(rc));
+	progerr(errmsg);
+    }
+    free(PUSH_STRING(buff));
+    free(filename);
+}
+
+/*
+** The content hash of an attachment, computed while it's being written.
+*/
+
+void attach_digest_init(struct attach_digest *digest)
+{
+    digest->hash = FNV64_INIT;
+    digest->size = 0;
+}
+
+void attach_digest_add(struct attach_digest *digest, const char *data,
+		       int len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + len;
+    unsigned long long h = digest->hash;
+
+    while (p < end) {
+	h ^= *p++;
+	h *= FNV64_PRIME;
+    }
+    digest->hash = h;
+    digest->size += len;
+}
+
+/*
+** The name of a blob in the store, relative to the archive directory
+** when dir is NULL.
+*/
+
+static char *store_name(char *dir, const struct attach_digest *digest)
+{
+    char *name;
+
+    if (dir)
+	trio_asprintf(&name, "%s%c%s%c%02x%c%016llx-%ld", dir, PATH_SEPARATOR,
+		      ATTACHMENT_STORE, PATH_SEPARATOR,
+		      (unsigned)(digest->hash >> 56), PATH_SEPARATOR,
+		      digest->hash, digest->size);
+    else
+	trio_asprintf(&name, "%s/%02x/%016llx-%ld", ATTACHMENT_STORE,
+		      (unsigned)(digest->hash >> 56), digest->hash,
+		      digest->size);
+    return name;
+}
+
+/*
+** Compares the file name with len bytes of data, or with the file
+** other when data is NULL.
+*/
+
+static int same_content(const char *name, const char *data, long len,
+			const char *other)
+{
+    char buf[8192], obuf[8192];
+    FILE *fp, *ofp = NULL;
+    int same = 1;
+
+    if ((fp = fopen(name, "rb")) == NULL)
+	return 0;
+    if (!data && (ofp = fopen(other, "rb")) == NULL) {
+	fclose(fp);
+	return 0;
+    }
+    while (same) {
+	size_t got = fread(buf, 1, sizeof(buf), fp);
+	if (data) {
+	    if (got > (size_t)len || memcmp(buf, data, got))
+		same = 0;
+	    data += got;
+	    len -= got;
+	}
+	else if (fread(obuf, 1, got, ofp) != got || memcmp(buf, obuf, got))
+	    same = 0;
+	if (got < sizeof(buf))
+	    break;
+    }
+    if (same)
+	same = data ? (len == 0) : (getc(ofp) == EOF);
+    fclose(fp);
+    if (ofp)
+	fclose(ofp);
+    return same;
+}
+
+/*
+** Makes filename a link to the stored blob, in one step so that it's
+** never missing. Returns 0 on success.
+*/
+
+static int link_to_store(char *dir, const char *filename,
+			 const struct attach_digest *digest)
+{
+    char *tmp, *blob;
+    int rc;
+
+    trio_asprintf(&tmp, "%s.hm2tmp", filename);
+    unlink(tmp);
+    if (!strcmp(set_attachment_store, "symlink")) {
+	/* the attachment directories are right below the archive */
+	char *target = store_name(NULL, digest);
+	trio_asprintf(&blob, "..%c%s", PATH_SEPARATOR, target);
+	free(target);
+	rc = symlink(blob, tmp);
+    }
+    else {
+	blob = store_name(dir, digest);
+	rc = link(blob, tmp);
+    }
+    if (!rc && (rc = rename(tmp, filename)) != 0)
+	unlink(tmp);
+    free(blob);
+    free(tmp);
+    return rc;
+}
+
+/*
+** An attachment that is still all in memory, in data, is about to be
+** written to filename. If the store already has it, filename is made a
+** link to the stored copy and nothing needs to be written; returns
+** TRUE in that case.
+*/
+
+int attach_link_stored(char *dir, const char *filename,
+		       const struct attach_digest *digest, const char *data)
+{
+    char *blob;
+    struct stat stbuf;
+    int linked = FALSE;
+
+    if (!digest->size)
+	return FALSE;
+    blob = store_name(dir, digest);
+    if (!stat(blob, &stbuf) && stbuf.st_size == digest->size
+	&& same_content(blob, data, digest->size, NULL))
+	linked = !link_to_store(dir, filename, digest);
+    free(blob);
+    return linked;
+}
+
+/*
+** filename has been written. Adds it to the store, or replaces it with a
+** link to the copy already there.
+*/
+
+void attach_store(char *dir, const char *filename,
+		  const struct attach_digest *digest)
+{
+    char *blob, *subdir;
+    struct stat stbuf;
+
+    if (!digest->size)
+	return;
+    blob = store_name(dir, digest);
+    if (!stat(blob, &stbuf)) {
+	if (stbuf.st_size == digest->size
+	    && same_content(blob, NULL, 0, filename))
+	    link_to_store(dir, filename, digest);
+	free(blob);
+	return;
+    }
+
+    trio_asprintf(&subdir, "%s%c%s", dir, PATH_SEPARATOR, ATTACHMENT_STORE);
+    check1dir(subdir);
+    free(subdir);
+    subdir = strsav(blob);
+    *strrchr(subdir, PATH_SEPARATOR) = '\0';
+    check1dir(subdir);
+    free(subdir);
+
+    if (!strcmp(set_attachment_store, "symlink")) {
+	if (!rename(filename, blob) && link_to_store(dir, filename, digest))
+	    rename(blob, filename);	/* no symlinks here, put it back */
+    }
+    else
+	link(filename, blob);	/* if that fails, it's simply not shared */
+    free(blob);
+}
@@ -0,0 +1,21 @@
+/*
+** attach.c functions
+*/
+
+struct attach_digest {
+    unsigned long long hash;	/* FNV-1a of the content */
+    long size;
+};
+
+struct attach *attach_add(struct attach **, const char *, const char *,
+			  const char *, const char *);
+void attach_free(struct attach *);
+void attach_drop(struct attach **, const char *);
+void attach_set(struct emailinfo *, struct attach *);
+void attach_load(char *);
+void attach_save(char *);
+void attach_digest_init(struct attach_digest *);
+void attach_digest_add(struct attach_digest *, const char *, int);
+int attach_link_stored(char *, const char *, const struct attach_digest *,
+		       const char *);
+void attach_store(char *, const char *, const struct attach_digest *);
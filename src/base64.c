@@ -15,31 +15,79 @@
 #include "hypermail.h"
 #include "base64.h"
 
+/*
+** The value of every base64 character, or one of these.
+*/
+
+#define B64_SKIP 64		/* not in the alphabet, ignored */
+#define B64_PAD  65		/* '=' */
+
+static unsigned char b64_value[256];
+static unsigned char qp_value[256];	/* hex digits, or 16 */
+
+static void decode_tables(void)
+{
+    static int done = 0;
+    int i;
+
+    if (done)
+	return;
+    for (i = 0; i < 256; i++) {
+	b64_value[i] = B64_SKIP;
+	qp_value[i] = 16;
+    }
+    for (i = 0; i < 26; i++) {
+	b64_value['A' + i] = i;
+	b64_value['a' + i] = i + 26;
+    }
+    for (i = 0; i < 10; i++) {
+	b64_value['0' + i] = i + 52;
+	qp_value['0' + i] = i;
+    }
+    b64_value['+'] = 62;
+    b64_value['/'] = 63;
+    b64_value['='] = B64_PAD;
+    for (i = 0; i < 6; i++) {
+	qp_value['A' + i] = i + 10;
+	qp_value['a' + i] = i + 10;
+    }
+    done = 1;
+}
+
 void base64Decode(char *intext, char *out, int *length)
 {
+    const unsigned char *in = (const unsigned char *)intext;
+    unsigned char *o = (unsigned char *)out;
     unsigned char ibuf[4];
-    unsigned char obuf[3];
-    char ignore;
     char endtext = FALSE;
-    char ch;
     int lindex = 0;
-    *length = 0;
 
+    decode_tables();
     memset(ibuf, 0, sizeof(ibuf));
 
-    while (*intext) {
-	ch = *intext;
-
-	ignore = FALSE;
-	if ((ch >= 'A') && (ch <= 'Z'))
-	    ch = ch - 'A';
-	else if ((ch >= 'a') && (ch <= 'z'))
-	    ch = ch - 'a' + 26;
-	else if ((ch >= '0') && (ch <= '9'))
-	    ch = ch - '0' + 52;
-	else if (ch == '+')
-	    ch = 62;
-	else if (ch == '=') {	/* end of text */
+    while (*in) {
+	unsigned char ch;
+
+	/* whole groups of four, the common case */
+	if (lindex == 0 && !endtext) {
+	    while (b64_value[in[0]] < 64 && b64_value[in[1]] < 64
+		   && b64_value[in[2]] < 64 && b64_value[in[3]] < 64) {
+		unsigned long v = ((unsigned long)b64_value[in[0]] << 18)
+		    | ((unsigned long)b64_value[in[1]] << 12)
+		    | ((unsigned long)b64_value[in[2]] << 6)
+		    | b64_value[in[3]];
+		o[0] = (unsigned char)(v >> 16);
+		o[1] = (unsigned char)(v >> 8);
+		o[2] = (unsigned char)v;
+		o += 3;
+		in += 4;
+	    }
+	    if (!*in)
+		break;
+	}
+
+	ch = b64_value[*in];
+	if (ch == B64_PAD) {	/* end of text */
 	    if (endtext)
 		break;
 	    endtext = TRUE;
@@ -47,48 +95,92 @@ void base64Decode(char *intext, char *out, int *length)
 	    if (lindex < 0)
 		lindex = 3;
 	}
-	else if (ch == '/')
-	    ch = 63;
-	else if (endtext)
-	    break;
-	else
-	    ignore = TRUE;
+	else if (ch == B64_SKIP) {
+	    if (endtext)
+		break;
+	    in++;
+	    continue;
+	}
 
-	if (!ignore) {
-	    if (!endtext) {
-		ibuf[lindex] = ch;
+	if (!endtext) {
+	    ibuf[lindex] = ch;
+	    lindex++;
+	    lindex &= 3;	/* use bit arithmetic instead of remainder */
+	}
+	if ((0 == lindex) || endtext) {
+	    unsigned char obuf[3];
 
-		lindex++;
-		lindex &= 3;	/* use bit arithmetic instead of remainder */
-	    }
-	    if ((0 == lindex) || endtext) {
-
-		obuf[0] = (ibuf[0] << 2) | ((ibuf[1] & 0x30) >> 4);
-		obuf[1] =
-		    ((ibuf[1] & 0x0F) << 4) | ((ibuf[2] & 0x3C) >> 2);
-		obuf[2] = ((ibuf[2] & 0x03) << 6) | (ibuf[3] & 0x3F);
-
-		switch (lindex) {
-		case 1:
-		    sprintf(out, "%c", obuf[0]);
-		    out++;
-		    (*length)++;
-		    break;
-		case 2:
-		    sprintf(out, "%c%c", obuf[0], obuf[1]);
-		    out += 2;
-		    (*length) += 2;
-		    break;
-		default:
-		    sprintf(out, "%c%c%c", obuf[0], obuf[1], obuf[2]);
-		    out += 3;
-		    (*length) += 3;
-		    break;
-		}
-		memset(ibuf, 0, sizeof(ibuf));
+	    obuf[0] = (ibuf[0] << 2) | ((ibuf[1] & 0x30) >> 4);
+	    obuf[1] = ((ibuf[1] & 0x0F) << 4) | ((ibuf[2] & 0x3C) >> 2);
+	    obuf[2] = ((ibuf[2] & 0x03) << 6) | (ibuf[3] & 0x3F);
+
+	    switch (lindex) {
+	    case 1:
+		*o++ = obuf[0];
+		break;
+	    case 2:
+		*o++ = obuf[0];
+		*o++ = obuf[1];
+		break;
+	    default:
+		*o++ = obuf[0];
+		*o++ = obuf[1];
+		*o++ = obuf[2];
+		break;
 	    }
+	    memset(ibuf, 0, sizeof(ibuf));
 	}
-	intext++;
+	in++;
+    }
+    *o = 0;
+    *length = (char *)o - out;
+}
+
+/*
+** Decodes a Quoted-Printable line as defined by RFC2045 into out, which
+** must have room for strlen(in) + 1 bytes. Decoding stops at the end of
+** the line or at a soft line break ("=" at the end of the line), in
+** which case *soft is set and the text continues on the next line.
+** Returns the number of bytes written, not counting the terminating
+** zero.
+*/
+
+int qpDecode(const char *in, char *out, int *soft)
+{
+    char *o = out;
+
+    decode_tables();
+    *soft = FALSE;
+    for (;;) {
+	const char *eq = strchr(in, '=');
+	unsigned char hi, lo;
+
+	if (!eq) {
+	    size_t rest = strlen(in);
+	    memcpy(o, in, rest);
+	    o += rest;
+	    break;
+	}
+	memcpy(o, in, eq - in);
+	o += eq - in;
+	in = eq + 1;
+	if (*in == '\n') {
+	    *soft = TRUE;
+	    break;
+	}
+	if (*in == '=') {
+	    *o++ = '=';
+	    in++;
+	}
+	else if ((hi = qp_value[(unsigned char)*in]) < 16) {
+	    /* one or two hex digits, but always pass two letters */
+	    lo = qp_value[(unsigned char)in[1]];
+	    *o++ = (lo < 16) ? (char)(hi << 4 | lo) : (char)hi;
+	    in += in[1] ? 2 : 1;
+	}
+	else
+	    *o++ = '=';
     }
-    *out = 0;
+    *o = 0;
+    return o - out;
 }
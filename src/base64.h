@@ -3,3 +3,4 @@
 */
 
 void base64Decode(char *, char *, int *);
+int qpDecode(const char *, char *, int *);
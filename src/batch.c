@@ -0,0 +1,286 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+
+/*
+** Batch mode: one hypermail run for many archives.
+**
+** "--batch=manifest" reads one job per line from the manifest, each
+** the config file, mailbox and archive directory of a list, optionally
+** followed by more command line options for that list only:
+**
+**   lists/foo.rc  /var/mail/foo  /www/archives/foo  -u
+**
+** The batch itself goes through the start of main() with its own
+** command line: it reads its configuration, sets up the language,
+** reads the header and footer templates and then, in batch_prepare(),
+** compiles the templates and the filter patterns. The jobs run in
+** child processes forked from there, at most "--jobs=N" at a time (by
+** default as many as there are processors). A job whose config file is
+** "-" or the batch's own, and whose options don't change the setup,
+** keeps all of that and only takes its mailbox, directory and options.
+** Any other job runs hypermail afresh with its own command line. All
+** the state a run keeps in globals stays its own either way.
+*/
+
+#include <sys/wait.h>
+
+#include "hypermail.h"
+#include "setup.h"
+#include "printfile.h"
+#include "regexset.h"
+#include "stats.h"
+#include "batch.h"
+
+#define MAX_JOB_ARGS 64
+
+struct job {
+    int line;			/* in the manifest */
+    char *dir;
+    pid_t pid;
+};
+
+static char *batch_file;
+static int batch_jobs;
+
+/*
+** Looks for --batch=manifest and --jobs=N in the arguments and takes
+** them out. Returns TRUE if there is a batch to run.
+*/
+
+int batch_args(int *argcp, char **argv)
+{
+    int i, j;
+
+    for (i = 1; i < *argcp; i++) {
+	if (!strcmp(argv[i], "--"))
+	    break;
+	if (!strncmp(argv[i], "--batch=", 8))
+	    batch_file = argv[i] + 8;
+	else if (!strncmp(argv[i], "--jobs=", 7))
+	    batch_jobs = atoi(argv[i] + 7);
+	else
+	    continue;
+	for (j = i; j < *argcp; j++)
+	    argv[j] = argv[j + 1];
+	--*argcp;
+	--i;
+    }
+    return batch_file != NULL;
+}
+
+/*
+** The command line of a job run afresh: ours with the job's options
+** after it, so they win, and its own file for --stats=file.
+*/
+
+static char **job_argv(int argc, char **argv, char **words, int nwords,
+		       int line)
+{
+    char **nargv = (char **)emalloc((argc + nwords + 8) * sizeof(char *));
+    int i, n = 0;
+
+    for (i = 0; i < argc; i++)
+	nargv[n++] = argv[i];
+    if (stats_file && !strcmp(stats_file, "-"))
+	nargv[n++] = "--stats";
+    else if (stats_file)
+	trio_asprintf(&nargv[n++], "--stats=%s.%d", stats_file, line);
+    if (strcmp(words[0], "-")) {
+	nargv[n++] = "-c";
+	nargv[n++] = words[0];
+    }
+    nargv[n++] = "-m";
+    nargv[n++] = words[1];
+    nargv[n++] = "-d";
+    nargv[n++] = words[2];
+    for (i = 3; i < nwords; i++)
+	nargv[n++] = words[i];
+    nargv[n] = NULL;
+    return nargv;
+}
+
+/*
+** Tells whether a job can go on with the setup the batch did: it uses
+** the same config file, and none of its options are read before the
+** setup (-c, -L, -o, -v) or bundled in a way we'd have to take apart.
+*/
+
+static int job_shares_setup(char **words, int nwords, const char *configfile)
+{
+    int i;
+
+    if (strcmp(words[0], "-") && strcmp(words[0], configfile))
+	return 0;
+    for (i = 3; i < nwords; i++) {
+	const char *w = words[i];
+
+	if (w[0] != '-' || !w[1] || w[2] || strchr("cLovV?", w[1]))
+	    return 0;
+	if (strchr("abdlmns0", w[1]))
+	    ++i;		/* skip the argument */
+    }
+    return 1;
+}
+
+/*
+** Compiles what the jobs would otherwise each compile on first use, so
+** they all inherit it.
+*/
+
+static void batch_prepare(void)
+{
+    compile_templates();
+    regex_prepare(set_filter_out);
+    regex_prepare(set_filter_require);
+    regex_prepare(set_filter_out_full_body);
+    regex_prepare(set_filter_require_full_body);
+}
+
+/*
+** Waits for one of the running jobs to end. Returns 1 if it failed.
+*/
+
+static int reap(struct job *running, int *nrunning)
+{
+    int status, i;
+    pid_t pid;
+
+    do
+	pid = wait(&status);
+    while (pid == -1 && errno == EINTR);
+    if (pid == -1)
+	return 0;
+    for (i = 0; i < *nrunning; i++)
+	if (running[i].pid == pid)
+	    break;
+    if (i == *nrunning)
+	return 0;
+    status = !WIFEXITED(status) || WEXITSTATUS(status);
+    if (status)
+	fprintf(stderr, "%s: %s:%d: job for \"%s\" failed\n", PROGNAME,
+		batch_file, running[i].line, running[i].dir);
+    free(running[i].dir);
+    running[i] = running[--*nrunning];
+    return status;
+}
+
+/*
+** Runs the jobs of the manifest. Returns only in a child process whose
+** job shares the batch's setup, with set_mbox and set_dir set for it
+** and *argcp and *argvp set to its options. Other jobs run hypermail
+** again; the parent exits when all the jobs are done, with 1 if any
+** failed.
+*/
+
+void batch_run(int *argcp, char ***argvp, const char *configfile)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    struct job *running;
+    int nrunning = 0, failed = 0, lineno = 0;
+
+    if (batch_jobs <= 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+	batch_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (batch_jobs <= 0)
+	    batch_jobs = 1;
+    }
+    if (!strcmp(batch_file, "-"))
+	fp = stdin;
+    else if ((fp = fopen(batch_file, "r")) == NULL) {
+	snprintf(errmsg, sizeof(errmsg), "Couldn't open batch file \"%s\".",
+		 batch_file);
+	progerr(errmsg);
+    }
+    batch_prepare();
+    running = (struct job *)emalloc(batch_jobs * sizeof(struct job));
+    fflush(stdout);
+    fflush(stderr);
+
+    while (fgets(line, sizeof(line), fp)) {
+	char *words[MAX_JOB_ARGS];
+	char **nargv;
+	char *p;
+	int nwords = 0, i;
+	pid_t pid;
+
+	++lineno;
+	for (p = strtok(line, " \t\r\n"); p && nwords < MAX_JOB_ARGS;
+	     p = strtok(NULL, " \t\r\n"))
+	    words[nwords++] = p;
+	if (!nwords || *words[0] == '#')
+	    continue;
+	if (nwords < 3) {
+	    fprintf(stderr, "%s: %s:%d: need a config file, a mailbox "
+		    "and a directory\n", PROGNAME, batch_file, lineno);
+	    failed = 1;
+	    continue;
+	}
+
+	while (nrunning >= batch_jobs)
+	    failed |= reap(running, &nrunning);
+
+	pid = fork();
+	if (pid == -1) {
+	    snprintf(errmsg, sizeof(errmsg), "Couldn't fork for %s:%d: %s.",
+		     batch_file, lineno, strerror(errno));
+	    progerr(errmsg);
+	}
+	if (pid == 0) {
+	    if (fp != stdin)
+		fclose(fp);
+	    free(running);
+	    if (!job_shares_setup(words, nwords, configfile)) {
+		nargv = job_argv(*argcp, *argvp, words, nwords, lineno);
+		execvp(nargv[0], nargv);
+		fprintf(stderr, "%s: %s:%d: couldn't run %s: %s\n", PROGNAME,
+			batch_file, lineno, nargv[0], strerror(errno));
+		_exit(1);
+	    }
+	    set_mbox = strreplace(set_mbox, words[1]);
+	    set_dir = strreplace(set_dir, words[2]);
+	    reset_localtime();
+	    if (stats_file && strcmp(stats_file, "-")) {
+		char *name;
+
+		trio_asprintf(&name, "%s.%d", stats_file, lineno);
+		stats_restart(name);
+	    }
+	    else
+		stats_restart(stats_file);
+	    /* the job's options, after a program name for getopt() */
+	    nargv = (char **)emalloc((nwords - 1) * sizeof(char *));
+	    nargv[0] = (*argvp)[0];
+	    for (i = 3; i < nwords; i++)
+		nargv[i - 2] = strsav(words[i]);
+	    nargv[nwords - 2] = NULL;
+	    *argcp = nwords - 2;
+	    *argvp = nargv;
+	    return;
+	}
+	running[nrunning].line = lineno;
+	running[nrunning].dir = strsav(words[2]);
+	running[nrunning].pid = pid;
+	nrunning++;
+    }
+    if (fp != stdin)
+	fclose(fp);
+    while (nrunning)
+	failed |= reap(running, &nrunning);
+    exit(failed);
+}
@@ -0,0 +1,6 @@
+/*
+** batch.c functions
+*/
+
+int batch_args(int *, char **);
+void batch_run(int *, char ***, const char *);
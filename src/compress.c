@@ -0,0 +1,353 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+/*
+** Precompressed copies of the generated pages.
+**
+** When the compress_output option is set, every page hypermail writes
+** is registered here. Pages are rewritten several times during a run
+** (replies and thread links are fixed up after the fact in incremental
+** mode), so nothing is compressed until compress_flush() is called at
+** the very end; by then each page is in its final state and the .gz
+** and .br copies written next to it are guaranteed to match it.
+*/
+
+#include <fcntl.h>
+
+#include "hypermail.h"
+#include "setup.h"
+#include "struct.h"
+#include "compress.h"
+#include "output.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+struct compress_page {
+    char *filename;
+    int failed;			/* errno of the first failure, or 0 */
+    struct compress_page *next;
+};
+
+static struct compress_page *pagetable[HASHSIZE];
+static struct compress_page **pagequeue;
+static int pagecount;
+static int formats = -1;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static int next_page;
+
+/*
+** Returns the COMPRESS_ bit for a compress_output value, or 0 if it
+** isn't one. Case doesn't matter.
+*/
+
+int compress_format(const char *name)
+{
+    if (!strcasecmp(name, "gzip") || !strcasecmp(name, "gz"))
+	return COMPRESS_GZIP;
+    if (!strcasecmp(name, "brotli") || !strcasecmp(name, "br"))
+	return COMPRESS_BROTLI;
+    return 0;
+}
+
+static int compress_formats(void)
+{
+    struct hmlist *hl;
+
+    if (formats == -1) {
+	formats = 0;
+	for (hl = set_compress_output; hl != NULL; hl = hl->next)
+	    formats |= compress_format(hl->val);
+    }
+    return formats;
+}
+
+/*
+** Remember that filename has been (re)written during this run.
+*/
+
+void compress_register(const char *filename)
+{
+    struct compress_page *pp;
+    unsigned hashval;
+
+    if (!compress_formats())
+	return;
+
+    hashval = hash((char *)filename);
+    for (pp = pagetable[hashval]; pp != NULL; pp = pp->next)
+	if (!strcmp(pp->filename, filename))
+	    return;
+
+    pp = (struct compress_page *)emalloc(sizeof(struct compress_page));
+    pp->filename = strsav(filename);
+    pp->failed = 0;
+    pp->next = pagetable[hashval];
+    pagetable[hashval] = pp;
+    ++pagecount;
+}
+
+/*
+** filename was left untouched by this run; only register it if some
+** of its compressed copies are missing, e.g. the first time a format
+** is requested.
+*/
+
+void compress_check(const char *filename)
+{
+    struct stat stbuf;
+    char *variant;
+    int missing = 0;
+
+    if (!compress_formats())
+	return;
+
+    if (formats & COMPRESS_GZIP) {
+	trio_asprintf(&variant, "%s.gz", filename);
+	missing |= stat(variant, &stbuf) == -1;
+	free(variant);
+    }
+    if (formats & COMPRESS_BROTLI) {
+	trio_asprintf(&variant, "%s.br", filename);
+	missing |= stat(variant, &stbuf) == -1;
+	free(variant);
+    }
+    if (missing)
+	compress_register(filename);
+}
+
+/*
+** A page is being removed from the archive; remove its compressed
+** copies too so they don't outlive it.
+*/
+
+void compress_remove(const char *filename)
+{
+    char *variant;
+
+    if (!compress_formats())
+	return;
+
+    trio_asprintf(&variant, "%s.gz", filename);
+    unlink(variant);
+    free(variant);
+    trio_asprintf(&variant, "%s.br", filename);
+    unlink(variant);
+    free(variant);
+}
+
+static int write_variant(const char *filename, const char *ext,
+			 const unsigned char *data, size_t len)
+{
+    size_t flen = strlen(filename);
+    char *target = (char *)malloc(flen + strlen(ext) + 1);
+    int rc;
+
+    /* built by hand: this runs in the worker threads */
+    if (!target)
+	return ENOMEM;
+    memcpy(target, filename, flen);
+    strcpy(target + flen, ext);
+    rc = output_replace(target, (const char *)data, len, set_filemode);
+    free(target);
+    return rc;
+}
+
+#ifdef HAVE_LIBZ
+static int gzip_variant(const char *filename, const unsigned char *data, size_t len)
+{
+    z_stream zs;
+    unsigned char *out;
+    int rc;
+
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+		     Z_DEFAULT_STRATEGY) != Z_OK)
+	return ENOMEM;
+    out = (unsigned char *)malloc(deflateBound(&zs, len));
+    if (!out) {
+	deflateEnd(&zs);
+	return ENOMEM;
+    }
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = out;
+    zs.avail_out = deflateBound(&zs, len);
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+	rc = EIO;
+    else
+	rc = write_variant(filename, ".gz", out, zs.total_out);
+    deflateEnd(&zs);
+    free(out);
+    return rc;
+}
+#endif
+
+#ifdef HAVE_BROTLI
+static int brotli_variant(const char *filename, const unsigned char *data, size_t len)
+{
+    size_t outlen = BrotliEncoderMaxCompressedSize(len);
+    unsigned char *out;
+    int rc;
+
+    if (!outlen || !(out = (unsigned char *)malloc(outlen)))
+	return ENOMEM;
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+			       BROTLI_MODE_TEXT, len, data, &outlen, out))
+	rc = EIO;
+    else
+	rc = write_variant(filename, ".br", out, outlen);
+    free(out);
+    return rc;
+}
+#endif
+
+static void compress_one(struct compress_page *pp)
+{
+    struct stat stbuf;
+    unsigned char *data;
+    int fd;
+    ssize_t got = 0;
+
+    fd = open(pp->filename, O_RDONLY);
+    if (fd == -1) {
+	/* removed after it was written, e.g. an empty monthly index */
+	if (errno != ENOENT)
+	    pp->failed = errno;
+	return;
+    }
+    if (fstat(fd, &stbuf) == -1
+	|| !(data = (unsigned char *)malloc(stbuf.st_size + 1))) {
+	pp->failed = errno ? errno : ENOMEM;
+	close(fd);
+	return;
+    }
+    while (got < stbuf.st_size) {
+	ssize_t n = read(fd, data + got, stbuf.st_size - got);
+	if (n <= 0) {
+	    if (n == -1 && errno == EINTR)
+		continue;
+	    pp->failed = n ? errno : EIO;
+	    break;
+	}
+	got += n;
+    }
+    close(fd);
+
+#ifdef HAVE_LIBZ
+    if (!pp->failed && (formats & COMPRESS_GZIP))
+	pp->failed = gzip_variant(pp->filename, data, got);
+#endif
+#ifdef HAVE_BROTLI
+    if (!pp->failed && (formats & COMPRESS_BROTLI))
+	pp->failed = brotli_variant(pp->filename, data, got);
+#endif
+    free(data);
+
+    if (!pp->failed && set_compress_output_only)
+	unlink(pp->filename);
+}
+
+static void *compress_worker(void *arg)
+{
+    for (;;) {
+	int i;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&queue_lock);
+#endif
+	i = next_page++;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&queue_lock);
+#endif
+	if (i >= pagecount)
+	    break;
+	compress_one(pagequeue[i]);
+    }
+    return arg;
+}
+
+/*
+** Write the compressed copies of every page registered during this run.
+*/
+
+void compress_flush(void)
+{
+    struct compress_page *pp;
+    int i, n, nthreads;
+
+    if (!pagecount)
+	return;
+
+    pagequeue = (struct compress_page **)
+	emalloc(pagecount * sizeof(struct compress_page *));
+    for (i = 0, n = 0; i < HASHSIZE; i++)
+	for (pp = pagetable[i]; pp != NULL; pp = pp->next)
+	    pagequeue[n++] = pp;
+    next_page = 0;
+
+    if (set_showprogress)
+	printf("Compressing %d pages...", pagecount);
+
+    nthreads = set_compress_threads;
+#ifdef HAVE_PTHREAD
+#ifdef _SC_NPROCESSORS_ONLN
+    if (nthreads <= 0)
+	nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nthreads > pagecount)
+	nthreads = pagecount;
+    if (nthreads > 1) {
+	pthread_t *workers = (pthread_t *)emalloc(nthreads * sizeof(pthread_t));
+	int started;
+	for (started = 0; started < nthreads; started++)
+	    if (pthread_create(&workers[started], NULL, compress_worker, NULL))
+		break;
+	compress_worker(NULL);	/* help out, and cover a failed create */
+	for (i = 0; i < started; i++)
+	    pthread_join(workers[i], NULL);
+	free(workers);
+    }
+    else
+#endif
+	compress_worker(NULL);
+
+    if (set_showprogress)
+	putchar('\n');
+
+    for (i = 0; i < pagecount; i++) {
+	pp = pagequeue[i];
+	if (pp->failed)
+	    fprintf(stderr, "%s: %s \"%s\": %s\n", PROGNAME,
+		    lang[MSG_COULD_NOT_WRITE], pp->filename,
+		    strerror(pp->failed));
+	free(pp->filename);
+	free(pp);
+    }
+    free(pagequeue);
+    pagequeue = NULL;
+    memset(pagetable, 0, sizeof(pagetable));
+    pagecount = 0;
+}
@@ -0,0 +1,12 @@
+/*
+** compress.c functions
+*/
+
+#define COMPRESS_GZIP    1
+#define COMPRESS_BROTLI  2
+
+int compress_format(const char *);
+void compress_register(const char *);
+void compress_check(const char *);
+void compress_remove(const char *);
+void compress_flush(void);
@@ -70,21 +70,26 @@ time_t convtoyearsecs(char *date)
     return yearsecs;
 }
 
+static char localtime_str[DATESTRLEN + 5];
+
 /* 
-** Gets the local time and returns it formatted.
+** Gets the local time and returns it formatted. This is the time
+** the archive was generated: it's computed once, so that all the
+** pages written by a run carry the same date.
 */
 
 char *getlocaltime(void)
 {
-    static char s[DATESTRLEN + 5];
+    char *s = localtime_str;
     time_t tp;
     struct tm *tmptr;
 
+    if (s[0])
+	return s;
+
     time(&tp);
     tmptr = (set_gmtime ? gmtime(&tp) : localtime(&tp));
 
-    s[0] = '\0';
-
     if (set_dateformat != NULL) {
 	strftime(s, DATESTRLEN, set_dateformat, tmptr);
         /* 
@@ -111,6 +116,16 @@ char *getlocaltime(void)
     return s;
 }
 
+/*
+** Forgets the time getlocaltime() computed, for a new run in the same
+** process.
+*/
+
+void reset_localtime(void)
+{
+    localtime_str[0] = '\0';
+}
+
 /* 
 ** Gets the local time zone.
 */
@@ -0,0 +1,297 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+/*
+** Microbenchmark for the MIME decoders in base64.c.
+**
+** Decodes the same generated base64 and quoted-printable lines with
+** the current decoders and with the character-at-a-time versions they
+** replaced, checks that both give the same bytes, and prints the
+** throughput of each. Build with "make decodebench" in src/.
+**
+** usage: decodebench [megabytes]
+*/
+
+#include <sys/time.h>
+
+#include "hypermail.h"
+#include "base64.h"
+
+/* so that base64.o links without mem.o and its friends */
+void *emalloc(int i)
+{
+    void *p = malloc(i);
+
+    if (p == NULL) {
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+    }
+    return p;
+}
+
+/*
+** The decoders as they were, for comparison.
+*/
+
+static void old_base64Decode(char *intext, char *out, int *length)
+{
+    unsigned char ibuf[4];
+    unsigned char obuf[3];
+    char ignore;
+    char endtext = FALSE;
+    char ch;
+    int lindex = 0;
+    *length = 0;
+
+    memset(ibuf, 0, sizeof(ibuf));
+
+    while (*intext) {
+	ch = *intext;
+
+	ignore = FALSE;
+	if ((ch >= 'A') && (ch <= 'Z'))
+	    ch = ch - 'A';
+	else if ((ch >= 'a') && (ch <= 'z'))
+	    ch = ch - 'a' + 26;
+	else if ((ch >= '0') && (ch <= '9'))
+	    ch = ch - '0' + 52;
+	else if (ch == '+')
+	    ch = 62;
+	else if (ch == '=') {	/* end of text */
+	    if (endtext)
+		break;
+	    endtext = TRUE;
+	    lindex--;
+	    if (lindex < 0)
+		lindex = 3;
+	}
+	else if (ch == '/')
+	    ch = 63;
+	else if (endtext)
+	    break;
+	else
+	    ignore = TRUE;
+
+	if (!ignore) {
+	    if (!endtext) {
+		ibuf[lindex] = ch;
+
+		lindex++;
+		lindex &= 3;	/* use bit arithmetic instead of remainder */
+	    }
+	    if ((0 == lindex) || endtext) {
+
+		obuf[0] = (ibuf[0] << 2) | ((ibuf[1] & 0x30) >> 4);
+		obuf[1] =
+		    ((ibuf[1] & 0x0F) << 4) | ((ibuf[2] & 0x3C) >> 2);
+		obuf[2] = ((ibuf[2] & 0x03) << 6) | (ibuf[3] & 0x3F);
+
+		switch (lindex) {
+		case 1:
+		    sprintf(out, "%c", obuf[0]);
+		    out++;
+		    (*length)++;
+		    break;
+		case 2:
+		    sprintf(out, "%c%c", obuf[0], obuf[1]);
+		    out += 2;
+		    (*length) += 2;
+		    break;
+		default:
+		    sprintf(out, "%c%c%c", obuf[0], obuf[1], obuf[2]);
+		    out += 3;
+		    (*length) += 3;
+		    break;
+		}
+		memset(ibuf, 0, sizeof(ibuf));
+	    }
+	}
+	intext++;
+    }
+    *out = 0;
+}
+
+/* the line loop of the old mdecodeQP(), without the soft line breaks */
+static int old_qpDecode(char *input, char **result)
+{
+    int outcount = 0;
+    unsigned char inchar;
+    char *output;
+    int len = strlen(input);
+
+    output = (char *)emalloc(len + 1);
+    strcpy(output, input);
+    while ((inchar = *input) != '\0') {
+	if (outcount >= len - 1) {
+	    char *newp = (char *)realloc(output, len * 2);
+	    if (newp) {
+		output = newp;
+		len *= 2;
+	    }
+	    else
+		break;
+	}
+	input++;
+	if ('=' == inchar) {
+	    int value;
+	    if ('\n' == *input)
+		break;
+	    else if ('=' == *input) {
+		inchar = '=';
+		input++;
+	    }
+	    else if (isxdigit(*input)) {
+		sscanf(input, "%02X", &value);
+		inchar = (unsigned char)value;
+		input += 2;
+	    }
+	    else
+		inchar = '=';
+	}
+	output[outcount++] = inchar;
+    }
+    output[outcount] = 0;
+    *result = output;
+    return outcount;
+}
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static const char b64chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* nlines lines of 76 characters, as a mailer writes them */
+static char **make_base64(int nlines)
+{
+    char **lines = (char **)emalloc(nlines * sizeof(char *));
+    int i, j;
+
+    for (i = 0; i < nlines; i++) {
+	lines[i] = (char *)emalloc(78);
+	for (j = 0; j < 76; j++)
+	    lines[i][j] = b64chars[rand() % 64];
+	if (i == nlines - 1 && i % 2)
+	    lines[i][74] = lines[i][75] = '=';
+	lines[i][76] = '\n';
+	lines[i][77] = '\0';
+    }
+    return lines;
+}
+
+/* text with roughly one encoded character in eight */
+static char **make_qp(int nlines)
+{
+    char **lines = (char **)emalloc(nlines * sizeof(char *));
+    static const char hex[] = "0123456789ABCDEF";
+    int i, j;
+
+    for (i = 0; i < nlines; i++) {
+	char *p = lines[i] = (char *)emalloc(80);
+	for (j = 0; j < 72;) {
+	    int c = rand() % 8 ? 'a' + rand() % 26 : 128 + rand() % 128;
+	    if (c < 128)
+		p[j++] = c;
+	    else {
+		p[j++] = '=';
+		p[j++] = hex[c >> 4];
+		p[j++] = hex[c & 15];
+	    }
+	}
+	p[j++] = '\n';
+	p[j] = '\0';
+    }
+    return lines;
+}
+
+int main(int argc, char **argv)
+{
+    int megabytes = argc > 1 ? atoi(argv[1]) : 64;
+    int nlines = 1000, rounds, r, i;
+    char **b64 = make_base64(nlines);
+    char **qp = make_qp(nlines);
+    char out1[MAXLINE], out2[MAXLINE];
+    long inbytes = 0;
+    double t, old_time, new_time;
+
+    for (i = 0; i < nlines; i++)
+	inbytes += strlen(b64[i]);
+    rounds = (int)((megabytes * 1048576.0) / inbytes) + 1;
+
+    /* same output first */
+    for (i = 0; i < nlines; i++) {
+	int len1, len2, soft;
+	char *res;
+	old_base64Decode(b64[i], out1, &len1);
+	base64Decode(b64[i], out2, &len2);
+	if (len1 != len2 || memcmp(out1, out2, len1)) {
+	    fprintf(stderr, "base64 mismatch on line %d\n", i);
+	    return 1;
+	}
+	len1 = old_qpDecode(qp[i], &res);
+	len2 = qpDecode(qp[i], out2, &soft);
+	if (len1 != len2 || memcmp(res, out2, len1)) {
+	    fprintf(stderr, "quoted-printable mismatch on line %d\n", i);
+	    return 1;
+	}
+	free(res);
+    }
+
+    t = now();
+    for (r = 0; r < rounds; r++)
+	for (i = 0; i < nlines; i++) {
+	    int len;
+	    old_base64Decode(b64[i], out1, &len);
+	}
+    old_time = now() - t;
+    t = now();
+    for (r = 0; r < rounds; r++)
+	for (i = 0; i < nlines; i++) {
+	    int len;
+	    base64Decode(b64[i], out2, &len);
+	}
+    new_time = now() - t;
+    printf("base64:           old %8.1f MB/s   new %8.1f MB/s   x%.1f\n",
+	   rounds * inbytes / 1048576.0 / old_time,
+	   rounds * inbytes / 1048576.0 / new_time, old_time / new_time);
+
+    inbytes = 0;
+    for (i = 0; i < nlines; i++)
+	inbytes += strlen(qp[i]);
+    t = now();
+    for (r = 0; r < rounds; r++)
+	for (i = 0; i < nlines; i++) {
+	    char *res;
+	    old_qpDecode(qp[i], &res);
+	    free(res);
+	}
+    old_time = now() - t;
+    t = now();
+    for (r = 0; r < rounds; r++)
+	for (i = 0; i < nlines; i++) {
+	    int soft;
+	    qpDecode(qp[i], out2, &soft);
+	}
+    new_time = now() - t;
+    printf("quoted-printable: old %8.1f MB/s   new %8.1f MB/s   x%.1f\n",
+	   rounds * inbytes / 1048576.0 / old_time,
+	   rounds * inbytes / 1048576.0 / new_time, old_time / new_time);
+    return 0;
+}
@@ -23,11 +23,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <pwd.h>
+#include <fcntl.h>
 
 #include "hypermail.h"
 #include "setup.h"
 #include "struct.h"
 #include "parse.h"
+#include "output.h"
 #ifdef HAVE_DIRENT_H
 #ifdef __LCC__
 #include "../lcc/dirent.h"
@@ -38,6 +40,9 @@
 #else
 #include <sys/dir.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #ifdef GDBM
 #include "gdbm.h"
 #endif
@@ -343,6 +348,123 @@ void symlink_latest()
 #endif
 }
 
+/*
+** The archive state file remembers the highest message number and the
+** layout it was written with, so that an update can skip scanning the
+** archive directory for it. It is only trusted when it is in this
+** format and was written by this version of hypermail, the layout still
+** matches, the page of that message is there and the next one isn't.
+*/
+
+#define STATE_HEADER "# hypermail archive state 1\n"
+
+static char *archive_state_name(void)
+{
+    char *name;
+
+    trio_asprintf(&name, "%s%s", set_dir, ARCHIVE_STATE);
+    return name;
+}
+
+static char *msgnum_page_name(int num)
+{
+    char *name;
+
+    if (set_msgsperfolder)
+	trio_asprintf(&name, "%s%d%c%.4d.%s", set_dir,
+		      num / set_msgsperfolder, PATH_SEPARATOR, num,
+		      set_htmlsuffix);
+    else
+	trio_asprintf(&name, "%s%.4d.%s", set_dir, num, set_htmlsuffix);
+    return name;
+}
+
+static int msgnum_page_exists(int num)
+{
+    char *name = msgnum_page_name(num);
+    int exists = isfile(name);
+
+    free(name);
+    return exists;
+}
+
+/*
+** The highest message number the state file gives, or -2 when there
+** is no state file or it doesn't fit the archive.
+*/
+
+static int archive_state_max(void)
+{
+    char *filename;
+    FILE *fp;
+    char line[MAXLINE];
+    char suffix[MAXLINE];
+    char version[MAXLINE];
+    int max_num = -2, perfolder = -1, n;
+
+    if (set_folder_by_date)
+	return -2;
+    filename = archive_state_name();
+    fp = fopen(filename, "r");
+    free(filename);
+    if (fp == NULL)
+	return -2;
+    *suffix = *version = '\0';
+    if (fgets(line, sizeof(line), fp) && !strcmp(line, STATE_HEADER)) {
+	while (fgets(line, sizeof(line), fp)) {
+	    if (sscanf(line, "max_msgnum %d", &n) == 1)
+		max_num = n;
+	    else if (sscanf(line, "msgsperfolder %d", &n) == 1)
+		perfolder = n;
+	    else if (!strncmp(line, "htmlsuffix ", 11)) {
+		strcpymax(suffix, line + 11, sizeof(suffix));
+		suffix[strcspn(suffix, "\n")] = '\0';
+	    }
+	    else if (!strncmp(line, "version ", 8)) {
+		strcpymax(version, line + 8, sizeof(version));
+		version[strcspn(version, "\n")] = '\0';
+	    }
+	}
+    }
+    fclose(fp);
+    if (max_num < -1 || strcmp(version, VERSION)
+	|| perfolder != set_msgsperfolder || strcmp(suffix, set_htmlsuffix))
+	return -2;
+    if ((max_num >= 0 && !msgnum_page_exists(max_num))
+	|| msgnum_page_exists(max_num + 1))
+	return -2;
+    return max_num;
+}
+
+/*
+** Writes the state file at the end of a run, once the pages are out.
+*/
+
+void archive_state_save(void)
+{
+    char *filename = archive_state_name();
+    char *data;
+    int max_num = max_msgnum, rc;
+
+    if (set_folder_by_date || set_nonsequential
+	|| (max_num >= 0 && !msgnum_page_exists(max_num))) {
+	unlink(filename);
+	free(filename);
+	return;
+    }
+    trio_asprintf(&data, "%sversion %s\nmax_msgnum %d\nmsgsperfolder %d\n"
+		  "htmlsuffix %s\n", STATE_HEADER, VERSION, max_num,
+		  set_msgsperfolder, set_htmlsuffix);
+    rc = output_replace(filename, data, strlen(data), set_filemode);
+    if (rc) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %s.",
+		 lang[MSG_COULD_NOT_WRITE], filename, strerror(rc));
+	progerr(errmsg);
+    }
+    free(data);
+    free(filename);
+}
+
 int find_max_msgnum()
 {
     DIR *dir;
@@ -353,9 +475,14 @@ int find_max_msgnum()
 #endif
     int max_num = -1;
     int num;
-    char *s_dir = strsav(set_dir);
-    int len = (int)strlen(s_dir);
-
+    char *s_dir;
+    int len;
+
+    if ((max_num = archive_state_max()) != -2)
+	return max_num;
+    max_num = -1;
+    s_dir = strsav(set_dir);
+    len = (int)strlen(s_dir);
     if (len > 0 && s_dir[len - 1] == PATH_SEPARATOR)
        s_dir[len - 1] = 0;
     dir = opendir(s_dir);
@@ -428,7 +555,104 @@ char *messageindex_name(void)
 }
 
 /*
-** Returns the corresponding message number from the messageindex file.
+** The message index of a nonsequential archive gives the file name of
+** each message number. It is a binary file, .hm2msgindex: a header,
+** then one fixed size slot per message number holding the name, or
+** nothing for a number that has no message. That way the name of any
+** message is at a known offset, the file is mapped in rather than
+** parsed, and an update only writes the slots of its new messages.
+** Archives made before keep a text "msgindex", which is still read
+** until the binary index replaces it. The numbers in the header are
+** 32 bit little-endian whatever the host, so an archive can move
+** between machines.
+**
+** There is no msgid to msgnum half: an update reads every old message
+** into the email hash table by msgid anyway, in loadoldheaders(), so
+** a second copy of that map on disk would have no reader.
+*/
+
+#define MSGINDEX_MAGIC "hm2msgix"
+#define MSGINDEX_VERSION 1
+
+struct msgindex_header {
+    char magic[8];
+    unsigned char version[4];	/* little-endian */
+    unsigned char slot_size[4];	/* little-endian */
+    char pad[16];
+};
+
+static void put_le32(unsigned char *p, unsigned long value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static unsigned long get_le32(const unsigned char *p)
+{
+    return p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16)
+	| ((unsigned long)p[3] << 24);
+}
+
+static char *msgindex_map;	/* the mapped binary index */
+static size_t msgindex_maplen;
+static int msgindex_count;	/* slots in it */
+static char **msgindex_table;	/* or the text index, read in */
+static int msgindex_table_max;
+
+char *msgindex_filename(void)
+{
+    char *buf;
+
+    trio_asprintf(&buf, "%s%s", set_dir, MESSAGE_INDEX);
+    return buf;
+}
+
+/*
+** The number of slots in the binary index open as fd, or -1 if it
+** isn't one.
+*/
+
+int msgindex_slots(int fd)
+{
+    struct msgindex_header head;
+    struct stat st;
+
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(head)
+	|| pread(fd, &head, sizeof(head), 0) != sizeof(head)
+	|| memcmp(head.magic, MSGINDEX_MAGIC, sizeof(head.magic))
+	|| get_le32(head.version) != MSGINDEX_VERSION
+	|| get_le32(head.slot_size) != MSGINDEX_SLOT)
+	return -1;
+    return (st.st_size - sizeof(head)) / MSGINDEX_SLOT;
+}
+
+/*
+** Writes the header of a new binary index.
+*/
+
+int msgindex_init(int fd)
+{
+    struct msgindex_header head;
+
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, MSGINDEX_MAGIC, sizeof(head.magic));
+    put_le32(head.version, MSGINDEX_VERSION);
+    put_le32(head.slot_size, MSGINDEX_SLOT);
+    if (ftruncate(fd, 0)
+	|| pwrite(fd, &head, sizeof(head), 0) != sizeof(head))
+	return -1;
+    return 0;
+}
+
+off_t msgindex_offset(int num)
+{
+    return (off_t)sizeof(struct msgindex_header) + (off_t)num * MSGINDEX_SLOT;
+}
+
+/*
+** Returns the highest message number in the message index.
 */
 int find_max_msgnum_id()
 {
@@ -439,7 +663,18 @@ int find_max_msgnum_id()
     int maxnum;
     int startnum;
     char *buf;
-    
+    int fd;
+
+    buf = msgindex_filename();
+    fd = open(buf, O_RDONLY);
+    free(buf);
+    if (fd != -1) {
+	int slots = msgindex_slots(fd);
+	close(fd);
+	if (slots != -1)
+	    return slots - 1;
+    }
+
     /* open the index file */
     buf = messageindex_name();
     fp = fopen(buf, "r");
@@ -456,7 +691,7 @@ int find_max_msgnum_id()
 /* 
 ** Get a list of msgid corresponding to hypermail msg numbers
 */
-char **read_msgnum_id_table(int max_num)
+static char **read_msgnum_id_table(int max_num)
 {
     char **table;
     int read_msgs;
@@ -498,20 +733,89 @@ char **read_msgnum_id_table(int max_num)
     return table;
 }
 
-/* 
-** Frees the table used to store the msgnum id correspondance
+/*
+** Opens the message index for msgindex_lookup().
+*/
+
+void msgindex_load(void)
+{
+    char *buf = msgindex_filename();
+    int fd = open(buf, O_RDONLY);
+
+    free(buf);
+    if (fd != -1) {
+	int slots = msgindex_slots(fd);
+
+	if (slots > 0) {
+	    msgindex_maplen = msgindex_offset(slots);
+#ifdef HAVE_SYS_MMAN_H
+	    msgindex_map = mmap(NULL, msgindex_maplen, PROT_READ, MAP_SHARED,
+				fd, 0);
+	    if (msgindex_map == MAP_FAILED)
+		msgindex_map = NULL;
+#endif
+	    if (msgindex_map == NULL) {
+		msgindex_map = (char *)emalloc(msgindex_maplen);
+		if (pread(fd, msgindex_map, msgindex_maplen, 0)
+		    != (ssize_t)msgindex_maplen) {
+		    free(msgindex_map);
+		    msgindex_map = NULL;
+		    slots = -1;
+		}
+		else
+		    msgindex_maplen = 0;	/* not mapped, to free() */
+	    }
+	}
+	close(fd);
+	if (slots != -1) {
+	    msgindex_count = slots > 0 ? slots : 0;
+	    return;
+	}
+    }
+    msgindex_table_max = find_max_msgnum_id();
+    msgindex_table = read_msgnum_id_table(msgindex_table_max);
+}
+
+/*
+** The file name of message num, without the suffix, or NULL if the
+** message index has none.
 */
-void free_msgnum_id_table(char *table[], int max_num)
+
+const char *msgindex_lookup(int num)
 {
-  int i;
+    if (num < 0)
+	return NULL;
+    if (msgindex_map) {
+	const char *slot = msgindex_map + msgindex_offset(num);
 
-  if (!table)
-    return;
+	return (num < msgindex_count && *slot) ? slot : NULL;
+    }
+    if (msgindex_table && num <= msgindex_table_max)
+	return msgindex_table[num];
+    return NULL;
+}
+
+void msgindex_unload(void)
+{
+    int i;
 
-  for (i = 0; i < max_num; i++)
-    if (table[i])
-			free(table[i]);
-	free(table);
+    if (msgindex_map) {
+#ifdef HAVE_SYS_MMAN_H
+	if (msgindex_maplen)
+	    munmap(msgindex_map, msgindex_maplen);
+	else
+#endif
+	    free(msgindex_map);
+	msgindex_map = NULL;
+    }
+    if (msgindex_table) {
+	for (i = 0; i <= msgindex_table_max; i++)
+	    if (msgindex_table[i])
+		free(msgindex_table[i]);
+	free(msgindex_table);
+	msgindex_table = NULL;
+    }
+    msgindex_count = 0;
 }
 
 int is_empty_archive()
@@ -523,8 +827,13 @@ int is_empty_archive()
     struct direct *entry;
 #endif
     int num_files = 0;
-    char *s_dir = strsav(set_dir);
-    int len = (int)strlen(s_dir);
+    char *s_dir;
+    int len;
+
+    if (archive_state_max() >= 0)
+	return 0;
+    s_dir = strsav(set_dir);
+    len = (int)strlen(s_dir);
     if (len > 0 && s_dir[len - 1] == PATH_SEPARATOR)
         s_dir[len - 1] = 0;
     dir = opendir(s_dir);
@@ -635,6 +944,8 @@ char *message_name (struct emailinfo *email)
   static char buffer[8 + sizeof (time_t) * 2 + 1];
 
 #ifdef HAVE_LIBFNV
+  if (set_nonsequential && email->pagename)
+    return email->pagename;
   if (set_nonsequential && email->msgid)
     {
       /* Call the FNV msg hash library */
@@ -647,7 +958,8 @@ char *message_name (struct emailinfo *email)
       /* hash_val = fnv_32_str(email->fromdatestr, hash_val); */
       sprintf (buffer, "%08x%08x", hash_val, email->fromdate);
 
-      return buffer;
+      email->pagename = strsav(buffer);
+      return email->pagename;
     }
   else
     {
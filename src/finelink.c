@@ -20,8 +20,10 @@
 #include "finelink.h"
 #include "print.h"
 #include "struct.h"
+#include "thread.h"
 #include "search.h"
 #include "setup.h"
+#include "output.h"
 #include "proto.h"
 #include <string.h>
 #include <ctype.h>
@@ -131,7 +133,6 @@ static int place_a_end(const String_Match * match_info, struct body **bp, char *
 static int add_anchor(int msgnum, int quoting_msgnum, int quote_num, const char *anchor, char *line, int find_substr, int count_quoted_lines, const String_Match * match_info)
 {
     char *filename;
-    char *tmpfilename;
     char buffer[MAXLINE];
     FILE *fp1, *fp2;
     int matches = 0;
@@ -166,9 +167,8 @@ static int add_anchor(int msgnum, int quoting_msgnum, int quote_num, const char
 			fprintf(stderr, "Couldn't read message number %d (linked from %d). " "May mean message deleted with delete_level = 0.\n", msgnum, quoting_msgnum);
 	return -1;
     }
-    tmpfilename = htmlfilename("tmp", ep, "tmp");	/* AUDIT biege: where is the tmp-file created? cwd? what about checking the return-value */
-    if ((fp2 = fopen(tmpfilename, "w")) == NULL) {
-	snprintf(errmsg, sizeof(errmsg), "Couldn't write \"%s\".", tmpfilename);
+    if ((fp2 = output_open(filename)) == NULL) {
+	snprintf(errmsg, sizeof(errmsg), "Couldn't write \"%s\".", filename);
 	progerr(errmsg);
     }
     while (fgets(buffer, sizeof(buffer), fp1)) {
@@ -236,22 +236,17 @@ static int add_anchor(int msgnum, int quoting_msgnum, int quote_num, const char
     }
 
     fclose(fp1);
-    fclose(fp2);
 
     if (matches != 1)
-	remove(tmpfilename);
+	output_discard(fp2);
     else {
-	if (rename(tmpfilename, filename) == -1) {
-	    snprintf(errmsg, sizeof(errmsg), "Couldn't rename \"%s\" to %s.", tmpfilename, filename);
-	    progerr(errmsg);
-	}
+	output_close(fp2);
 	if (chmod(filename, set_filemode) == -1) {
 	    snprintf(errmsg, sizeof(errmsg), "Couldn't chmod \"%s\" to %o.", filename, set_filemode);
 	    progerr(errmsg);
 	}
     }
     free(filename);
-    free(tmpfilename);
     return matches == 1;
 }
 
@@ -391,7 +386,6 @@ int handle_quoted_text(FILE *fp, struct emailinfo *email, const struct body *bp,
 {
     char *url1;
     int quoting_msgnum = email->msgnum;
-    const struct body *last_quoted_line = bp;
     int count_quoted_lines = 0;
     char *fmt2;
     char *cvtd_line = ConvURLsString(unquote(line), email->msgid, email->subject, email->charset);
@@ -401,10 +395,7 @@ int handle_quoted_text(FILE *fp, struct emailinfo *email, const struct body *bp,
     if (cvtd_line)
 	free(cvtd_line);
     found_quote = (quote_num > 0);
-    while (last_quoted_line && isquote(last_quoted_line->line)) {
-	++count_quoted_lines;
-	last_quoted_line = last_quoted_line->next;
-    }
+    count_quoted_lines = body_quote_run(bp);
     cvtd_line = unquote_and_strip(line);
     if (strlen(cvtd_line) < 5 && (!replace_quoted || !inquote)) {
 	char *parsed = ConvURLsString(line, email->msgid, email->subject, email->charset);
@@ -512,7 +503,6 @@ int get_new_reply_to()
 
 void replace_maybe_replies(const char *filename, struct emailinfo *ep, int new_reply_to)
 {
-    char tmpfilename[MAXFILELEN];
     char buffer[MAXLINE];
     FILE *fp1, *fp2;
     struct emailinfo *ep2;
@@ -522,13 +512,12 @@ void replace_maybe_replies(const char *filename, struct emailinfo *ep, int new_r
 
     if (!hashnumlookup(new_reply_to, &ep2))
 	return;
-    snprintf(tmpfilename, sizeof(tmpfilename), "%s/aaaa.tmp", set_dir);	/* AUDIT biege: poss. BOF. */
     if ((fp1 = fopen(filename, "r")) == NULL) {
         snprintf(errmsg, sizeof(errmsg), "Couldn't read \"%s\".", filename);
 	progerr(errmsg);
     }
-    if ((fp2 = fopen(tmpfilename, "w")) == NULL) {
-        snprintf(errmsg, sizeof(errmsg), "Couldn't write \"%s\".", tmpfilename);
+    if ((fp2 = output_open(filename)) == NULL) {
+        snprintf(errmsg, sizeof(errmsg), "Couldn't write \"%s\".", filename);
 	progerr(errmsg);
     }
     while (fgets(buffer, sizeof(buffer), fp1)) {
@@ -616,12 +605,7 @@ void replace_maybe_replies(const char *filename, struct emailinfo *ep, int new_r
 	fputs(buffer, fp2);
     }
     fclose(fp1);
-    fclose(fp2);
-
-    if (rename(tmpfilename, filename) == -1) {
-	snprintf(errmsg, sizeof(errmsg), "Couldn't rename \"%s\" to %s.", tmpfilename, filename);
-	progerr(errmsg);
-    }
+    output_close(fp2);
 }
 
 /*
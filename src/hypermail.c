@@ -32,9 +32,17 @@
 #include "setup.h"
 #include "parse.h"
 #include "print.h"
+#include "printfile.h"
 #include "finelink.h"
 #include "search.h"
 #include "struct.h"
+#include "compress.h"
+#include "output.h"
+#include "attach.h"
+#include "stats.h"
+#include "thread.h"
+#include "source.h"
+#include "batch.h"
 
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
@@ -155,6 +163,10 @@ void usage(void)
     printf("  -x            : %s\n", lang[MSG_OPTION_X]);
     printf("  -X            : %s\n", lang[MSG_OPTION_XML]);
     printf("  -1            : %s\n", lang[MSG_OPTION_1]);
+    printf("  --stats[=file]: %s\n", "Write run statistics as JSON");
+    printf("  --batch=file  : %s\n", "Run the jobs listed in file");
+    printf("  --jobs=N      : %s\n", "Run up to N batch jobs at once");
+    printf("  --read-lock cmd ...: %s\n", "Run cmd with the archive locked for reading");
     printf("  -L lang       : %s (", lang[MSG_OPTION_LANG]);
 
     /* Print out languages supported */
@@ -170,6 +182,99 @@ void usage(void)
     exit(1);
 }
 
+#define GETOPT_OPTSTRING ("a:Ab:c:d:gil:L:m:n:o:ps:tTuvVxX0:1M?")
+
+/*
+** Applies the command line options that override the configuration
+** file, from optind on.
+*/
+
+static void command_options(int argc, char **argv, int *use_stdin,
+			    int *show_variables)
+{
+    int i;
+
+    while ((i = getopt(argc, argv, GETOPT_OPTSTRING)) != -1) {
+	switch ((char)i) {
+	case 'A':
+	    set_append = 1;
+	    break;
+	case 'a':
+	    set_archives = strreplace(set_archives, optarg);
+	    break;
+	case 'b':
+	    set_about = strreplace(set_about, optarg);
+	    break;
+	case 'c':
+	    /* config file from pre-config options */
+	    break;
+	case 'd':
+	    set_dir = strreplace(set_dir, optarg);
+	    break;
+	case 'g':
+	    set_usegdbm = 1;
+	    break;
+	case 'i':
+	    *use_stdin = TRUE;
+	    break;
+	case 'l':
+	    set_label = strreplace(set_label, optarg);
+	    break;
+	case 'L':
+	    set_language = strreplace(set_language, optarg);
+	    break;
+	case 'm':
+	    set_mbox = strreplace(set_mbox, optarg);
+	    break;
+	case 'n':
+	    set_hmail = strreplace(set_hmail, optarg);
+	    break;
+	case 'o':
+	    ConfigAddItem(optarg);
+	    break;
+	case 'p':
+	    set_showprogress = TRUE;
+	    break;
+	case 's':
+	    set_htmlsuffix = strreplace(set_htmlsuffix, optarg);
+	    break;
+	case 't':
+	    set_usetable = TRUE;
+	    break;
+	case 'T':
+	    set_indextable = TRUE;
+	    break;
+	case 'u':
+	    set_increment = TRUE;
+	    break;
+	case 'v':
+	    *show_variables = TRUE;
+	    break;
+	case 'x':
+	    set_overwrite = TRUE;
+	    break;
+	case 'X':
+	    set_writehaof = TRUE;
+	    break;
+	case '0':
+	    set_delete_msgnum = add_list(set_delete_msgnum, optarg);
+	    break;
+	case '1':
+	    set_readone = TRUE;
+	    break;
+	case 'M':
+	    set_usemeta = TRUE;
+	    break;
+	case 'N':
+ 	    set_nonsequential = TRUE;
+	    break;
+	case '?':
+	default:
+	    break;
+	}
+    }
+}
+
 int main(int argc, char **argv)
 {
     int i, use_stdin, use_mbox;
@@ -177,6 +282,8 @@ int main(int argc, char **argv)
     char **tlang, *locale_code;
     int cmd_show_variables;
     int print_usage;
+    int is_batch;
+    char **read_lock_cmd;
 
     int amount_old = 0;		/* number of old mails */
     int amount_new = 0;		/* number of new mails */
@@ -198,7 +305,9 @@ int main(int argc, char **argv)
 
     opterr = 0;
 
-#define GETOPT_OPTSTRING ("a:Ab:c:d:gil:L:m:n:o:ps:tTuvVxX0:1M?")
+    is_batch = batch_args(&argc, argv);
+    stats_args(&argc, argv);
+    read_lock_cmd = read_lock_args(&argc, argv);
 
     /* get pre config options here */
 	while ((i = getopt(argc, argv, GETOPT_OPTSTRING)) != -1) {
@@ -256,85 +365,7 @@ int main(int argc, char **argv)
 
     /* now get the post-config options! */
 
-	while ((i = getopt(argc, argv, GETOPT_OPTSTRING)) != -1) {
-		switch ((char)i) {
-	case 'A':
-	    set_append = 1;
-	    break;
-	case 'a':
-	    set_archives = strreplace(set_archives, optarg);
-	    break;
-	case 'b':
-	    set_about = strreplace(set_about, optarg);
-	    break;
-	case 'c':
-	    /* config file from pre-config options */
-	    break;
-	case 'd':
-	    set_dir = strreplace(set_dir, optarg);
-	    break;
-	case 'g':
-	    set_usegdbm = 1;
-	    break;
-	case 'i':
-	    use_stdin = TRUE;
-	    break;
-	case 'l':
-	    set_label = strreplace(set_label, optarg);
-	    break;
-	case 'L':
-	    set_language = strreplace(set_language, optarg);
-	    break;
-	case 'm':
-	    set_mbox = strreplace(set_mbox, optarg);
-	    break;
-	case 'n':
-	    set_hmail = strreplace(set_hmail, optarg);
-	    break;
-	case 'o':
-	    ConfigAddItem(optarg);
-	    break;
-	case 'p':
-	    set_showprogress = TRUE;
-	    break;
-	case 's':
-	    set_htmlsuffix = strreplace(set_htmlsuffix, optarg);
-	    break;
-	case 't':
-	    set_usetable = TRUE;
-	    break;
-	case 'T':
-	    set_indextable = TRUE;
-	    break;
-	case 'u':
-	    set_increment = TRUE;
-	    break;
-	case 'v':
-	    cmd_show_variables = TRUE;
-	    break;
-	case 'x':
-	    set_overwrite = TRUE;
-	    break;
-	case 'X':
-	    set_writehaof = TRUE;
-	    break;
-	case '0':
-	    set_delete_msgnum = add_list(set_delete_msgnum, optarg);
-	    break;
-	case '1':
-	    set_readone = TRUE;
-	    break;
-	case 'M':
-	    set_usemeta = TRUE;
-	    break;
-	case 'N':
- 	    set_nonsequential = TRUE;
-	    break;
-	case '?':
-	default:
-	    break;
-	}
-    }
+    command_options(argc, argv, &use_stdin, &cmd_show_variables);
 
 #ifdef DEBUG
     dump_config();
@@ -457,6 +488,18 @@ int main(int argc, char **argv)
     mhtmlheaderfile = expand_contents(set_mhtmlheader);
     mhtmlfooterfile = expand_contents(set_mhtmlfooter);
 
+    /*
+     * Up to here, nothing depends on the mailbox or the archive, so the
+     * jobs of a batch that use our configuration go on from here.
+     */
+
+    if (is_batch) {
+	batch_run(&argc, &argv, configfile);	/* returns in each job */
+	optind = 1;
+	command_options(argc, argv, &use_stdin, &cmd_show_variables);
+	use_stdin = FALSE;
+    }
+
     if (set_dir)
 	set_dir = strreplace(set_dir, dirpath(set_dir));
 
@@ -583,6 +626,11 @@ int main(int argc, char **argv)
         cmderr(lang[MSG_CANNOT_BOTH_READ_AND_WRITE_TO_MBOX]);
     }
 
+    /* a program that only reads the archive runs with it locked shared */
+
+    if (read_lock_cmd)
+	exit(run_read_locked(set_dir, read_lock_cmd));
+
     gettimezone();
     getthisyear();
 
@@ -606,13 +654,17 @@ int main(int argc, char **argv)
 	set_append = 0;
 	if (set_mbox_shortened)
 	    progerr("can not use increment = -1 option with mbox_shortened option\n");
+	stats_begin("parse");
 	amount_new = parsemail(set_mbox, use_stdin, 1, -1, set_dir, set_inlinehtml, 0);
+	stats_end("parse");
 	set_increment = !matches_existing(set_startmsgnum);
 	if (set_increment && set_folder_by_date && !set_usegdbm)
 	    progerr("folder_by_date with incremental update requires usegdbm option");
 	reinit_structs();
 	set_append = save_append;
     }
+    if (set_increment && set_compress_output_only)
+	progerr("compress_output_only can't be used with incremental updates");
     if (set_increment) {
 	int num_displayable;
 	int num_added;
@@ -621,36 +673,50 @@ int main(int argc, char **argv)
 	/* we have to start with the msgnum - 1 so that the rest of the
 	   code works ok when there are no old headers. */
 	max_msgnum = set_startmsgnum - 1;
+	stats_begin("load_old_headers");
 	num_displayable = loadoldheaders(set_dir);
+	stats_end("load_old_headers");
 	amount_old = max_msgnum + 1; /* counts gaps as messages */
 
 	/* start numbering at this number */
+	stats_begin("parse");
 	num_added = parsemail(set_mbox, use_stdin, set_readone, set_increment, set_dir, set_inlinehtml, amount_old);
+	stats_end("parse");
 	if (num_added > 0) {
 	    amount_new = num_displayable + num_added;
-	    if (set_linkquotes)
+	    if (set_linkquotes) {
+		stats_begin("analyze_headers");
 		analyze_headers(max_msgnum + 1);
+		stats_end("analyze_headers");
+	    }
 
 	    /* write the index of msgno/msgid_hash filenames */
 	    if (set_nonsequential)
-		    write_messageindex(0, max_msgnum + 1);
+		    write_messageindex(amount_old, max_msgnum + 1);
 
+	    stats_begin("write_articles");
 	    writearticles(amount_old, max_msgnum + 1);
+	    stats_end("write_articles");
 
 	    /* JK: in function of other hypermail configuration options, 
 	       delete_incremental will continuous escape and add more markup
 	       to non-deleted messages that are replies to deleted messages.
 	       Thus, a setup option to disable it */
-	    if (set_delete_incremental && deletedlist)
+	    if (set_delete_incremental && deletedlist) {
+		stats_begin("update_deletions");
 		update_deletions(amount_old);
+		stats_end("update_deletions");
+	    }
 
 	    if (set_show_msg_links) {
+		stats_begin("fix_old_links");
 		fixnextheader(set_dir, amount_old, -1);
 		for (i = amount_old; i <= max_msgnum; ++i) {
 		    if (set_showreplies)
 			fixreplyheader(set_dir, i, 0, amount_old);
 		    fixthreadheader(set_dir, i, amount_old);
 		}
+		stats_end("fix_old_links");
 	    }
 	}
     }
@@ -658,69 +724,61 @@ int main(int argc, char **argv)
 	if (set_mbox_shortened) {
 	    if (!set_usegdbm) progerr("mbox_shortened option requires that the usegdbm option be on");
 	    max_msgnum = set_startmsgnum - 1;
+	    stats_begin("load_old_headers");
 	    loadoldheaders(set_dir);
+	    stats_end("load_old_headers");
 	}
+	stats_begin("parse");
 	amount_new = parsemail(set_mbox, use_stdin, set_readone, set_increment, set_dir, 
 			       set_inlinehtml, set_startmsgnum);	/* number from 0 */
+	stats_end("parse");
 	if (!set_mbox_shortened && !matches_existing(0)) {
 	    progerr("First message in mailbox does not "
 		    "match first message in archive\n"
 		    "or obsolete gdbm file present.\n"
 		    "Maybe you want to enable the mbox_shortened option?\n");
 	}
-	if (set_linkquotes)
+	if (set_linkquotes) {
+	    stats_begin("analyze_headers");
 	    analyze_headers(max_msgnum + 1);
+	    stats_end("analyze_headers");
+	}
 
 	/* write the index of msgno/msgid_hash filenames */
 	if (set_nonsequential)
 		write_messageindex(0, max_msgnum + 1);
 
+	stats_begin("write_articles");
 	writearticles(0, max_msgnum + 1);
+	stats_end("write_articles");
     }
 
     if (amount_new) {		/* Always write the index files */
 	if (set_linkquotes) {
-	    threadlist = NULL;
-	    threadlist_end = NULL;
-	    printedthreadlist = NULL;
-	    for (i = 0; i <= max_msgnum; ++i) {
-	        struct emailinfo *ep;
-		if (hashnumlookup(i, &ep)) {
-		    ep->flags &= ~USED_THREAD;
-#ifdef FASTREPLYCODE
-		    ep->isreply = 0;
-#endif
-		}
-		threadlist_by_msgnum[i] = NULL;
-	    } /* redo threading with more complete info than in 1st pass */
-	    crossindexthread1(datelist);
-	    for (i = 0; i <= max_msgnum; ++i) {
-	        struct emailinfo *ep, *etmp;
-		hashnumlookup(i, &ep);
-		etmp = nextinthread(i);
-		if (etmp && ep->initial_next_in_thread != etmp->msgnum)
-		    fixthreadheader(set_dir, etmp->msgnum, amount_new);
-		/* if (ep->flags & THREADING_ALTERED) */
-	    }
+	    /* redo the threads linkquotes found more replies in */
+	    stats_begin("rethread");
+	    thread_update(amount_new);
+	    stats_end("rethread");
 	}
 	count_deleted(max_msgnum + 1);
-	if (show_index[0][DATE_INDEX])
-	    writedates(amount_new, NULL);
-	if (show_index[0][THREAD_INDEX])
-	    writethreads(amount_new, NULL);
-	if (show_index[0][SUBJECT_INDEX])
-	    writesubjects(amount_new, NULL);
-	if (show_index[0][AUTHOR_INDEX])
-	    writeauthors(amount_new, NULL);
-	if (set_attachmentsindex) {
-	    writeattachments(amount_new, NULL);
-	}
-	if (set_writehaof) 
-            writehaof(amount_new, NULL);
-	if (set_folder_by_date || set_msgsperfolder)
+	stats_begin("write_indices");
+	write_indices(amount_new);
+	stats_end("write_indices");
+	stats_begin("attachment_manifest");
+	attach_save(set_dir);
+	stats_end("attachment_manifest");
+	thread_save(set_dir);
+	source_save(set_dir);
+	if (set_folder_by_date || set_msgsperfolder) {
+	    stats_begin("toplevel_indices");
 	    write_toplevel_indices(amount_new);
-	if (set_monthly_index || set_yearly_index)
+	    stats_end("toplevel_indices");
+	}
+	if (set_monthly_index || set_yearly_index) {
+	    stats_begin("summary_indices");
 	    write_summary_indices(amount_new);
+	    stats_end("summary_indices");
+	}
 	if (set_latest_folder)
 	    symlink_latest();
     }
@@ -728,6 +786,17 @@ int main(int argc, char **argv)
 	printf("No mails to output!\n");
     }
 
+    stats_begin("compress");
+    compress_flush();
+    stats_end("compress");
+    stats_begin("sync");
+    output_sync();
+    stats_end("sync");
+    archive_state_save();
+    output_report();
+    search_stats();
+    stats_report();
+
     if (set_uselock)
 	unlock_archive();
 
@@ -749,6 +818,8 @@ int main(int argc, char **argv)
 	free(mhtmlheaderfile);
     if (mhtmlfooterfile)
 	free(mhtmlfooterfile);
+    free_templates();
+    free_index_rows(datelist);
 
     return (0);
 }
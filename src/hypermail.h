@@ -124,6 +124,13 @@
 #define NOSUBJECT   "(no subject)"
 
 #define GDBM_INDEX_NAME ".hm2index"
+#define ATTACHMENT_MANIFEST ".hm2attachments"
+#define THREAD_STATE ".hm2threads"
+#define MESSAGE_SOURCES ".hm2sources"
+#define ARCHIVE_STATE ".hm2state"
+#define MESSAGE_INDEX ".hm2msgindex"
+#define DATE_INDEX_STATE ".hm2dateindex"
+#define MSGINDEX_SLOT 24	/* bytes per message in MESSAGE_INDEX */
 
 /* Name of the Hypertext Archive Overview File an XML file
  * which contains pointers to the various index files
@@ -140,6 +147,7 @@
 #define DATESTRLEN   80
 #define MSGDSTRLEN   256
 #define REPYSTRLEN   256
+#define REFSSTRLEN   512
 #define SUBJSTRLEN   256
 #define URLSTRLEN    256
 #define HOSTSTRLEN   256
@@ -186,6 +194,22 @@ typedef enum {
   ANNOTATION_CONTENT_DELETED_SPAM = 4
 } annotation_content_t;
 
+/* the header lines parsemail() acts on, see header_kind() */
+typedef enum {
+  HEADER_UNKNOWN = 1,
+  HEADER_DATE,
+  HEADER_FROM,
+  HEADER_MESSAGE_ID,
+  HEADER_SUBJECT,
+  HEADER_IN_REPLY_TO,
+  HEADER_REFERENCES,
+  HEADER_CONTENT_TYPE,
+  HEADER_CONTENT_DESCRIPTION,
+  HEADER_CONTENT_DISPOSITION,
+  HEADER_CONTENT_BASE,
+  HEADER_CONTENT_TRANSFER_ENCODING
+} header_kind_t;
+
 typedef enum {
   FORMAT_FIXED = 0,
   FORMAT_FLOWED = 1
@@ -236,8 +260,17 @@ struct body {
     char attached;		/* part of attachment */
     char demimed;		/* if this is a header, this is set to TRUE if
 				   it has passed the decoderfc2047() function */
+    char kind;			/* header_kind_t of a header line, 0 until
+				   header_kind() has looked at it */
     int format_flowed;          /* TRUE if this a text/plain f=f line */
     int msgnum;
+    char analyzed;		/* analyze_body() has set the fields below */
+    char quoted;		/* isquote() */
+    char sig;			/* is_sig_start() */
+    int quote_depth;		/* find_quote_depth(), for a quoted line */
+    int quote_run;		/* quoted lines from this one on */
+    char repetition_set;	/* init_txt2html() has set repetition */
+    int repetition;		/* find_repetition() */
     struct body *next;
 };
 
@@ -281,7 +314,10 @@ struct emailinfo {
     char *msgid;
     char *subject;
     char *unre_subject;
+    char *name_key;		/* name and unre_subject as casefold() */
+    char *subject_key;		/* keys them, for the indexes */
     char *inreplyto;
+    char *references;		/* References: ids, oldest first, or NULL */
     char *charset;		/* added in 2b10 */
 
     long datenum;		/* moved here from 'struct header' */
@@ -307,6 +343,9 @@ struct emailinfo {
 			/* 8=filtered (required line missing), 16=deleted (other) */
     int deletion_completed; /* -1 or delete_level that reflects last time */
                             /* that file was rewritten to reflect is_deleted */
+    struct attach *attachments;	/* stored attachments, see attach.c */
+    struct index_row *index_row;	/* what the indexes show, see print.c */
+    char *pagename;		/* message_name(), once worked out */
 };
 
 struct header {
@@ -321,6 +360,7 @@ struct attach {
     char *id;
     char *storedas;		/* filename used for storage */
     char *descr;		/* "Content-Description" */
+    long size;			/* bytes stored, or -1 if unknown */
     struct attach *next;
 };
 
@@ -400,7 +440,6 @@ VAR long firstdatenum;
 VAR long lastdatenum;
 VAR int max_msgnum;
 
-VAR char **msgnum_id_table;
 
 VAR const char *latest_folder_path;
 
@@ -0,0 +1,134 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+
+/*
+** A pool of the header values that repeat across an archive - names,
+** addresses, charsets, subjects. Each distinct value is stored once and
+** all the messages that have it share the same pointer, so two values
+** from the pool are equal exactly when their pointers are.
+**
+** Strings from the pool must never be modified or freed.
+*/
+
+#include "hypermail.h"
+#include "intern.h"
+
+#define FNV32_INIT  2166136261U
+#define FNV32_PRIME 16777619U
+
+struct intern_entry {
+    struct intern_entry *next;
+    unsigned hashval;
+    char str[1];		/* the value, as long as it needs to be */
+};
+
+static struct intern_entry **table;
+static int size;		/* a power of two */
+static long count;
+static long lookups;
+static long bytes;
+
+static unsigned intern_hash(const char *s)
+{
+    unsigned h = FNV32_INIT;
+
+    for (; *s; s++) {
+	h ^= (unsigned char)*s;
+	h *= FNV32_PRIME;
+    }
+    return h;
+}
+
+static void intern_grow(void)
+{
+    struct intern_entry **old = table;
+    int oldsize = size, i;
+
+    size = size ? size * 2 : 1024;
+    table = (struct intern_entry **)emalloc(size * sizeof(*table));
+    memset(table, 0, size * sizeof(*table));
+    for (i = 0; i < oldsize; i++) {
+	struct intern_entry *ep, *next;
+
+	for (ep = old[i]; ep != NULL; ep = next) {
+	    next = ep->next;
+	    ep->next = table[ep->hashval & (size - 1)];
+	    table[ep->hashval & (size - 1)] = ep;
+	}
+    }
+    if (old)
+	free(old);
+}
+
+/*
+** Returns the pool's copy of s, adding it if it isn't there yet. Like
+** strsav(), NULL gives an empty string.
+*/
+
+char *intern(const char *s)
+{
+    struct intern_entry *ep;
+    unsigned hashval;
+    int len;
+
+    if (s == NULL)
+	s = "";
+    ++lookups;
+    hashval = intern_hash(s);
+    if (size)
+	for (ep = table[hashval & (size - 1)]; ep != NULL; ep = ep->next)
+	    if (ep->hashval == hashval && !strcmp(ep->str, s))
+		return ep->str;
+
+    if (count >= size)
+	intern_grow();
+    len = strlen(s);
+    ep = (struct intern_entry *)emalloc(sizeof(struct intern_entry) + len);
+    memcpy(ep->str, s, len + 1);
+    ep->hashval = hashval;
+    ep->next = table[hashval & (size - 1)];
+    table[hashval & (size - 1)] = ep;
+    ++count;
+    bytes += len + 1;
+    return ep->str;
+}
+
+/*
+** The same for a string that was allocated to be stored, which is
+** freed.
+*/
+
+char *intern_free(char *s)
+{
+    char *p = intern(s);
+
+    if (s)
+	free(s);
+    return p;
+}
+
+/*
+** For --stats: the number of distinct values, of values looked up, and
+** of bytes the distinct values take.
+*/
+
+void intern_stats(long *strings, long *looked_up, long *size_bytes)
+{
+    *strings = count;
+    *looked_up = lookups;
+    *size_bytes = bytes;
+}
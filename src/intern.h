@@ -0,0 +1,7 @@
+/*
+** intern.c functions
+*/
+
+char *intern(const char *);
+char *intern_free(char *);
+void intern_stats(long *, long *, long *);
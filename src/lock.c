@@ -1,10 +1,179 @@
 #include "hypermail.h"
 #include "setup.h"
 
+#include <sys/wait.h>
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#endif
+
 #define LOCKBASE       ".hypermail.lock"
 
 int i_locked_it = 0;
 
+#ifdef HAVE_FCNTL_H
+
+/*
+** The lock is an fcntl() lock on the whole of the lock file, which the
+** kernel lets go of when the process holding it ends, however it ends.
+** hypermail takes it exclusive (F_WRLCK). Programs that only read the
+** archive can take it shared (F_RDLCK), see --read-lock, so that they
+** run alongside each other but not while hypermail changes the archive.
+**
+** The last holder removes the file before letting go, so the file only
+** exists while the archive is in use, the way older versions (and the
+** polling code below) expect. A writer is always the last holder; a
+** reader only knows it is if it can turn its lock into an exclusive one
+** without waiting. Whoever was waiting on the removed file finds it
+** gone once it gets the lock, and starts over with a new one.
+*/
+
+static int lock_fd = -1;
+static int lock_shared;
+
+static void lock_timeout(int sig)
+{
+    (void)sig;			/* only here to interrupt fcntl() */
+}
+
+/*
+** Waits up to timeout seconds for the lock. Returns 0, or the errno
+** fcntl() gave up with.
+*/
+
+static int wait_for_lock(int fd, struct flock *fl, int timeout)
+{
+    struct sigaction sa, old_sa;
+    unsigned int old_alarm;
+    int rc = 0;
+
+    if (fcntl(fd, F_SETLK, fl) == 0)
+	return 0;
+    if (errno != EACCES && errno != EAGAIN)
+	return errno;
+    if (timeout <= 0)
+	return EAGAIN;
+    if (set_showprogress)
+	fprintf(stderr, "Waiting for lock (file '%s')\n", lockfile);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = lock_timeout;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;		/* no SA_RESTART, the wait has to end */
+    sigaction(SIGALRM, &sa, &old_sa);
+    old_alarm = alarm(timeout);
+    if (fcntl(fd, F_SETLKW, fl) == -1)
+	rc = (errno == EINTR) ? EAGAIN : errno;
+    alarm(0);
+    sigaction(SIGALRM, &old_sa, NULL);
+    if (old_alarm)
+	alarm(old_alarm);
+    return rc;
+}
+
+/*
+** Tells whether the locked file open on fd is still the one named
+** lockfile, and not one the previous holder removed.
+*/
+
+static int lock_is_current(int fd)
+{
+    struct stat fd_st, name_st;
+
+    if (fstat(fd, &fd_st) == -1 || stat(lockfile, &name_st) == -1)
+	return 0;
+    return fd_st.st_dev == name_st.st_dev && fd_st.st_ino == name_st.st_ino;
+}
+
+/*
+** Locks the archive in dir, shared or exclusive, waiting up to
+** set_locktime seconds for whoever has it now.
+*/
+
+void lock_archive_mode(char *dir, int shared)
+{
+    struct flock fl;
+    char buffer[64];
+    time_t deadline = time(NULL) + set_locktime;
+    int rc;
+
+    i_locked_it = 0;		/* guilty until proven innocent */
+
+    snprintf(lockfile, sizeof(lockfile), "%s/%s", dir, LOCKBASE);
+
+    for (;;) {
+	lock_fd = open(lockfile, O_RDWR | O_CREAT, 0666);
+	if (lock_fd == -1) {
+	    if (!dir[0])
+		return;
+	    snprintf(errmsg, sizeof(errmsg),
+		     "Couldn't create lock file \"%s\".", lockfile);
+	    progerr(errmsg);
+	}
+	fcntl(lock_fd, F_SETFD, FD_CLOEXEC);
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = shared ? F_RDLCK : F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 0;		/* the whole file */
+	rc = wait_for_lock(lock_fd, &fl, (int)(deadline - time(NULL)));
+	if (rc || lock_is_current(lock_fd))
+	    break;
+	close(lock_fd);		/* removed by the last holder, try again */
+    }
+    if (rc) {
+	close(lock_fd);
+	lock_fd = -1;
+	if (rc == EAGAIN)
+	    snprintf(errmsg, sizeof(errmsg),
+		     "Archive still locked (file \"%s\") after %d seconds.",
+		     lockfile, set_locktime);
+	else
+	    snprintf(errmsg, sizeof(errmsg), "Couldn't lock \"%s\": %s.",
+		     lockfile, strerror(rc));
+	lockfile[0] = '\0';
+	progerr(errmsg);
+    }
+    i_locked_it = 1;
+    lock_shared = shared;
+    if (shared)
+	return;
+
+    /* who has it, for people looking; older versions read the time */
+    snprintf(buffer, sizeof(buffer), "%ld %ld\n", (long)time(NULL),
+	     (long)getpid());
+    if (ftruncate(lock_fd, 0) == 0)
+	write(lock_fd, buffer, strlen(buffer));
+}
+
+void lock_archive(char *dir)
+{
+    lock_archive_mode(dir, 0);
+}
+
+void unlock_archive(void)
+{
+    if (lock_fd != -1) {
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	if (!lock_shared
+	    || (fcntl(lock_fd, F_SETLK, &fl) == 0 && lock_is_current(lock_fd)))
+	    unlink(lockfile);	/* while still holding it */
+	close(lock_fd);		/* lets go of the lock */
+	lock_fd = -1;
+    }
+    i_locked_it = 0;
+    lockfile[0] = '\0';
+}
+
+#else /* !HAVE_FCNTL_H */
+
 void lock_archive(char *dir)
 {
     FILE *fp;
@@ -18,9 +187,9 @@ void lock_archive(char *dir)
     while ((fp = fopen(lockfile, "r")) != NULL) {
 	fgets(buffer, MAXLINE-1, fp);
 	fclose(fp);
-	/*  
-         * "set_locktime" is the config file item named 'locktime', 
-         * default is 3600 seconds 
+	/*
+         * "set_locktime" is the config file item named 'locktime',
+         * default is 3600 seconds
          */
 	if (time(NULL) > (time_t)(atol(buffer) + set_locktime))
 	    break;		/* lock over hour old - break it */
@@ -41,9 +210,71 @@ void lock_archive(char *dir)
     }
 }
 
+void lock_archive_mode(char *dir, int shared)
+{
+    (void)shared;		/* readers lock the archive like writers */
+    lock_archive(dir);
+}
+
 void unlock_archive(void)
 {
     if (lockfile && i_locked_it)
 	remove(lockfile);
     lockfile[0] = '\0';
 }
+
+#endif /* HAVE_FCNTL_H */
+
+/*
+** Looks for --read-lock in the arguments. What follows it is a command
+** to run with the archive locked for reading; it is taken out of the
+** arguments and returned, or NULL if there is no --read-lock.
+*/
+
+char **read_lock_args(int *argcp, char **argv)
+{
+    int i;
+
+    for (i = 1; i < *argcp; i++) {
+	if (!strcmp(argv[i], "--"))
+	    break;
+	if (!strcmp(argv[i], "--read-lock")) {
+	    if (i + 1 == *argcp)
+		return NULL;
+	    argv[i] = NULL;
+	    *argcp = i;
+	    return &argv[i + 1];
+	}
+    }
+    return NULL;
+}
+
+/*
+** Runs cmd with the archive in dir locked for reading, and returns its
+** exit status.
+*/
+
+int run_read_locked(char *dir, char **cmd)
+{
+    int status;
+    pid_t pid;
+
+    lock_archive_mode(dir, 1);
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) == -1) {
+	snprintf(errmsg, sizeof(errmsg), "Couldn't fork for %s: %s.",
+		 cmd[0], strerror(errno));
+	progerr(errmsg);
+    }
+    if (pid == 0) {
+	execvp(cmd[0], cmd);
+	fprintf(stderr, "%s: couldn't run %s: %s\n", PROGNAME, cmd[0],
+		strerror(errno));
+	_exit(127);
+    }
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+	;
+    unlock_archive();
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -20,6 +20,7 @@
 */
 
 #include "hypermail.h"
+#include "stats.h"
 
 /* Just a tiny malloc() error checker! */
 
@@ -29,6 +30,10 @@ void *emalloc(int i)
 
     if ((p = (void *)malloc(i)) == NULL)
 	progerr(lang[MSG_RAN_OUT_OF_MEMORY]);
+    if (stats_file) {
+	STATS_ADD(stats_allocs, 1);
+	STATS_ADD(stats_alloc_bytes, i);
+    }
     return p;
 }
 
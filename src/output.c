@@ -0,0 +1,401 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+/*
+** Writing the archive pages.
+**
+** Every page goes through output_open()/output_close() instead of
+** fopen()/fclose(). The page is built in memory and, once complete,
+** written with a single write() to a temporary file in the same
+** directory that is then renamed over the old page, so a web server
+** never sees a truncated or half-written page. With sync_output set,
+** the data is flushed to disk once, at the end of the run.
+**
+** With skip_unchanged_pages set, a page is first compared with the
+** one already on disk and left alone if they only differ by the date
+** the archive was generated, so unchanged pages keep their mtime and
+** caches and mirrors don't have to fetch them again.
+*/
+
+#define _GNU_SOURCE		/* for syncfs() */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hypermail.h"
+#include "setup.h"
+#include "compress.h"
+#include "output.h"
+#include "stats.h"
+
+struct outfile {
+    FILE *fp;
+    char *filename;
+    char *buf;			/* page contents, with open_memstream */
+    size_t size;
+    char *tmpname;		/* temporary file, without it */
+    struct outfile *next;
+};
+
+static struct outfile *open_outputs;
+
+static int pages_written;
+static int pages_unchanged;
+
+/*
+** Returns the name of the temporary file used to replace filename:
+** a hidden file next to it, so rename() stays within one filesystem.
+** Uses malloc() rather than emalloc(), as it's called from threads.
+*/
+
+static char *output_tmpname(const char *filename)
+{
+    const char *base = strrchr(filename, PATH_SEPARATOR);
+    size_t dirlen = base ? (size_t)(base - filename + 1) : 0;
+    size_t len = strlen(filename);
+    char *tmpname = (char *)malloc(len + 6);
+
+    if (!tmpname)
+	return NULL;
+    memcpy(tmpname, filename, dirlen);
+    tmpname[dirlen] = '.';
+    memcpy(tmpname + dirlen + 1, filename + dirlen, len - dirlen);
+    memcpy(tmpname + len + 1, ".tmp", 5);
+    return tmpname;
+}
+
+/*
+** Moves a completed temporary file over filename. If mode is -1, the
+** permissions of the file being replaced are kept.
+*/
+
+static int install_tmp(const char *tmpname, const char *filename, int mode)
+{
+    struct stat stbuf;
+
+    if (mode == -1 && stat(filename, &stbuf) == 0)
+	mode = stbuf.st_mode & 07777;
+    if (mode != -1 && chmod(tmpname, mode) == -1)
+	return errno;
+    if (rename(tmpname, filename) == -1)
+	return errno;
+    return 0;
+}
+
+/*
+** Atomically replaces filename with len bytes of data. Returns 0 or
+** an errno value. Safe to call from several threads at once, as long
+** as they write different files.
+*/
+
+int output_replace(const char *filename, const char *data, size_t len, int mode)
+{
+    char *tmpname = output_tmpname(filename);
+    int fd, rc = 0;
+
+    if (!tmpname)
+	return ENOMEM;
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+	rc = errno;
+	free(tmpname);
+	return rc;
+    }
+    while (len > 0) {
+	ssize_t n = write(fd, data, len);
+	if (n == -1) {
+	    if (errno == EINTR)
+		continue;
+	    rc = errno;
+	    break;
+	}
+	data += n;
+	len -= n;
+	STATS_ADD(stats_written_bytes, n);
+    }
+    if (close(fd) == -1 && !rc)
+	rc = errno;
+    if (!rc)
+	rc = install_tmp(tmpname, filename, mode);
+    if (rc)
+	unlink(tmpname);
+    free(tmpname);
+    return rc;
+}
+
+/*
+** Reads a whole file with plain read()s. Returns NULL if it can't.
+*/
+
+static char *read_whole_file(const char *filename, size_t *lenp)
+{
+    struct stat stbuf;
+    char *buf;
+    size_t got = 0;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1)
+	return NULL;
+    if (fstat(fd, &stbuf) == -1
+	|| !(buf = (char *)malloc(stbuf.st_size + 1))) {
+	close(fd);
+	return NULL;
+    }
+    while (got < (size_t)stbuf.st_size) {
+	ssize_t n = read(fd, buf + got, stbuf.st_size - got);
+	if (n <= 0) {
+	    if (n == -1 && errno == EINTR)
+		continue;
+	    free(buf);
+	    close(fd);
+	    return NULL;
+	}
+	got += n;
+    }
+    close(fd);
+    *lenp = got;
+    return buf;
+}
+
+/*
+** Compares a page with its previous version, line by line. A line
+** that differs is accepted only when it holds the date of this run
+** in the new page and what's around that date is identical in the
+** old one; that's the "generated on" date every page carries.
+*/
+
+static int same_page(const char *old, size_t oldlen,
+		     const char *new, size_t newlen)
+{
+    const char *stamp = getlocaltime();
+    size_t slen = strlen(stamp);
+    const char *oldend = old + oldlen;
+    const char *newend = new + newlen;
+
+    while (old < oldend && new < newend) {
+	const char *eol;
+	size_t olen, nlen;
+
+	eol = memchr(old, '\n', oldend - old);
+	olen = eol ? (size_t)(eol - old + 1) : (size_t)(oldend - old);
+	eol = memchr(new, '\n', newend - new);
+	nlen = eol ? (size_t)(eol - new + 1) : (size_t)(newend - new);
+
+	if (olen != nlen || memcmp(old, new, nlen)) {
+	    const char *sp;
+	    size_t pre, post;
+
+	    for (sp = new; sp + slen <= new + nlen; sp++)
+		if (*sp == *stamp && !memcmp(sp, stamp, slen))
+		    break;
+	    if (!slen || sp + slen > new + nlen)
+		return FALSE;
+	    pre = sp - new;
+	    post = nlen - pre - slen;
+	    if (olen < pre + post || olen - pre - post > DATESTRLEN + 4
+		|| memcmp(old, new, pre)
+		|| memcmp(old + olen - post, sp + slen, post))
+		return FALSE;
+	}
+	old += olen;
+	new += nlen;
+    }
+    return old == oldend && new == newend;
+}
+
+/*
+** Returns TRUE if filename already holds this page.
+*/
+
+static int page_unchanged(struct outfile *of)
+{
+    char *oldbuf, *newbuf;
+    size_t oldlen, newlen;
+    int same;
+
+    if (!set_skip_unchanged_pages)
+	return FALSE;
+    if ((oldbuf = read_whole_file(of->filename, &oldlen)) == NULL)
+	return FALSE;
+    if (of->tmpname) {
+	if ((newbuf = read_whole_file(of->tmpname, &newlen)) == NULL) {
+	    free(oldbuf);
+	    return FALSE;
+	}
+    }
+    else {
+	newbuf = of->buf;
+	newlen = of->size;
+    }
+    same = same_page(oldbuf, oldlen, newbuf, newlen);
+    free(oldbuf);
+    if (newbuf != of->buf)
+	free(newbuf);
+    return same;
+}
+
+/*
+** Starts a new page. Returns NULL, like fopen(), if it can't.
+*/
+
+FILE *output_open(const char *filename)
+{
+    struct outfile *of = (struct outfile *)emalloc(sizeof(struct outfile));
+
+    of->filename = strsav(filename);
+    of->buf = NULL;
+    of->size = 0;
+    of->tmpname = NULL;
+#ifdef HAVE_OPEN_MEMSTREAM
+    of->fp = open_memstream(&of->buf, &of->size);
+#else
+    of->tmpname = output_tmpname(filename);
+    of->fp = of->tmpname ? fopen(of->tmpname, "w") : NULL;
+#endif
+    if (of->fp == NULL) {
+	free(of->tmpname);
+	free(of->filename);
+	free(of);
+	return NULL;
+    }
+    of->next = open_outputs;
+    open_outputs = of;
+    return of->fp;
+}
+
+static struct outfile *output_find(FILE *fp)
+{
+    struct outfile **opp, *of;
+
+    for (opp = &open_outputs; (of = *opp) != NULL; opp = &of->next)
+	if (of->fp == fp) {
+	    *opp = of->next;
+	    return of;
+	}
+    return NULL;
+}
+
+static void output_free(struct outfile *of)
+{
+    if (of->tmpname)
+	free(of->tmpname);
+    if (of->buf)
+	free(of->buf);
+    free(of->filename);
+    free(of);
+}
+
+/*
+** Finishes a page started with output_open() and puts it in place.
+*/
+
+void output_close(FILE *fp)
+{
+    struct outfile *of;
+    long written;
+    int rc;
+
+    if (fp == NULL)
+	return;
+    if ((of = output_find(fp)) == NULL) {
+	fclose(fp);
+	return;
+    }
+    written = of->tmpname ? ftell(fp) : 0;
+    rc = (fclose(fp) == EOF) ? errno : 0;
+    if (written > 0)
+	STATS_ADD(stats_written_bytes, written);
+    if (!rc && page_unchanged(of)) {
+	if (of->tmpname)
+	    unlink(of->tmpname);
+	++pages_unchanged;
+	compress_check(of->filename);
+	output_free(of);
+	return;
+    }
+    if (!rc) {
+	if (of->tmpname)
+	    rc = install_tmp(of->tmpname, of->filename, -1);
+	else
+	    rc = output_replace(of->filename, of->buf, of->size, -1);
+    }
+    if (rc) {
+	if (of->tmpname)
+	    unlink(of->tmpname);
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %s.",
+		 lang[MSG_COULD_NOT_WRITE], of->filename, strerror(rc));
+	output_free(of);
+	progerr(errmsg);
+    }
+    ++pages_written;
+    compress_register(of->filename);
+    output_free(of);
+}
+
+/*
+** Drops a page started with output_open(); the old one, if any, is
+** left untouched.
+*/
+
+void output_discard(FILE *fp)
+{
+    struct outfile *of;
+
+    if (fp == NULL)
+	return;
+    of = output_find(fp);
+    fclose(fp);
+    if (of) {
+	if (of->tmpname)
+	    unlink(of->tmpname);
+	output_free(of);
+    }
+}
+
+/*
+** Flushes everything written during this run to disk, if asked to.
+*/
+
+void output_sync(void)
+{
+    if (!set_sync_output)
+	return;
+#ifdef HAVE_SYNCFS
+    {
+	int fd = open(set_dir, O_RDONLY);
+	if (fd != -1) {
+	    int rc = syncfs(fd);
+	    close(fd);
+	    if (rc == 0)
+		return;
+	}
+    }
+#endif
+    sync();
+}
+
+/*
+** Tells how many pages were written, and how many were left alone
+** because they hadn't changed.
+*/
+
+void output_report(void)
+{
+    stats_count("pages_written", pages_written);
+    stats_count("pages_unchanged", pages_unchanged);
+    if (set_showprogress && set_skip_unchanged_pages)
+	printf("%d pages written, %d unchanged.\n",
+	       pages_written, pages_unchanged);
+}
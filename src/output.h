@@ -0,0 +1,10 @@
+/*
+** output.c functions
+*/
+
+FILE *output_open(const char *);
+void output_close(FILE *);
+void output_discard(FILE *);
+int output_replace(const char *, const char *, size_t, int);
+void output_sync(void);
+void output_report(void);
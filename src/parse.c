@@ -31,6 +31,12 @@
 #include "getname.h"
 #include "parse.h"
 #include "print.h"
+#include "output.h"
+#include "attach.h"
+#include "regexset.h"
+#include "stats.h"
+#include "thread.h"
+#include "source.h"
 
 #ifdef GDBM
 #include "gdbm.h"
@@ -351,184 +357,6 @@ create_attachname(char *attachname, int max_len)
     safe_filename(attachname);
 }
 
-/*
-** Cross-indexes - adds to a list of replies. If a message is a reply to
-** another, the number of the message it's replying to is added to the list.
-** This list is searched upon printing.
-*/
-
-void crossindex(void)
-{
-    int num, status, maybereply;
-    struct emailinfo *email;
-
-    num = 0;
-    if(!set_linkquotes)
-        replylist = NULL;
-
-    while (num <= max_msgnum) {
-	if (!hashnumlookup(num, &email)) {
-	    ++num;
-	    continue;
-	}
-	status = hashreplynumlookup(email->msgnum,
-				    email->inreplyto, email->subject,
-				    &maybereply);
-	if (status != -1) {
-	    struct emailinfo *email2;
-            
-	    if (!hashnumlookup(status, &email2)) {
-		++num;
-		continue;
-	    }
-	    /*  make sure there is no recursion between the message
-                and reply lookup if a message and its reply-to were
-                archived in reverse, both messages share the same
-                subject (regardless of Re), and the message itself was
-                a reply to a non-archived message. */
-	    if (maybereply && !strcmp (email2->inreplyto, email->msgid)) {
-                ++num;
-                continue;
-            }
-            
-	    if (set_linkquotes) {
-	        struct reply *rp;
-		int found_num = 0;
-		for (rp = replylist; rp != NULL; rp = rp->next)
-		    if(rp->msgnum == status && rp->frommsgnum == num) {
-		        found_num = 1;
-			break;
-		    }
-		if (!found_num && !(maybereply || num <= status))
-#ifdef FASTREPLYCODE
-		    replylist = addreply2(replylist, email2, email, maybereply,
-					 &replylist_end);
-#else
-		    replylist = addreply(replylist, status, email, maybereply,
-					 &replylist_end);
-#endif		
-	    }
-	    else {
-#ifdef FASTREPLYCODE
-		replylist = addreply2(replylist, email2, email, maybereply,
-				      &replylist_end);
-#else
-		replylist = addreply(replylist, status, email, maybereply,
-				     &replylist_end);
-#endif		
-	    }
-	}
-	num++;
-    }
-#if DEBUG_THREAD
-    {
-	struct reply *r;
-	r = replylist;
-	fprintf(stderr, "START of replylist after crossindex\n");
-	fprintf(stderr, "- msgnum frommsgnum maybereply msgid\n");
-	while (r != NULL) {
-	    fprintf(stderr, "- %d %d %d '%s'\n",
-		    r->data->msgnum,
-		    r->frommsgnum, r->maybereply, r->data->msgid);
-	    r = r->next;
-	}
-	fprintf(stderr, "END of replylist after crossindex\n");
-    }
-#endif
-}
-
-/* 
-** Recursively checks for replies to replies to a message, etc.
-** Replies are added to the thread list.
-*/
-
-#ifdef FASTREPLYCODE
-void crossindexthread2(int num)
-{
-    struct reply *rp;
-    struct emailinfo *ep;
-    if(!hashnumlookup(num, &ep)) {
-	char errmsg[512];
-        snprintf(errmsg, sizeof(errmsg), 
-                 "internal error crossindexthread2 %d", num);
-	progerr(errmsg);
-    }
-
-    for (rp = ep->replylist; rp != NULL; rp = rp->next) {
-	if (!(rp->data->flags & USED_THREAD)) {
-	    rp->data->flags |= USED_THREAD;
-	    if (0) fprintf(stderr, "add thread.b %d %d %d\n", num, rp->data->msgnum, rp->msgnum);
-	    threadlist = addreply(threadlist, num, rp->data, 0,
-				  &threadlist_end);
-	    printedlist = markasprinted(printedthreadlist, rp->msgnum);
-	    crossindexthread2(rp->msgnum);
-	}
-    }
-}
-#else
-void crossindexthread2(int num)
-{
-    struct reply *rp;
-
-    for (rp = replylist; rp != NULL; rp = rp->next) {
-	if (!(rp->data->flags & USED_THREAD) && (rp->frommsgnum == num)) {
-	    rp->data->flags |= USED_THREAD;
-	    threadlist = addreply(threadlist, num, rp->data, 0,
-				  &threadlist_end);
-	    printedlist = markasprinted(printedthreadlist, rp->msgnum);
-	    crossindexthread2(rp->msgnum);
-	}
-    }
-}
-#endif
-
-
-/*
-** First, print out the threads in order by date...
-** Each message number is appended to a thread list. Threads and individual
-** messages are separated by a -1.
-*/
-
-void crossindexthread1(struct header *hp)
-{
-    int isreply;
-
-#ifndef FASTREPLYCODE
-    struct reply *rp;
-#endif
-
-    if (hp) {
-	crossindexthread1(hp->left);
-
-#ifdef FASTREPLYCODE
-	isreply = hp->data->isreply;
-#else
-	for (isreply = 0, rp = replylist; rp != NULL; rp = rp->next) {
-	    if (rp->msgnum == hp->data->msgnum) {
-		isreply = 1;
-		break;
-	    }
-	}
-#endif
-
-	/* If this message is not a reply to any other messages then it
-	 * is the first message in a thread.  If it hasn't already
-	 * been dealt with, then add it to the thread list, followed by
-	 * any descendants and then the end of thread marker.
-	 */
-	if (!isreply && !wasprinted(printedthreadlist, hp->data->msgnum) &&
-	    !(hp->data->flags & USED_THREAD)) {
-	    hp->data->flags |= USED_THREAD;
-	    threadlist = addreply(threadlist, hp->data->msgnum, hp->data,
-				  0, &threadlist_end);
-	    crossindexthread2(hp->data->msgnum);
-	    threadlist = addreply(threadlist, -1, NULL, 0, &threadlist_end);
-	}
-
-	crossindexthread1(hp->right);
-    }
-}
-
 /*
 ** Grabs the date string from a Date: header. (Y2K OK)
 */
@@ -622,6 +450,90 @@ char *getid(char *line)
     RETURN_PUSH(buff);
 }
 
+/*
+** Grabs the message IDs from a References: header, oldest first and
+** separated by spaces. Only the newest ones that fit in REFSSTRLEN are
+** kept, which is plenty to find a parent in the archive. Continuation
+** lines are spamified like the first line was, so that the IDs compare
+** equal to those getid() returns.
+**
+** Returns ALLOCATED string, or NULL if there are no IDs.
+*/
+
+char *getrefs(char *header)
+{
+    char *line = spamify(strsav(header));
+    char *c, *end, *s;
+    int len;
+
+    struct Push buff;
+
+    INIT_PUSH(buff);
+
+    for (c = strchr(line, '<'); c != NULL; c = strchr(end, '<')) {
+	++c;
+	end = c + strcspn(c, "<> \t\n");
+	if (*end != '>' || end == c)
+	    continue;		/* not an ID, or not a well formed one */
+	if (PUSH_STRLEN(buff))
+	    PushByte(&buff, ' ');
+	PushNString(&buff, c, end - c);
+    }
+    free(line);
+
+    s = PUSH_STRING(buff);
+    if (s && (len = strlen(s)) > REFSSTRLEN) {
+	for (c = s + len - REFSSTRLEN; *c && c[-1] != ' '; c++)
+	    ;
+	memmove(s, c, strlen(c) + 1);
+	if (!*s) {
+	    free(s);
+	    s = NULL;
+	}
+    }
+    return s;
+}
+
+/*
+** unspamify() for each of the ids of a References list.
+*/
+
+static char *unspamify_refs(char *refs)
+{
+    char *id, *p;
+
+    struct Push buff;
+
+    INIT_PUSH(buff);
+
+    if (!refs)
+	return NULL;
+    for (id = strtok(refs, " "); id != NULL; id = strtok(NULL, " ")) {
+	p = unspamify(id);
+	if (PUSH_STRLEN(buff))
+	    PushByte(&buff, ' ');
+	PushString(&buff, p);
+	free(p);
+    }
+    RETURN_PUSH(buff);
+}
+
+/*
+** Gives a message the References ids read for it, unless they only
+** name the message it is in reply to. Takes over refs.
+*/
+
+static void set_references(struct emailinfo *emp, char *refs)
+{
+    if (!refs)
+	return;
+    if (emp->references
+	|| (emp->inreplyto && !strcmp(refs, emp->inreplyto)))
+	free(refs);
+    else
+	emp->references = refs;
+}
+
 
 /*
 ** Grabs the subject from the Subject: header.
@@ -1304,60 +1216,36 @@ static char * mdecodeQP(FILE *file, char *input, char **result, int *length,
     int outcount = 0;
     char i_buffer[MAXLINE];
     char *buffer;
-    unsigned char inchar;
     char *output;
+    int size = strlen(input) + 1;
+    int soft;
     struct Push pbuf;
 
-    int len = strlen(input);
-    output = strsav(input);
+    output = (char *)emalloc(size);
 
     INIT_PUSH(pbuf);
 
-    while ((inchar = *input) != '\0') {
-
-	if (outcount >= len - 1) {
-	    /* we need to enlarge the destination area! */
-	    /* double the size each time enlargement is needed */
-	    char *newp = (char *)realloc(output, len * 2);
-	    if (newp) {
-		output = newp;
-		len *= 2;
+    for (;;) {
+	outcount += qpDecode(input, output + outcount, &soft);
+	if (!soft || !fgets(i_buffer, MAXLINE, file))
+	    break;
+	buffer = i_buffer + set_ietf_mbox;
+	if (set_append) {
+	    if(fputs(buffer, fpo) < 0) {
+		progerr("Can't write to \"mbox\""); /* revisit me */
 	    }
-	    else
-		break;
 	}
-
-	input++;
-	if ('=' == inchar) {
-	    int value;
-	    if ('\n' == *input) {
-		if (!fgets(i_buffer, MAXLINE, file))
-		    break;
-		buffer = i_buffer + set_ietf_mbox;
-		if (set_append) {
-		  if(fputs(buffer, fpo) < 0) {
-		    progerr("Can't write to \"mbox\""); /* revisit me */
-		  }
-		}
-		input = buffer;
-		PushString(&pbuf, buffer);
-		continue;
-	    }
-	    else if ('=' == *input) {
-		inchar = '=';
-		input++;	/* pass this */
-	    }
-	    else if (isxdigit(*input)) {
-		sscanf(input, "%02X", &value);
-		inchar = (unsigned char)value;
-		input += 2;	/* pass the two letters */
-	    }
-	    else
-		inchar = '=';
+	PushString(&pbuf, buffer);
+	input = buffer;
+	if (outcount + (int)strlen(input) + 1 > size) {
+	    /* double the size each time enlargement is needed */
+	    while (outcount + (int)strlen(input) + 1 > size)
+		size *= 2;
+	    output = (char *)realloc(output, size);
+	    if (!output)
+		progerr(lang[MSG_RAN_OUT_OF_MEMORY]);
 	}
-	output[outcount++] = inchar;
     }
-    output[outcount] = 0;	/* zero terminate */
 
     *result = output;
     *length = outcount;
@@ -1482,6 +1370,125 @@ static int do_uudecode(FILE *fp, char *line, char *line_buf,
     return 1;
 }
 
+/*
+** Attachments are decoded a line at a time. The decoded pieces are
+** collected here and written in large chunks rather than with one
+** write() per line. With attachment_store, attachments of up to
+** STORE_HOLD_LIMIT bytes are kept in memory until they're complete,
+** so that one the store already has is never written at all.
+*/
+
+#define BINFILE_BUFSIZE 65536
+#define STORE_HOLD_LIMIT (4 * 1024 * 1024)
+
+static char *binfile_buf;
+static int binfile_bufsize;
+static int binfile_buflen;
+static char *binfile_name;		/* for the store */
+static bool binfile_held;		/* nothing written to the file yet */
+static struct attach_digest binfile_digest;
+
+#ifdef O_BINARY
+#define OPENBITMASK O_WRONLY | O_CREAT | O_TRUNC | O_BINARY
+#else
+#define OPENBITMASK O_WRONLY | O_CREAT | O_TRUNC
+#endif
+
+static int binfile_open(char *binname)
+{
+    int fd;
+
+    if (set_attachment_store)
+	/* it may be a link to a stored copy, which must stay as it is */
+	unlink(binname);
+    fd = open(binname, OPENBITMASK, set_filemode);
+    if (fd != -1 && set_attachment_store) {
+	binfile_name = strsav(binname);
+	binfile_held = TRUE;
+	attach_digest_init(&binfile_digest);
+    }
+    binfile_buflen = 0;
+    return fd;
+}
+
+static void binfile_flush(int fd, struct attach *ap)
+{
+    char *p = binfile_buf;
+
+    while (binfile_buflen > 0) {
+	ssize_t written = write(fd, p, binfile_buflen);
+	if (written < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	if (ap)
+	    ap->size += written;
+	STATS_ADD(stats_written_bytes, written);
+	p += written;
+	binfile_buflen -= written;
+    }
+    binfile_buflen = 0;
+}
+
+static void binfile_write(int fd, struct attach *ap, const char *data, int len)
+{
+    int limit = BINFILE_BUFSIZE;
+
+    if (set_attachment_store) {
+	attach_digest_add(&binfile_digest, data, len);
+	if (binfile_held && binfile_buflen + len <= STORE_HOLD_LIMIT)
+	    limit = STORE_HOLD_LIMIT;
+	else
+	    binfile_held = FALSE;
+    }
+    if (binfile_buflen + len > limit)
+	binfile_flush(fd, ap);
+    if (len > limit) {
+	ssize_t written = write(fd, data, len);
+	if (written > 0) {
+	    if (ap)
+		ap->size += written;
+	    STATS_ADD(stats_written_bytes, written);
+	}
+	return;
+    }
+    if (binfile_buflen + len > binfile_bufsize) {
+	while (binfile_buflen + len > binfile_bufsize)
+	    binfile_bufsize = binfile_bufsize ? binfile_bufsize * 2
+		: BINFILE_BUFSIZE;
+	binfile_buf = (char *)realloc(binfile_buf, binfile_bufsize);
+	if (!binfile_buf)
+	    progerr(lang[MSG_RAN_OUT_OF_MEMORY]);
+    }
+    memcpy(binfile_buf + binfile_buflen, data, len);
+    binfile_buflen += len;
+}
+
+static void binfile_close(char *dir, int *fdp, struct attach **app)
+{
+    bool linked = FALSE;
+
+    if (set_attachment_store && binfile_held
+	&& attach_link_stored(dir, binfile_name, &binfile_digest,
+			      binfile_buf)) {
+	if (*app)
+	    (*app)->size = binfile_buflen;
+	binfile_buflen = 0;
+	linked = TRUE;
+    }
+    binfile_flush(*fdp, *app);
+    close(*fdp);
+    if (set_attachment_store) {
+	if (!linked)
+	    attach_store(dir, binfile_name, &binfile_digest);
+	free(binfile_name);
+	binfile_name = NULL;
+    }
+    *fdp = -1;
+    *app = NULL;
+}
+
 static void write_txt_file(struct emailinfo *emp, struct Push *raw_text_buf)
 {
     char *txt_filename;
@@ -1505,6 +1512,80 @@ static void write_txt_file(struct emailinfo *emp, struct Push *raw_text_buf)
     INIT_PUSH(*raw_text_buf);
 }
 
+/*
+** The headers parsemail() acts on are found with a perfect hash of the
+** name: its length plus a value for its next to last and its middle
+** letter, modulo 16, which puts each of them in a slot of its own. The
+** letter values were found by search; adding a name means searching
+** again, so that it too gets a free slot.
+*/
+
+#define HEADER_SLOTS 16
+
+static const unsigned char header_letter_values[26] = {
+     0,  0, 10,  0,  5,  0,  7,  0, 13,  0,  0,  0,  0,	/* a-m */
+     3, 11,  8,  0,  0, 10, 12,  0,  0,  0,  0,  0,  0	/* n-z */
+};
+
+static const struct {
+    const char *name;
+    header_kind_t kind;
+} header_slots[HEADER_SLOTS] = {
+    { "Content-Type", HEADER_CONTENT_TYPE },		/*  0 */
+    { "Subject", HEADER_SUBJECT },			/*  1 */
+    { "Content-Base", HEADER_CONTENT_BASE },		/*  2 */
+    { "Content-Description", HEADER_CONTENT_DESCRIPTION },	/*  3 */
+    { "References", HEADER_REFERENCES },		/*  4 */
+    { NULL, HEADER_UNKNOWN },				/*  5 */
+    { "Content-Transfer-Encoding", HEADER_CONTENT_TRANSFER_ENCODING }, /*  6 */
+    { NULL, HEADER_UNKNOWN },				/*  7 */
+    { NULL, HEADER_UNKNOWN },				/*  8 */
+    { NULL, HEADER_UNKNOWN },				/*  9 */
+    { "From", HEADER_FROM },				/* 10 */
+    { "Content-Disposition", HEADER_CONTENT_DISPOSITION },	/* 11 */
+    { "Date", HEADER_DATE },				/* 12 */
+    { NULL, HEADER_UNKNOWN },				/* 13 */
+    { "Message-Id", HEADER_MESSAGE_ID },		/* 14 */
+    { "In-Reply-To", HEADER_IN_REPLY_TO },		/* 15 */
+};
+
+static int header_letter_value(char c)
+{
+    c = tolower((unsigned char)c);
+    return (c >= 'a' && c <= 'z') ? header_letter_values[c - 'a'] : 0;
+}
+
+/*
+** Which of the headers above a header line is, with one hash and one
+** compare. The answer is kept in the line, for the second look
+** parsemail() takes at the MIME headers.
+*/
+
+static header_kind_t header_kind(struct body *head)
+{
+    const char *line = head->line;
+    size_t len;
+    int slot;
+
+    if (head->kind)
+	return (header_kind_t)head->kind;
+    head->kind = HEADER_UNKNOWN;
+    len = strcspn(line, ":");
+    if (line[len] == ':' && len >= 2) {
+	slot = (len + header_letter_value(line[len - 2])
+		+ header_letter_value(line[len / 2])) % HEADER_SLOTS;
+	if (header_slots[slot].name
+	    && strlen(header_slots[slot].name) == len
+	    && !strncasecmp(line, header_slots[slot].name, len))
+	    head->kind = header_slots[slot].kind;
+    }
+    return (header_kind_t)head->kind;
+}
+
+/* MIME-decoded body lines, for --stats */
+static long decoded_lines;
+static long decoded_bytes;
+
 /*
 ** Parsing...the heart of Hypermail!
 ** This loads in the articles from stdin or a mailbox, adding the right
@@ -1527,6 +1608,7 @@ int parsemail(char *mbox,	/* file name */
     char *subject = NULL;
     char *msgid = NULL;
     char *inreply = NULL;
+    char *references = NULL;
     char *namep = NULL;
     char *emailp = NULL;
     char *line = NULL; 
@@ -1628,6 +1710,8 @@ int parsemail(char *mbox,	/* file name */
     bool delsp_flag = FALSE;
 
     int binfile = -1;
+    struct attach *attachments = NULL;	/* stored for this message so far */
+    struct attach *cur_attachment = NULL;	/* the one binfile is */
 
     char *charset = NULL;	/* this is the LOCAL charset used in the mail */
     char *charsetsave;      /* charset in MIME encoded text */
@@ -1695,6 +1779,7 @@ int parsemail(char *mbox,	/* file name */
 	    progerr(errmsg);
 	}
     }
+    source_begin(fp != stdin ? mbox : NULL, fp, pathname, fpo);
 
     num = startnum;
 
@@ -1746,6 +1831,8 @@ int parsemail(char *mbox,	/* file name */
 
     for ( ; fgets(line_buf, MAXLINE, fp) != NULL; 
 	  set_txtsuffix ? PushString(&raw_text_buf, line_buf) : 0) {
+	if (stats_file)
+	    STATS_ADD(stats_read_bytes, strlen(line_buf));
 #if DEBUG_PARSE
         fprintf(stderr,"\n^IN: %s", line_buf);
         fprintf(stderr, "^  BP %.0s: %.40s|\n^  LP %.0s: %.40s|\n^ ABP %.0s: %.40s|\n^ ALP %.0s: %.40s|\n^ OBP %.0s: %.40s|\n^ "
@@ -1773,13 +1860,14 @@ int parsemail(char *mbox,	/* file name */
             }
         }
         
-	if (!is_deleted &&
-	    inlist_regex_pos(set_filter_out_full_body, line) != -1) {
-	    is_deleted = FILTERED_OUT;
-	}
-	pos = inlist_regex_pos(set_filter_require_full_body, line);
-	if (pos != -1 && pos < require_filter_full_len) {
-	    require_filter_full[pos] = TRUE;
+	if (set_filter_out_full_body || set_filter_require_full_body) {
+	    int linelen = strlen(line);
+	    if (!is_deleted &&
+		regex_first(set_filter_out_full_body, line, linelen) != -1) {
+		is_deleted = FILTERED_OUT;
+	    }
+	    regex_all(set_filter_require_full_body, line, linelen,
+		      require_filter_full);
 	}
 	if (isinheader) {
 	    if (!strncasecmp(line_buf, "From ", 5))
@@ -1806,6 +1894,7 @@ int parsemail(char *mbox,	/* file name */
 
 	    else if (line[0] == '\n' || (line[0] == '\r' && line[1] == '\n')) {
 		struct body *head;
+		header_kind_t kind;
 
 		char savealternative;
 
@@ -1872,17 +1961,17 @@ int parsemail(char *mbox,	/* file name */
 		        is_deleted = FILTERED_OUT;
 		    }
 
-		    pos = inlist_regex_pos(set_filter_require, head->line);
-		    if (pos != -1 && pos < require_filter_len) {
-		        require_filter[pos] = TRUE;
-		    }
+		    if (set_filter_require)
+			regex_all(set_filter_require, head->line,
+				  strlen(head->line), require_filter);
 
-		    if (!strncasecmp(head->line, "Date:", 5)) {
+		    kind = header_kind(head);
+		    if (kind == HEADER_DATE) {
 			date = getmaildate(head->line);
 			head->parsedheader = TRUE;
 			hasdate = 1;
 		    }
-		    else if (!strncasecmp(head->line, "From:", 5)) {
+		    else if (kind == HEADER_FROM) {
 			getname(head->line, &namep, &emailp);
 			head->parsedheader = TRUE;
                         if (set_spamprotect) {
@@ -1892,20 +1981,20 @@ int parsemail(char *mbox,	/* file name */
 			    namep = spamify(strsav(namep));
                         }
 		    }
-		    else if (!strncasecmp(head->line, "Message-Id:", 11)) {
+		    else if (kind == HEADER_MESSAGE_ID) {
 			msgid = getid(head->line);
 			head->parsedheader = TRUE;
 		    }
-		    else if (!strncasecmp(head->line, "Subject:", 8)) {
+		    else if (kind == HEADER_SUBJECT) {
 			subject = getsubject(head->line);
 			hassubject = 1;
 			head->parsedheader = TRUE;
 		    }
-		    else if (!strncasecmp(head->line, "In-Reply-To:", 12)) {
+		    else if (kind == HEADER_IN_REPLY_TO) {
 			inreply = getreply(head->line);
 			head->parsedheader = TRUE;
 		    }
-		    else if (!strncasecmp(head->line, "References:", 11)) {
+		    else if (kind == HEADER_REFERENCES) {
 			/*
 			 * Adding threading capability for the "References" 
 			 * header, ala RFC 822, used only for messages that 
@@ -1916,12 +2005,14 @@ int parsemail(char *mbox,	/* file name */
 			 */
 			if (!inreply)
 			    inreply = getid(head->line);
+			if (!references)
+			    references = getrefs(head->line);
 			if (set_linkquotes) {
 			    bp = addbody(bp, &lp, line, 0);
 			}
                         head->parsedheader = TRUE;
 		    }
-                    else if (!strncasecmp(head->line, "Content-Type:", 13)) {
+                    else if (kind == HEADER_CONTENT_TYPE) {
                         content_type_p = head;
                     }
 		    else if (applemail_ua_header_len > 0
@@ -1989,13 +2080,14 @@ int parsemail(char *mbox,	/* file name */
 		    if (head->parsedheader || !head->header)
 			continue;
 		    /* Content-Description is defined ... where?? */
-		    if (!strncasecmp(head->line, "Content-Description:", 20)) {
+		    kind = header_kind(head);
+		    if (kind == HEADER_CONTENT_DESCRIPTION) {
 			char *ptr = head->line;
 			description = ptr + 21;
 		    }
 		    /* Content-Disposition is defined in RFC 2183 */
 		    else
-			if (!strncasecmp (head->line, "Content-Disposition:", 20)) {
+			if (kind == HEADER_CONTENT_DISPOSITION) {
 			char *ptr = head->line + 20;
 			char *fname;
 			char *jp;
@@ -2071,7 +2163,7 @@ int parsemail(char *mbox,	/* file name */
 			    file_created = MAKE_FILE;	/* please make one */
 			} /* inline */
                         } /* Content-Disposition: */
-		    else if (!strncasecmp(head->line, "Content-Base:", 13)) {
+		    else if (kind == HEADER_CONTENT_BASE) {
 #ifdef NOTUSED
 			char *ptr = head->line + 13;
 #endif
@@ -2081,7 +2173,7 @@ int parsemail(char *mbox,	/* file name */
 			head->parsedheader = TRUE;
 
                     }
-		    else if (!strncasecmp(head->line, "Content-Type:", 13)) {
+		    else if (kind == HEADER_CONTENT_TYPE) {
 			char *ptr = head->line + 13;
 #define DISP_HREF 1
 #define DISP_IMG  2
@@ -2188,6 +2280,7 @@ int parsemail(char *mbox,	/* file name */
 				if (alternative_lastfile[0] != '\0') {
 				    /* remove the previous attachment */
 				    unlink(alternative_lastfile);
+				    attach_drop(&attachments, alternative_lastfile);
 				    alternative_lastfile[0] = '\0';
 				}
 			    }
@@ -2462,8 +2555,7 @@ int parsemail(char *mbox,	/* file name */
 			}
 		    }
 		    else 
-			if (!strncasecmp
-			    (head->line, "Content-Transfer-Encoding:", 26)) {
+			if (kind == HEADER_CONTENT_TRANSFER_ENCODING) {
 			char *ptr = head->line + 26;
 
 			head->parsedheader = TRUE;
@@ -2559,10 +2651,8 @@ int parsemail(char *mbox,	/* file name */
 	    if (!readone &&
 		!strncmp(line_buf, "From ", 5) &&
 		(*(dp = getfromdate(line)) != '\0')) {
-		if (-1 != binfile) {
-		    close(binfile);
-		    binfile = -1;
-		}
+		if (-1 != binfile)
+		    binfile_close(dir, &binfile, &cur_attachment);
 
                 /* as long as we don't handle UTF-8 throughout), use the prefered
                    content charset if we got one  */
@@ -2647,6 +2737,9 @@ int parsemail(char *mbox,	/* file name */
 
 		while (rmlastlines(bp));
 
+		/* the message ended before this "From " line */
+		source_boundary(fp, fpo, strlen(line_buf));
+
 		if (set_mbox_shortened && !increment && num == startnum
 		    && max_msgnum >= set_startmsgnum) {
 		    emp = hashlookupbymsgid(msgid);
@@ -2674,6 +2767,7 @@ msgid);
 		  emp =
 		    addhash(num, date, namep, emailp, msgid, subject,
 			    inreply, fromdate, charset, NULL, NULL, bp);
+		source_set(emp);
                 /* 
                  * dp, if it has a value, has a date from the "From " line of
                  * the message after the one we are just finishing. 
@@ -2688,16 +2782,23 @@ msgid);
 		    emp->is_deleted = is_deleted;
 		    emp->annotation_robot = annotation_robot;
 		    emp->annotation_content = annotation_content;
+		    attach_set(emp, attachments);
+		    set_references(emp, references);
+		    references = NULL;
 
 		    if (insert_in_lists(emp, require_filter,
 					require_filter_len + require_filter_full_len))
 		        ++num_added;
 		    num++;
 		}
-		else if (att_dir != NULL) {
-		    emptydir(att_dir);
-		    rmdir(att_dir);
+		else {
+		    attach_free(attachments);
+		    if (att_dir != NULL) {
+			emptydir(att_dir);
+			rmdir(att_dir);
+		    }
 		}
+		attachments = cur_attachment = NULL;
 		for (pos = 0; pos < require_filter_len; ++pos)
 		    require_filter[pos] = FALSE;
 		for (pos = 0; pos < require_filter_full_len; ++pos)
@@ -2713,6 +2814,10 @@ msgid);
 		    free(inreply);
 		    inreply = NULL;
 		}
+		if (references) {
+		    free(references);
+		    references = NULL;
+		}
 		if (charset) {
 		    free(charset);
 		    charset = NULL;
@@ -2991,10 +3096,8 @@ msgid);
                             printf("New section: restoring charset %s and charsetsave %s\n", charset, charsetsave);
 #endif
                         }
-			if (-1 != binfile) {
-			    close(binfile);
-			    binfile = -1;
-			}
+			if (-1 != binfile)
+			    binfile_close(dir, &binfile, &cur_attachment);
                         
 			continue;
 		    }
@@ -3030,6 +3133,10 @@ msgid);
 		    data = NULL;
 		    break;
 		}
+		if (stats_file && decode != ENCODE_NORMAL && data) {
+		    ++decoded_lines;
+		    decoded_bytes += datalen;
+		}
 #if DEBUG_PARSE
 		printf("LINE %s\n", (content != CONTENT_BINARY) ? data : "<binary>");
 #endif
@@ -3211,20 +3318,21 @@ msgid);
                              * directories must exist first...  
                              */
 
-#ifdef O_BINARY
-#define OPENBITMASK O_WRONLY | O_CREAT | O_TRUNC | O_BINARY
-#else
-#define OPENBITMASK O_WRONLY | O_CREAT | O_TRUNC
-#endif
 			    if (binname) {
-				binfile = open(binname, OPENBITMASK,
-					       set_filemode);
+				if (-1 != binfile)
+				    binfile_close(dir, &binfile, &cur_attachment);
+				binfile = binfile_open(binname);
 
 #if DEBUG_PARSE
 				printf("%4d open attachment %s\n", num, binname);
 #endif
 				if (-1 != binfile) {
 				    chmod(binname, set_filemode);
+				    cur_attachment =
+					attach_add(&attachments,
+						   &binname[strlen(att_dir) + 1],
+						   attachname, type,
+						   description);
 				    if (set_showprogress)
 					print_progress(num, lang
 					       [MSG_CREATED_ATTACHMENT_FILE],
@@ -3413,8 +3521,7 @@ msgid);
 		    if (-1 != binfile) {
 			if (datalen < 0)
 			    datalen = strlen(data);
-
-			write(binfile, data, datalen);
+			binfile_write(binfile, cur_attachment, data, datalen);
 		    }
 		}
 
@@ -3423,6 +3530,9 @@ msgid);
 	    }
 	}
     }
+    if (-1 != binfile)
+	binfile_close(dir, &binfile, &cur_attachment);
+    source_boundary(fp, fpo, 0);
     if(set_append && fclose(fpo)) {
 	progerr("Can't close \"mbox\"");
     }
@@ -3510,11 +3620,15 @@ msgid);
         
 	emp = addhash(num, date, namep, emailp, msgid, subject, inreply,
 		      fromdate, charset, NULL, NULL, bp);
+	source_set(emp);
 	if (emp) {
 	    emp->exp_time = exp_time;
 	    emp->is_deleted = is_deleted;
 	    emp->annotation_robot = annotation_robot;
 	    emp->annotation_content = annotation_content;
+	    attach_set(emp, attachments);
+	    set_references(emp, references);
+	    references = NULL;
 	    if (insert_in_lists(emp, require_filter,
 				require_filter_len + require_filter_full_len))
 	        ++num_added;
@@ -3522,6 +3636,9 @@ msgid);
 	        write_txt_file(emp, &raw_text_buf);
 	    num++;
 	}
+	else
+	    attach_free(attachments);
+	attachments = cur_attachment = NULL;
 
 	/* @@@ if we didn't add the message, we should consider erasing the attdir
 	   if it's there */
@@ -3534,6 +3651,10 @@ msgid);
 	    free(inreply);
 	    inreply = NULL;
 	}
+	if (references) {
+	    free(references);
+	    references = NULL;
+	}
 	if (charset) {
 	    free(charset);
 	    charset = NULL;
@@ -3640,10 +3761,15 @@ msgid);
 #endif
     if (num > max_msgnum)
 	max_msgnum = num - 1;
+    stats_count("decoded_lines", decoded_lines);
+    stats_count("decoded_bytes", decoded_bytes);
+    decoded_lines = decoded_bytes = 0;
+    stats_begin("crossindex");
     crossindex();
-    threadlist = NULL;
-    printedthreadlist = NULL;
-    crossindexthread1(datelist);
+    stats_end("crossindex");
+    stats_begin("thread");
+    thread_build();
+    stats_end("thread");
 #if DEBUG_THREAD
     {
 	struct reply *r;
@@ -3713,6 +3839,7 @@ int parse_old_html(int num, struct emailinfo *ep, int parse_body,
     char *msgid = NULL;
     char *subject = NULL;
     char *inreply = NULL;
+    char *references = NULL;
     char *fromdate = NULL;
     char *charset = NULL;
     char *isodate = NULL;
@@ -3736,8 +3863,14 @@ int parse_old_html(int num, struct emailinfo *ep, int parse_body,
     char inreply_start[256];
     static char *inreply_start_old = "<li><dfn>In reply to</dfn>: <a href=\"";
 
-    if (set_nonsequential && !msgnum_id_table[num])
-      return 0;
+    const char *pagename = NULL;
+
+    if (set_nonsequential) {
+	/* the message index names the pages we don't have yet */
+	pagename = ep ? message_name(ep) : msgindex_lookup(num);
+	if (!pagename)
+	    return cmp_msgid ? -1 : 0;
+    }
 
     if (set_linkquotes) {
         snprintf(inreply_start, sizeof(inreply_start), 
@@ -3748,7 +3881,7 @@ int parse_old_html(int num, struct emailinfo *ep, int parse_body,
     if (set_nonsequential)
       trio_asprintf(&filename, "%s%s%s.%s", set_dir,
 		    subdir ? subdir->subdir : "", 
-		    msgnum_id_table[num],
+		    pagename,
 		    set_htmlsuffix);
     else
       trio_asprintf(&filename, "%s%s%.4d.%s", set_dir,
@@ -3762,6 +3895,7 @@ int parse_old_html(int num, struct emailinfo *ep, int parse_body,
      * subject  == <!-- subject="Test of the testmail mail address." -->
      * msgid    == <!-- id="199806031512.KAA22323@landfield.com" -->
      * inreply  == <!-- inreplyto="" -->
+     * references == <!-- references="" -->
      *
      * New for 2b10:
      * charset  == <!-- charset="iso-8859-2" -->
@@ -3826,12 +3960,28 @@ int parse_old_html(int num, struct emailinfo *ep, int parse_body,
 			free(valp);
 		    }
 		}
+		else if (!strcasecmp(command, "references")) {
+		    char *raw_refs = getvalue(line);
+		    valp = unspamify_refs(raw_refs);
+		    if (raw_refs) free(raw_refs);
+		    if (valp) {
+			references = unconvchars(valp);
+			free(valp);
+		    }
+		}
 		else if (!strcasecmp(command, "body")) {
 		    /*
 		     * When we reach the mail body, we know we've got all the
 		     * headers there were!
 		     */
-		    if (parse_body) {
+		    if (parse_body && (bp = source_body(num, msgid,
+					set_linkquotes ? &inreply : NULL))) {
+			if (ep != NULL)
+			    ep->bodylist = bp;
+			stats_count("source_bodies", 1);
+		    }
+		    else if (parse_body) {
+			stats_count("html_bodies", 1);
 			while (fgets(line, MAXLINE, fp)) {
 			    char *ptr;
 			    char *line2;
@@ -3906,12 +4056,16 @@ int parse_old_html(int num, struct emailinfo *ep, int parse_body,
 	    emp = addhash(num, date ? date : NODATE,
 			  name, email, msgid, subject, inreply,
 			  fromdate, charset, isodate, isofromdate, bp);
+	if (emp != NULL && pagename && !emp->pagename)
+	    emp->pagename = strsav(pagename);	/* what it was named */
 	if (cmp_msgid)
 	    msgids_are_same = !strcmp(ep->msgid, msgid);
 	if (emp != NULL && replylist_tmp != NULL) {
 	    if (do_insert) {
 	        emp->exp_time = exp_time;
 		emp->is_deleted = is_deleted;
+		set_references(emp, references);
+		references = NULL;
 		check_expiry(emp);
 		if (insert_in_lists(emp, NULL, 0))
 		    ++num_added;
@@ -3945,6 +4099,9 @@ int parse_old_html(int num, struct emailinfo *ep, int parse_body,
     if (inreply) {
 	free(inreply);
     }
+    if (references) {
+	free(references);
+    }
     if (fromdate) {
 	free(fromdate);
     }
@@ -4085,8 +4242,8 @@ static int loadoldheadersfrommessages(char *dir, int num_from_gdbm)
      * into dynamically-allocated memory, then saving if it's not corrupt. */
 
     if (set_nonsequential)
-      /* read the msgid to msgnum table */
-      msgnum_id_table = read_msgnum_id_table (max_num);
+      /* open the msgnum to file name index */
+      msgindex_load();
 
     while (num <= max_num) {
 	struct emailinfo *ep0 = NULL;
@@ -4110,11 +4267,7 @@ static int loadoldheadersfrommessages(char *dir, int num_from_gdbm)
     }
 
     if (set_nonsequential)
-      {
-	/* free the msgnum_id_table */
-	free_msgnum_id_table (msgnum_id_table, max_num);
-	msgnum_id_table = NULL;
-      }
+      msgindex_unload();
 
 #ifdef WANTDUPMESSAGES
     if (set_showprogress)
@@ -4157,6 +4310,9 @@ int loadoldheadersfromGDBMindex(char *dir, int get_count_only)
        *   charset      v2.0
        *   isofromdate  v2.0
        *   isodate      v2.0
+       *   expires
+       *   isdeleted
+       *   references
        */
 
       trio_asprintf(&indexname, (dir[strlen(dir)-1] == '/') ? "%s%s" : "%s/%s",
@@ -4202,6 +4358,7 @@ int loadoldheadersfromGDBMindex(char *dir, int get_count_only)
 	  char *charset=NULL;
 	  char *isodate=NULL;
 	  char *isofromdate=NULL;
+	  char *references=NULL;
 	  long exp_time = -1;
 	  int is_deleted = 0;
 	  struct emailinfo *emp;
@@ -4245,12 +4402,19 @@ int loadoldheadersfromGDBMindex(char *dir, int get_count_only)
 	      is_deleted = atoi(dp);
 	      dp += strlen(dp) + 1;
 	  }
+	  if (dp < dp_end) {
+	      if (*dp)
+		  references = strsav(dp);
+	      dp += strlen(dp) + 1;
+	  }
 
 	  if ((emp = addhash(num, date, name, email, msgid, subject, inreply,
 			   fromdate, charset, isodate, isofromdate, bp))) {
 	      emp->exp_time = exp_time;
 	      emp->is_deleted = is_deleted;
 	      emp->deletion_completed = old_delete_level;
+	      set_references(emp, references);
+	      references = NULL;
 	      check_expiry(emp);
 	      if (insert_in_lists(emp, NULL, 0))
 		  ++num_added;
@@ -4269,6 +4433,8 @@ int loadoldheadersfromGDBMindex(char *dir, int get_count_only)
 	  }
 	  free(subject);
 	  free(inreply);
+	  if (references)
+	      free(references);
 #if 0
 	  if(bp) {
 	      if (bp->line) 
@@ -4335,6 +4501,7 @@ int loadoldheaders(char *dir)
 {
   int num;
 
+  source_load(dir);
   if (set_showprogress)
     printf("%s...\n", lang[MSG_READING_OLD_HEADERS]);
 #ifdef GDBM
@@ -4344,6 +4511,10 @@ int loadoldheaders(char *dir)
 #endif
     num = loadoldheadersfrommessages(dir, -1);
 
+  if (set_attachmentsindex)
+    attach_load(dir);
+  thread_load(dir);
+
   if (set_showprogress)
     printf("\b\b\b\b%4d %s.\n", num, lang[MSG_ARTICLES]);
 
@@ -4395,7 +4566,7 @@ void fixnextheader(char *dir, int num, int direction)
     numname=i18n_utf2numref(email->name,1);
 #endif
 
-    fp = fopen(filename, "w+");
+    fp = output_open(filename);
     if (fp) {
 	while (bp) {
 	    if (!strncmp(bp->line, "<!-- emptylink=", 15)) {
@@ -4465,13 +4636,41 @@ void fixnextheader(char *dir, int num, int direction)
 	    bp = bp->next;
 	}
     }
-    fclose(fp);
+    output_close(fp);
 
     /* can we clean up a bit please... */
     free_body(cp);
     free(filename);
 }
 
+/*
+** Tells whether one of the lines of a message page, from bp up to stop,
+** is already a "Reply:" (or "Maybe reply:") entry linking to href, in
+** any of the formats hypermail has used for them.
+*/
+
+static bool reply_is_listed(struct body *bp, struct body *stop,
+			    const char *label, const char *href)
+{
+    char link[MAXFILELEN + 8];
+    char labels[3][MAXLINE];
+    int i;
+
+    trio_snprintf(link, sizeof(link), "href=\"%s\"", href);
+    trio_snprintf(labels[0], MAXLINE, "<dfn>%s</dfn>:", label);
+    trio_snprintf(labels[1], MAXLINE, "<strong>%s:</strong>", label);
+    trio_snprintf(labels[2], MAXLINE, "<b>%s:</b>", label);
+
+    for (; bp && bp != stop; bp = bp->next) {
+	if (!strstr(bp->line, link))
+	    continue;
+	for (i = 0; i < 3; i++)
+	    if (strcasestr(bp->line, labels[i]))
+		return TRUE;
+    }
+    return FALSE;
+}
+
 /*
 ** Adds a "Reply:" link in the proper article, after the archive has been
 ** incrementally updated.
@@ -4493,26 +4692,20 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
     struct emailinfo *email;
     struct emailinfo *email2 = NULL;
 
-    const char *last_reply = "";
     int next_in_thread = -1;
 
     const char *old_maybe_pattern = "<li> <b>Maybe reply:</b> <a href=";
-    const char *old_reply_pattern = "<b>Reply:</b> ";
     const char *old_nextinthread_pattern = "<b>Next in thread:</b> <a href=\"";
     const char *old_next_pattern = "<li> <b>Next message:</b>:";
 
     /* pre-WAI patterns */
     char old2_maybe_pattern[MAXLINE];
     char old2_link_maybe_pattern[MAXLINE];
-    char old2_reply_pattern[MAXLINE];
-    char old2_link_reply_pattern[MAXLINE];
     char old2_nextinthread_pattern[MAXLINE];
     char old2_next_pattern[MAXLINE];
 
     char current_maybe_pattern[MAXLINE];
     char current_link_maybe_pattern[MAXLINE];
-    char current_reply_pattern[MAXLINE];
-    char current_link_reply_pattern[MAXLINE];
     char current_nextinthread_pattern[MAXLINE];
     char current_next_pattern[MAXLINE];
     
@@ -4529,11 +4722,6 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
         snprintf(current_link_maybe_pattern, sizeof(current_maybe_pattern), 
                 "<li><a name=\"replies\" id=\"replies\"></a><dfn>%s</dfn>: <a href=", 
 		 lang[MSG_MAYBE_REPLY]);
-        snprintf(current_reply_pattern, sizeof(current_reply_pattern), 
-                "<li><dfn>%s</dfn>: <a href=", lang[MSG_REPLY]);
-        snprintf(current_link_reply_pattern, sizeof(current_reply_pattern), 
-                "<li><a name=\"replies\" id=\"replies\"></a><dfn>%s</dfn>: <a href=",
-		 lang[MSG_REPLY]);
         snprintf(current_nextinthread_pattern, 
                 sizeof(current_nextinthread_pattern), 
                 "<li><dfn>%s</dfn>: <a href=", lang[MSG_NEXT_IN_THREAD]);
@@ -4543,8 +4731,9 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
 	/* backwards compatiblity */
 	snprintf(old2_maybe_pattern, sizeof(old2_maybe_pattern), 
                 "<li><strong>%s:</strong> <a href=", lang[MSG_MAYBE_REPLY]);
-        snprintf(old2_reply_pattern, sizeof(old2_reply_pattern), 
-                "<li><strong>%s:</strong> <a href=", lang[MSG_REPLY]);
+        snprintf(old2_link_maybe_pattern, sizeof(old2_link_maybe_pattern), 
+                "<li><a name=\"replies\" id=\"replies\"></a><strong>%s:</strong> <a href=",
+		 lang[MSG_MAYBE_REPLY]);
         snprintf(old2_nextinthread_pattern, 
                 sizeof(old2_nextinthread_pattern), 
                 "<li><strong>%s:</strong> <a href=", lang[MSG_NEXT_IN_THREAD]);
@@ -4563,8 +4752,7 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
       if (!set_showreplies && replynum != num - 1)
 	return;
       if (replynum == -1 && email->inreplyto && email->inreplyto[0]) {
-	email2 = hashreplylookup(email->msgnum, email->inreplyto,
-				 email->subject, &subjmatch);
+	email2 = thread_parent(email, &subjmatch);
 	if (!email2)
 	  return;
 	replynum = email2->msgnum;
@@ -4577,8 +4765,7 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
     else {
 	if (!email->inreplyto || !email->inreplyto[0])
 	    return;
-	email2 = hashreplylookup(email->msgnum, email->inreplyto,
-				 email->subject, &subjmatch);
+	email2 = thread_parent(email, &subjmatch);
 	if (!email2)
 	    return;
 	replynum = email2->msgnum;
@@ -4628,7 +4815,7 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
     numname=i18n_utf2numref(email->name,1);
 #endif
 
-    fp = fopen(filename, "w+");
+    fp = output_open(filename);
     if (fp) {
         bool list_started = FALSE; /* tells when we're starting a reply list for the
 				      first time */
@@ -4691,7 +4878,9 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
 #endif
 		free(ptr);
 
-		if (!last_reply || strcmp(ptr1, last_reply))
+		if (!reply_is_listed(cp, bp,
+				     lang[subjmatch ? MSG_MAYBE_REPLY : MSG_REPLY],
+				     msg_href(email, email2, FALSE)))
 		    fputs(ptr1, fp);
 		free(ptr1);
 	    }
@@ -4715,7 +4904,9 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
 #endif
 		free(ptr);
 
-		if (!last_reply || strcmp(ptr1, last_reply))
+		if (!reply_is_listed(cp, bp,
+				     lang[subjmatch ? MSG_MAYBE_REPLY : MSG_REPLY],
+				     msg_href(email, email2, FALSE)))
 		    fputs(ptr1, fp);
 		free(ptr1);
 	    }
@@ -4735,16 +4926,10 @@ void fixreplyheader(char *dir, int num, int remove_maybes, int max_update)
 			       strlen(old2_link_maybe_pattern))
 		|| strncasecmp(bp->line, old_maybe_pattern, strlen(old_maybe_pattern)))
 	        fprintf(fp, "%s", bp->line); /* not redundant or disproven */
-	    if (set_linkquotes && (strcasestr(bp->line, current_reply_pattern)
-				   || strcasestr(bp->line, current_link_reply_pattern)
-				   || strcasestr(bp->line, old2_reply_pattern)
-				   || strcasestr(bp->line, old2_link_reply_pattern)
-				   || strstr(bp->line, old_reply_pattern)))
-	        last_reply = bp->line;
 	    bp = bp->next;
 	}
     }
-    fclose(fp);
+    output_close(fp);
 
     /* can we clean up a bit please... */
     free_body(cp);
@@ -4769,6 +4954,20 @@ void fixthreadheader(char *dir, int num, int max_update)
     int threadnum = 0;
     char *ptr;
 
+#ifdef FASTREPLYCODE
+    /* threadlist_by_msgnum has the node before num's */
+    rp = threadlist_by_msgnum ? threadlist_by_msgnum[num] : NULL;
+    if (rp != NULL && rp->next != NULL &&
+	(rp->next->data && rp->next->data->msgnum == num) &&
+	(rp->data && rp->msgnum != -1)
+	) {
+	threadnum = rp->msgnum;
+	name = rp->next->data->name;
+	subject = rp->next->data->subject;
+    }
+    else
+	rp = NULL;
+#else
     for (rp = threadlist; rp != NULL; rp = rp->next) {
 	if (rp->next != NULL &&
 	    (rp->next->data && rp->next->data->msgnum == num) &&
@@ -4781,6 +4980,7 @@ void fixthreadheader(char *dir, int num, int max_update)
 	    break;
 	}
     }
+#endif
 
     if (rp == NULL || threadnum >= max_update)
 	return;
@@ -4808,7 +5008,7 @@ void fixthreadheader(char *dir, int num, int max_update)
     numname=i18n_utf2numref(name,1);
 #endif
 
-    if ((fp = fopen(filename, "w+")) != NULL) {
+    if ((fp = output_open(filename)) != NULL) {
 	while (bp != NULL) {
 	   if (!strncmp(bp->line, "<!-- emptylink=", 15)) {
 	      /* JK: just skip this line and the following which is just our
@@ -4876,7 +5076,8 @@ void fixthreadheader(char *dir, int num, int max_update)
 	    bp = bp->next;
 	}
     }
-    fclose(fp);
+    output_close(fp);
+    rp->data->initial_next_in_thread = num;
 
     /* can we clean up a bit please... */
     free_body(cp);
@@ -9,6 +9,7 @@ char *safe_filename(char *);
 char *getmaildate(char *);
 char *getfromdate(char *);
 char *getid(char *);
+char *getrefs(char *);
 char *getsubject(char *);
 char *getreply(char *);
 void print_progress(int, char *, char *);
@@ -16,9 +17,6 @@ int parsemail(char *, int, int, int, char *, int, int);
 int parse_old_html(int, struct emailinfo *, int, int, struct reply **, int);
 int loadoldheaders(char *);
 int loadoldheadersfromGDBMindex(char *, int);
-void crossindex(void);
-void crossindexthread1(struct header *);
-void crossindexthread2(int);
 void fixnextheader(char *, int, int);
 void fixreplyheader(char *, int, int, int);
 void fixthreadheader(char *, int, int);
@@ -41,6 +39,11 @@ int count_deleted(int);
  */
 #define DIR_PREFIXER "att-"
 
+/*
+ * Where the attachment_store option keeps one copy of each attachment
+ */
+#define ATTACHMENT_STORE DIR_PREFIXER "store"
+
 /* 
  * Used to replace invalid characters in supplied attachment filenames
  */
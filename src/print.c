@@ -32,6 +32,10 @@
 #include "finelink.h"
 
 #include "threadprint.h"
+#include "compress.h"
+#include "output.h"
+#include "stats.h"
+#include "thread.h"
 
 #include "proto.h"
 
@@ -53,6 +57,10 @@
 #include <string.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 /* conditions that say when a message's body may be removed */
 #define REMOVE_MESSAGE(email) (email->is_deleted && set_delete_level != DELETE_LEAVES_TEXT \
 			       && !(email->is_deleted == 2 && set_delete_level == DELETE_LEAVES_EXPIRED_TEXT))
@@ -81,6 +89,7 @@ int togdbm(void *gp, struct emailinfo *ep)
   char *msgid = ep->msgid;
   char *subject = ep->subject;
   char *inreply = ep->inreplyto;
+  char *references = ep->references;
   char *fromdate = ep->fromdatestr;
   char *charset = ep->charset;
   char *isodate = strsav(secs_to_iso(ep->date));
@@ -94,7 +103,7 @@ int togdbm(void *gp, struct emailinfo *ep)
 
   /* malloc() a string long enough for our data */
   /* AUDIT biege: trailing \0 missing */
-  if (!(buf = (char *)calloc((name ? strlen(name) : 0) + (email ? strlen(email) : 0) + (date ? strlen(date) : 0) + (msgid ? strlen(msgid) : 0) + (subject ? strlen(subject) : 0) + (inreply ? strlen(inreply) : 0) + (fromdate ? strlen(fromdate) : 0) + (charset ? strlen(charset) : 0) + (isodate ? strlen(isodate) : 0) + (isofromdate ? strlen(isofromdate) : 0) + strlen(exp_time_str) + strlen(is_deleted_str) + 13, sizeof(char)))) {
+  if (!(buf = (char *)calloc((name ? strlen(name) : 0) + (email ? strlen(email) : 0) + (date ? strlen(date) : 0) + (msgid ? strlen(msgid) : 0) + (subject ? strlen(subject) : 0) + (inreply ? strlen(inreply) : 0) + (fromdate ? strlen(fromdate) : 0) + (charset ? strlen(charset) : 0) + (isodate ? strlen(isodate) : 0) + (isofromdate ? strlen(isofromdate) : 0) + strlen(exp_time_str) + strlen(is_deleted_str) + (references ? strlen(references) : 0) + 14, sizeof(char)))) {
     return -1;
   }
 
@@ -122,6 +131,8 @@ int togdbm(void *gp, struct emailinfo *ep)
   dp += strlen(dp) + 1;
   strcpy(dp, is_deleted_str);
   dp += strlen(dp) + 1;
+  strcpy(dp, references ? references : "");
+  dp += strlen(dp) + 1;
   content.dsize = dp - buf;
   content.dptr = buf; /* the value is in this string */
   rval = gdbm_store((GDBM_FILE) gp, key, content, GDBM_REPLACE);
@@ -260,6 +271,18 @@ void fprint_menu(FILE *fp, mindex_t idx, char *archives, char *currentid, char *
 
 #endif
 
+/*
+** Where the index of a type that lists message num is, its page when
+** the index is split into pages.
+*/
+
+static char *index_link_name(int dlev, mindex_t type, int num)
+{
+    if (dlev || set_msgsperindexpage <= 0)
+	return strsav(index_name[dlev][type]);
+    return index_page_name(type, index_page_num(type, num));
+}
+
 /* non-tables version of fprint_menu */
 
 void fprint_menu0(FILE *fp, struct emailinfo *email, int pos)
@@ -310,22 +333,34 @@ void fprint_menu0(FILE *fp, struct emailinfo *email, int pos)
     if (!(set_mailcommand && set_hmail))
       fprintf (fp, "<a name=\"%s\" id=\"%s\"></a>",id,id);
     fprintf(fp, "<dfn>%s</dfn>:", lang[MSG_CONTEMPORARY_MSGS_SORTED]);
-    if (show_index[dlev][DATE_INDEX])
+    if (show_index[dlev][DATE_INDEX]) {
+      char *name = index_link_name(dlev, DATE_INDEX, num);
       fprintf(fp, " [ <a href=\"%s#%s%d\" title=\"%s\">%s</a> ]", 
-	      index_name[dlev][DATE_INDEX], set_fragment_prefix, num, 
+	      name, set_fragment_prefix, num, 
 	      lang[MSG_LTITLE_BY_DATE], lang[MSG_BY_DATE]);
-    if (show_index[dlev][THREAD_INDEX])
+      free(name);
+    }
+    if (show_index[dlev][THREAD_INDEX]) {
+      char *name = index_link_name(dlev, THREAD_INDEX, num);
       fprintf(fp, " [ <a href=\"%s#%s%d\" title=\"%s\">%s</a> ]",
-	      index_name[dlev][THREAD_INDEX], set_fragment_prefix, num, 
+	      name, set_fragment_prefix, num, 
 	      lang[MSG_LTITLE_BY_THREAD], lang[MSG_BY_THREAD]);
-    if (show_index[dlev][SUBJECT_INDEX])
+      free(name);
+    }
+    if (show_index[dlev][SUBJECT_INDEX]) {
+      char *name = index_link_name(dlev, SUBJECT_INDEX, num);
       fprintf(fp, " [ <a href=\"%s#%s%d\" title=\"%s\">%s</a> ]", 
-	      index_name[dlev][SUBJECT_INDEX], set_fragment_prefix, num, 
+	      name, set_fragment_prefix, num, 
 	      lang[MSG_LTITLE_BY_SUBJECT], lang[MSG_BY_SUBJECT]);
-    if (show_index[dlev][AUTHOR_INDEX])
+      free(name);
+    }
+    if (show_index[dlev][AUTHOR_INDEX]) {
+      char *name = index_link_name(dlev, AUTHOR_INDEX, num);
       fprintf(fp, " [ <a href=\"%s#%s%d\" title=\"%s\">%s</a> ]", 
-	      index_name[dlev][AUTHOR_INDEX], set_fragment_prefix, num, 
+	      name, set_fragment_prefix, num, 
 	      lang[MSG_LTITLE_BY_AUTHOR], lang[MSG_BY_AUTHOR]);
+      free(name);
+    }
     if (show_index[dlev][ATTACHMENT_INDEX])
       fprintf(fp, " [ <a href=\"%s\" title=\"%s\">%s</a> ]", 
 	      index_name[dlev][ATTACHMENT_INDEX], 
@@ -709,12 +744,18 @@ void printcomment(FILE *fp, char *label, char *value)
 
 	ptr = strchr(ext_value, '@');
 	if (set_spamprotect_id && ptr && (!strcmp(label, "id")
-				       || !strcmp(label, "inreplyto"))) {
+				       || !strcmp(label, "inreplyto")
+				       || !strcmp(label, "references"))) {
 	    struct Push retbuf;
+	    char *rest = ext_value;
 	    INIT_PUSH(retbuf);
-	    PushNString(&retbuf, ext_value, ptr - ext_value);
-	    PushNString(&retbuf, set_antispam_at, strlen(set_antispam_at));
-	    PushString(&retbuf, ptr + 1);
+	    do {		/* references has one @ per id */
+		PushNString(&retbuf, rest, ptr - rest);
+		PushNString(&retbuf, set_antispam_at, strlen(set_antispam_at));
+		rest = ptr + 1;
+	    } while (!strcmp(label, "references")
+		     && (ptr = strchr(rest, '@')) != NULL);
+	    PushString(&retbuf, rest);
 	    if (ext_value != value)
 	      free (ext_value);
 	    ext_value = PUSH_STRING(retbuf);
@@ -767,78 +808,183 @@ void printhtml(FILE *fp, char *line)
 }
 
 /*
-** Pretty-prints the dates in the index files.
+** The subject, author and date strings the date, subject and author
+** indexes and the haof show for a message. They are escaped once and
+** shared by all of them, and by the monthly and yearly indexes.
 */
-void printdates(FILE *fp, struct header *hp, int year, int month, struct emailinfo *subdir_email,
-		char *prev_date_str)
+
+struct index_row {
+    char *subject;
+    char *unre_subject;		/* subject index headings */
+    char *name;
+    char *emailaddr;		/* haof only */
+    char *date;			/* getdatestr(), haof only */
+    char *indexdate;		/* getindexdatestr() */
+    char *day;			/* getdateindexdatestr() */
+    char *path;			/* link from the top of the archive */
+    char *local;		/* link from the message's own folder */
+};
+
+static struct index_row *index_row(struct emailinfo *em)
+{
+    struct index_row *row = em->index_row;
+    char *charset;
+
+    if (row)
+	return row;
+
+#ifdef HAVE_ICONV
+    charset = "utf-8";
+#else
+    charset = em->charset;
+#endif
+    row = (struct index_row *)emalloc(sizeof(struct index_row));
+    row->subject = convchars(em->subject, charset);
+#ifdef HAVE_ICONV
+    row->unre_subject = convchars(em->unre_subject, charset);
+#else
+    row->unre_subject = row->subject;
+#endif
+    row->name = convchars(em->name, charset);
+    if (set_writehaof) {
+	row->emailaddr = convchars(em->emailaddr, charset);
+	row->date = strsav(getdatestr(em->date));
+    }
+    else {
+	row->emailaddr = NULL;
+	row->date = NULL;
+    }
+    row->indexdate = strsav(getindexdatestr(em->date));
+    row->day = strsav(getdateindexdatestr(em->date));
+    row->path = strsav(msg_relpath(em, NULL));
+    row->local = row->path + (em->subdir ? strlen(em->subdir->subdir) : 0);
+
+    em->index_row = row;
+    return row;
+}
+
+/*
+** Fills in the rows of all the messages the indexes will show, so the
+** index bodies can be printed from several threads.
+*/
+
+static void make_index_rows(struct header *hp)
+{
+    while (hp != NULL) {
+	make_index_rows(hp->left);
+	if (!hp->data->is_deleted)
+	    index_row(hp->data);
+	hp = hp->right;
+    }
+}
+
+/*
+** Frees the rows make_index_rows() and index_row() made.
+*/
+
+void free_index_rows(struct header *hp)
+{
+    struct index_row *row;
+
+    while (hp != NULL) {
+	free_index_rows(hp->left);
+	if ((row = hp->data->index_row) != NULL) {
+	    free(row->subject);
+	    if (row->unre_subject != row->subject)
+		free(row->unre_subject);
+	    free(row->name);
+	    if (row->emailaddr)
+		free(row->emailaddr);
+	    if (row->date)
+		free(row->date);
+	    free(row->indexdate);
+	    free(row->day);
+	    free(row->path);
+	    free(row);
+	    hp->data->index_row = NULL;
+	}
+	hp = hp->right;
+    }
+}
+
+/*
+** The link to a message from an index. The indexes only list the
+** messages in their own folder, or are at the top of the archive.
+*/
+
+#define ROW_HREF(row, subdir_email) ((subdir_email) ? (row)->local : (row)->path)
+
+/*
+** Prints the line of a message in a date index.
+*/
+static void print_date_row(FILE *fp, struct emailinfo *em,
+			   struct emailinfo *subdir_email, char *prev_date_str)
 {
-  char *subject=NULL,*name=NULL;
+  struct index_row *row;
   const char *startline;
   const char *break_str;
   const char *endline;
   const char *subj_tag;
   const char *subj_end_tag;
-  static char date_str[DATESTRLEN+40]; /* made static for smaller stack */
+  char date_str[DATESTRLEN+40];
   static char *first_attributes = "<a  accesskey=\"j\" name=\"first\" id=\"first\"></a>";
 
+  row = index_row(em);
+
+  if(set_indextable) {
+    startline = "<tr><td>";
+    break_str = "</td><td nowrap>";
+    strcpy(date_str, row->day);
+    endline = "</td></tr>";
+    subj_tag = "";
+    subj_end_tag = "";
+  }
+  else {
+    char *tmp;
+    bool is_first;
+    tmp = row->day;
+    if (strcmp (prev_date_str, tmp)) {
+      if (*prev_date_str)  { /* close the previous date item */
+	fprintf (fp, "</ul></li>\n");
+	is_first = FALSE;
+      }
+      else
+	is_first = TRUE;
+      snprintf(date_str, sizeof(date_str), "<li>%s<dfn>%s</dfn><ul>\n", 
+	      (is_first) ? first_attributes : "", tmp);
+      fprintf (fp, "%s", date_str);
+      strcpy (prev_date_str, tmp);
+    }
+    date_str[0] = 0;
+    startline = "<li>";
+    break_str = "&nbsp;";
+    endline = "</li>";
+    subj_tag = "";
+    subj_end_tag = "";
+  }
+
+  fprintf(fp,"%s<a href=\"%s\">%s%s%s</a>%s<a name=\"%s%d\" id=\"%s%d\"><em>%s</em></a>%s%s%s\n",
+	  startline, ROW_HREF(row, subdir_email),
+	  subj_tag, row->subject, subj_end_tag, break_str, 
+	  set_fragment_prefix, em->msgnum, set_fragment_prefix, em->msgnum, 
+	  row->name,
+	  break_str, date_str, endline);
+}
+
+/*
+** Pretty-prints the dates in the index files.
+*/
+void printdates(FILE *fp, struct header *hp, int year, int month, struct emailinfo *subdir_email,
+		char *prev_date_str)
+{
   if (hp != NULL) {
     struct emailinfo *em=hp->data;
     printdates(fp, hp->left, year, month, subdir_email, prev_date_str);
     if ((year == -1 || year_of_datenum(em->date) == year)
 	&& (month == -1 || month_of_datenum(em->date) == month)
 	&& !em->is_deleted
-	&& (!subdir_email || subdir_email->subdir == em->subdir)) {
-
-#ifdef HAVE_ICONV
-      subject = convchars(em->subject, "utf-8");
-      name = convchars(em->name, "utf-8");
-#else
-      subject = convchars(em->subject, em->charset);
-      name = convchars(em->name, em->charset);
-#endif
-      
-      if(set_indextable) {
-	startline = "<tr><td>";
-	break_str = "</td><td nowrap>";
-	strcpy(date_str, getdateindexdatestr(hp->data->date));
-	endline = "</td></tr>";
-	subj_tag = "";
-	subj_end_tag = "";
-      }
-      else {
-	char *tmp;
-	bool is_first;
-	tmp = getdateindexdatestr(hp->data->date);
-	if (strcmp (prev_date_str, tmp)) {
-	  if (*prev_date_str)  { /* close the previous date item */
-	    fprintf (fp, "</ul></li>\n");
-	    is_first = FALSE;
-	  }
-	  else
-	    is_first = TRUE;
-	  snprintf(date_str, sizeof(date_str), "<li>%s<dfn>%s</dfn><ul>\n", 
-		  (is_first) ? first_attributes : "", tmp);
-	  fprintf (fp, "%s", date_str);
-	  strcpy (prev_date_str, tmp);
-	}
-	date_str[0] = 0;
-	startline = "<li>";
-	break_str = "&nbsp;";
-	endline = "</li>";
-	subj_tag = "";
-	subj_end_tag = "";
-      }
-
-      fprintf(fp,"%s<a href=\"%s\">%s%s%s</a>%s<a name=\"%s%d\" id=\"%s%d\"><em>%s</em></a>%s%s%s\n",
-	      startline, msg_href(em, subdir_email, FALSE), 
-	      subj_tag, subject, subj_end_tag, break_str, 
-	      set_fragment_prefix, em->msgnum, set_fragment_prefix, em->msgnum, 
-	      name,
-	      break_str, date_str, endline);
-
-      free(subject);
-      free(name);
-    }
+	&& (!subdir_email || subdir_email->subdir == em->subdir))
+      print_date_row(fp, em, subdir_email, prev_date_str);
     printdates(fp, hp->right, year, month, subdir_email, prev_date_str);
   }
 }
@@ -850,8 +996,6 @@ void printdates(FILE *fp, struct header *hp, int year, int month, struct emailin
 int printattachments(FILE *fp, struct header *hp, struct emailinfo *subdir_email, bool *is_first)
 {
     char *subject=NULL,*name=NULL;
-    char *attdir;
-    char *msgnum;
     int  nb_attach = 0;
     static char *first_attributes = "<a  accesskey=\"j\" name=\"first\" id=\"first\"></a>";
 
@@ -861,75 +1005,47 @@ int printattachments(FILE *fp, struct header *hp, struct emailinfo *subdir_email
 	struct emailinfo *em = hp->data;
 	nb_attach = printattachments(fp, hp->left, subdir_email, is_first);
 	if ((!subdir_email || subdir_email->subdir == em->subdir)
-	    && !em->is_deleted) {
-            
+	    && !em->is_deleted && em->attachments) {
+	    struct attach *ap;
+	    const char *fmt2 = (set_indextable ? "<tr><td>&nbsp;&nbsp;&nbsp;&nbsp;<a href=\"%s" DIR_PREFIXER "%s%c%s\">%s</a></td>" "<td colspan=\"2\" align=\"center\">(%d %s)</td></tr>\n" : "<li><a href=\"%s" DIR_PREFIXER "%s%c%s\">%s</a> (%d %s)</li>\n");
+	    char *msgname;
+
 	    subject = (set_i18n) ? em->subject : convchars(em->subject, em->charset);
             name = (set_i18n) ? em->name : convchars(em->name,em->charset);
 
-	    /* See if there's a directory corresponding to this message */
-	    msgnum = message_name(em);
-	    trio_asprintf(&attdir, "%s%c" DIR_PREFIXER "%s", set_dir, PATH_SEPARATOR, msgnum);
-	    if (isdir(attdir)) {
-	        DIR *dir = opendir(attdir);
-		
-		/* consider that if there's an attachment directory, there are attachments */
+	    nb_attach++;
+	    if (set_indextable) {
+	      fprintf(fp, "<tr><td>%s%s</a></td><td><a name=\"%s%d\" id=\"%s%d\"><em>%s</em></a></td>" "<td>%s</td></tr>\n", msg_href(em, subdir_email, TRUE), subject, set_fragment_prefix, em->msgnum, set_fragment_prefix, em->msgnum, name, getindexdatestr(em->date));
+	    }
+	    else {
+	      fprintf(fp, "<li>%s%s<dfn>%s</dfn></a>&nbsp;" 
+		      "<a name=\"%s%d\" id=\"%s%d\"><em>%s</em></a>&nbsp;<em>(%s)</em>\n", 
+		      (*is_first) ? first_attributes : "",
+		      msg_href(em, subdir_email, TRUE), subject, 
+		      set_fragment_prefix, em->msgnum, 
+		      set_fragment_prefix, em->msgnum, 
+		      name,
+		      getindexdatestr(em->date));
+	      if (*is_first)
+		*is_first = FALSE;
+	      fprintf(fp, "<ol>\n");
+	    }
+
+	    /* the files are listed under the name they were stored as,
+	       without the counter that keeps it unique */
+	    msgname = message_name(em);
+	    for (ap = em->attachments; ap != NULL; ap = ap->next) {
+		const char *stripped_filename = strchr(ap->storedas, '-');
+
 		nb_attach++;
-		if (set_indextable) {
-		  fprintf(fp, "<tr><td>%s%s</a></td><td><a name=\"%s%d\" id=\"%s%d\"><em>%s</em></a></td>" "<td>%s</td></tr>\n", msg_href(em, subdir_email, TRUE), subject, set_fragment_prefix, em->msgnum, set_fragment_prefix, em->msgnum, name, getindexdatestr(em->date));
-		}
-		else {
-		  fprintf(fp, "<li>%s%s<dfn>%s</dfn></a>&nbsp;" 
-			  "<a name=\"%s%d\" id=\"%s%d\"><em>%s</em></a>&nbsp;<em>(%s)</em>\n", 
-			  (*is_first) ? first_attributes : "",
-			  msg_href(em, subdir_email, TRUE), subject, 
-			  set_fragment_prefix, em->msgnum, 
-			  set_fragment_prefix, em->msgnum, 
-			  name,
-			  getindexdatestr(em->date));
-		  if (*is_first)
-		    *is_first = FALSE;
-		}
-		if (dir) {
-#ifdef HAVE_DIRENT_H
-		    struct dirent *entry;
-#else
-		    struct direct *entry;
-#endif
-		    struct stat fileinfo;
-		    char *filename, *stripped_filename;
-		    const char *fmt2 = (set_indextable ? "<tr><td>&nbsp;&nbsp;&nbsp;&nbsp;<a href=\"%s%s\">%s</a></td>" "<td colspan=\"2\" align=\"center\">(%d %s)</td></tr>\n" : "<li><a href=\"%s%s\">%s</a> (%d %s)</li>\n");
-
-		    int first_time = 1;
-		    while ((entry = readdir(dir))) {
-		        int file_size = -1;
-			if (!strcmp(".", entry->d_name) || !strcmp("..", entry->d_name))
-				continue;
-			nb_attach++;
-			if (first_time && !set_indextable) {
-			    first_time = 0;
-			    fprintf(fp, "<ol>\n");
-			}
-			trio_asprintf(&filename, "%s%c%s", attdir, PATH_SEPARATOR, entry->d_name);
-			if (!stat(filename, &fileinfo))
-			    file_size = (int)fileinfo.st_size;
-			free(filename);
-			trio_asprintf(&filename, DIR_PREFIXER "%s%c%s", message_name(em), PATH_SEPARATOR, entry->d_name);
-			stripped_filename = strchr(entry->d_name, '-');
-			if (stripped_filename)
-				fprintf(fp, fmt2, rel_path_to_top, filename, stripped_filename + 1, file_size, lang[MSG_BYTES]);
-			else if(strcmp(entry->d_name, ".meta"))
-				fprintf(fp, fmt2, rel_path_to_top, filename, entry->d_name, file_size, lang[MSG_BYTES]);
-			free(filename);
-		    }
-		    if (!first_time && !set_indextable) {
-		        fprintf(fp, "</ol></li>\n");
-		    }
-		    closedir(dir);
-		}
+		fprintf(fp, fmt2, rel_path_to_top, msgname, PATH_SEPARATOR,
+			ap->storedas,
+			stripped_filename ? stripped_filename + 1 : ap->storedas,
+			(int)ap->size, lang[MSG_BYTES]);
 	    }
-            
-	    free(attdir);
-            
+	    if (!set_indextable)
+		fprintf(fp, "</ol></li>\n");
+
             if (!set_i18n) {
                 free(subject);
                 free(name);
@@ -1221,14 +1337,11 @@ void printbody(FILE *fp, struct emailinfo *email, int maybe_reply, int is_reply)
     int quoted_percent;
     bool replace_quoted;
 
-    if (set_linkquotes || set_showhtml == 2)
-      /* should be changed to unconditional after tested for a while?
-	 - pcm@rahul.net 1999-09-09 */
-      find_quote_prefix(email->bodylist, is_reply);
-    
-    if (set_quote_hide_threshold <= 100)
-	quoted_percent = compute_quoted_percent(bp);
-    else
+    /* the quote prefix guess: should be changed to unconditional
+       after tested for a while? - pcm@rahul.net 1999-09-09 */
+    quoted_percent = analyze_body(email->bodylist, is_reply,
+				  set_linkquotes || set_showhtml == 2);
+    if (set_quote_hide_threshold > 100)
       quoted_percent = 100;
     replace_quoted = (quoted_percent > set_quote_hide_threshold);
 
@@ -1277,7 +1390,7 @@ void printbody(FILE *fp, struct emailinfo *email, int maybe_reply, int is_reply)
     fprintf(fp, "<a name=\"start\" accesskey=\"j\" id=\"start\"></a>");
 
     if (set_showhtml == 2)
-      init_txt2html();
+      init_txt2html(email->bodylist);
     inquote = 0;
     quote_num = 0;
 
@@ -1362,7 +1475,7 @@ void printbody(FILE *fp, struct emailinfo *email, int maybe_reply, int is_reply)
 	  inblank = 0;
 	
 	if (set_showhtml) {
-	  if (is_sig_start(bp->line)) {
+	  if (bp->sig) {
 	    insig = 1;
 	    if (!pre) {
 	      fprintf(fp, "<pre>\n");
@@ -1383,7 +1496,7 @@ void printbody(FILE *fp, struct emailinfo *email, int maybe_reply, int is_reply)
 	    if (insig) {
 	      ConvURLs(fp, bp->line, id, subject, email->charset);
 	    }
-	    else if (isquote(bp->line)) {
+	    else if (bp->quoted) {
 	      if (set_linkquotes) {
 		if (handle_quoted_text(fp, email, bp, bp->line, inquote, quote_num, replace_quoted, maybe_reply)) {
 		  ++quote_num;
@@ -1391,7 +1504,7 @@ void printbody(FILE *fp, struct emailinfo *email, int maybe_reply, int is_reply)
 		}
 	      }
 	      else {
-		fprintf(fp, "<%s class=\"%s\">", set_iquotes ? "em" : "span", find_quote_class(bp->line));
+		fprintf(fp, "<%s class=\"%s\">", set_iquotes ? "em" : "span", quote_class(bp->quote_depth));
 
 		ConvURLs(fp, bp->line, id, subject, email->charset);
 		
@@ -1442,7 +1555,7 @@ void printbody(FILE *fp, struct emailinfo *email, int maybe_reply, int is_reply)
 	  else
 	    ConvURLs(fp, bp->line, id, subject, email->charset);
 	}
-	if (!isquote(bp->line))
+	if (!bp->quoted)
 	  inquote = 0;
 	bp = bp->next;
     }
@@ -1737,7 +1850,7 @@ int print_links_up(FILE *fp, struct emailinfo *email, int pos, int in_thread_fil
 	     */
 
 	    if (email->inreplyto[0]) {
-	      email2 = hashreplylookup(email->msgnum, email->inreplyto, email->subject, &subjmatch);
+	      email2 = thread_parent(email, &subjmatch);
 	      if (email2) {
 		char *del_msg = (email2->is_deleted ? lang[MSG_DEL_SHORT]
 				 : "");
@@ -1911,7 +2024,7 @@ int print_links(FILE *fp, struct emailinfo *email, int pos, int in_thread_file)
 	 */
 
 	if (email->inreplyto[0]) {
-	  email2 = hashreplylookup(email->msgnum, email->inreplyto, email->subject, &subjmatch);
+	  email2 = thread_parent(email, &subjmatch);
 	  if (email2) {
 	    char *del_msg = (email2->is_deleted ? lang[MSG_DEL_SHORT]
 			     : "");
@@ -2080,6 +2193,7 @@ void update_deletions(int num_old)
 		}
 		else if (isfile(filename)) {
 		    unlink(filename);
+		    compress_remove(filename);
 		}
 		free(filename);
 	    }
@@ -2184,6 +2298,7 @@ void writearticles(int startnum, int maxnum)
 	if (email->is_deleted && set_delete_level == DELETE_REMOVES_FILES) {
 	    if (!newfile) {
 		unlink(filename);
+		compress_remove(filename);
 	    }
 #ifdef GDBM
 	    else if (gp) {
@@ -2202,7 +2317,7 @@ void writearticles(int startnum, int maxnum)
 	    continue;
 	}
 	else {
-	  if ((fp = fopen(filename, "w")) == NULL) { /* AUDIT biege:where? */
+	  if ((fp = output_open(filename)) == NULL) { /* AUDIT biege:where? */
 	        snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
 		progerr(errmsg);
 	  }
@@ -2272,6 +2387,10 @@ void writearticles(int startnum, int maxnum)
  	printcomment(fp, "inreplyto", ptr = convcharsnospamprotect(email->inreplyto, email->charset));
 	if (ptr)
 	    free(ptr);
+	if (email->references) {
+	    printcomment(fp, "references", ptr = convcharsnospamprotect(email->references, email->charset));
+	    free(ptr);
+	}
 	if (email->is_deleted) {
 	    char num_buf[32];
 	    sprintf(num_buf, "%d", email->is_deleted);
@@ -2333,7 +2452,7 @@ void writearticles(int startnum, int maxnum)
 	
 	printfooter(fp, mhtmlfooterfile, set_label, set_dir, email->subject, filename, FALSE);
 	
-	fclose(fp);
+	output_close(fp);
 	
 	if (get_new_reply_to() != -1) {
 	  /* will only be true if set_linkquotes is */
@@ -2356,6 +2475,8 @@ void writearticles(int startnum, int maxnum)
 		}
 	      }
 	      e4->replylist = addreply(e4->replylist, e4->msgnum, email, 0, NULL);
+	      thread_touch(e3);
+	      thread_touch(e4);
 #endif
 	      rp->frommsgnum = get_new_reply_to();
 	      rp->maybereply = 0;
@@ -2420,123 +2541,677 @@ void writearticles(int startnum, int maxnum)
 } /* end writearticles() */
  
 /*
-** Write the date index...
-** If email != NULL, write index for the subdir in which that email is.
+** The message lists of the date, subject and author indexes and of
+** the haof only depend on the index rows, so write_indices() can print
+** them in parallel before the pages are put together one at a time.
 */
 
-void writedates(int amountmsgs, struct emailinfo *email)
-{
-    int newfile;
-    char *filename;
-    FILE *fp;
-    char prev_date_str[DATESTRLEN + 40];
-    char *datename = index_name[email && email->subdir != NULL][DATE_INDEX];
-    time_t start_date_num = email && email->subdir ? email->subdir->first_email->date : firstdatenum;
-    time_t end_date_num = email && email->subdir ? email->subdir->last_email->date : lastdatenum;
+typedef void (*index_body_func) (FILE *, struct emailinfo *);
 
-    filename = htmlfilename(datename, email, "");
+struct index_body {
+    index_body_func print;
+    struct emailinfo *email;
+    char *text;
+    size_t len;
+};
 
-    if (isfile(filename))
-	newfile = 0;
-    else
-	newfile = 1;
+static struct index_body index_bodies[4];
+static int index_body_count;
 
-    if ((fp = fopen(filename, "w")) == NULL) { /* AUDIT biege: where? */
-	snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
-	progerr(errmsg);
+/*
+** Prints the message list of an index, or copies it if it has already
+** been printed.
+*/
+
+static void print_index_body(FILE *fp, index_body_func print,
+			     struct emailinfo *email)
+{
+    int i;
+
+    for (i = 0; i < index_body_count; i++) {
+	struct index_body *b = &index_bodies[i];
+	if (b->print == print && b->email == email && b->text) {
+	    fwrite(b->text, 1, b->len, fp);
+	    free(b->text);
+	    b->text = NULL;
+	    return;
+	}
     }
+    print(fp, email);
+}
 
-    if (set_showprogress)
-	printf("%s \"%s\"...", lang[MSG_WRITING_DATE_INDEX], filename);
+/*
+** What comes before and after the messages in a date index.
+*/
 
-    /*
-     * Print out the index file header 
-     */
-    print_index_header(fp, set_label, set_dir, lang[MSG_BY_DATE], datename);
+static char *date_list_head(void)
+{
+    char *head;
 
-    /* 
-     * Print out archive information links at the top of the index
-     */
-    print_index_header_links(fp, DATE_INDEX, start_date_num, end_date_num,
-			     amountmsgs, email ? email->subdir : NULL);
-    fprintf (fp, "</div>\n");
+    if (set_indextable)
+	trio_asprintf(&head, "<div class=\"center\">\n<table>\n<tr><td><strong>%s</strong></td><td><strong>%s</strong></td><td><strong>%s</strong></td></tr>\n", lang[MSG_CSUBJECT], lang[MSG_CAUTHOR], lang[MSG_CDATE]);
+    else
+	head = strsav("<div class=\"messages-list\">\n<ul>\n");
+    return head;
+}
 
-    /*
-     * Print out the actual message index lists. Here's the beef.
-     */
+static const char *date_list_tail(int rows)
+{
     if (set_indextable)
-	fprintf(fp, "<div class=\"center\">\n<table>\n<tr><td><strong>%s</strong></td><td><strong>%s</strong></td><td><strong>%s</strong></td></tr>\n", lang[MSG_CSUBJECT], lang[MSG_CAUTHOR], lang[MSG_CDATE]);
-    else {
-        fprintf (fp, "<div class=\"messages-list\">\n");
-	fprintf(fp, "<ul>\n");
-    }
+	return "</table>\n</div>\n";
+    /* with the last day's list to close */
+    return rows ? "</ul></li>\n</ul>\n" : "</ul>\n";
+}
+
+static void date_list_begin(FILE *fp)
+{
+    char *head = date_list_head();
+
+    fputs(head, fp);
+    free(head);
+}
+
+static void date_list_end(FILE *fp, char *prev_date_str)
+{
+    fputs(date_list_tail(*prev_date_str != '\0'), fp);
+}
+
+static void date_index_body(FILE *fp, struct emailinfo *email)
+{
+    char prev_date_str[DATESTRLEN + 40];
+
+    date_list_begin(fp);
     prev_date_str[0] = '\0';
     printdates(fp, datelist, -1, -1, email, prev_date_str);
+    date_list_end(fp, prev_date_str);
+}
 
-    if (set_indextable)
-      fprintf(fp, "</table>\n</div>\n");
-    else
-      {
-	if (*prev_date_str)  /* close the previous date item */
-	  fprintf (fp, "</ul></li>\n");
-	fprintf(fp, "</ul>\n");
-	printlaststats (fp, end_date_num);
-	fprintf (fp, "</div>\n");
-      }
+/*
+** The date index at the top of the archive is described in
+** DATE_INDEX_STATE: where the list of messages starts and ends in the
+** page, how many it lists and which. When an update only adds
+** messages that sort after all of those, the old list is copied into
+** the new page as it is and only the new messages are printed after
+** it. Otherwise, or when the page doesn't look like the description,
+** the whole list is printed again.
+*/
 
-    /* 
-     * Print out archive information links at the bottom of the index
-     */
-    print_index_footer_links(fp, DATE_INDEX, end_date_num, amountmsgs,
-			     email ? email->subdir : NULL);
+#define DATE_STATE_HEADER "# hypermail date index 1\n"
 
-    /* 
-     * Print the index page footer.
-     */
-    printfooter(fp, ihtmlfooterfile, set_label, set_dir, lang[MSG_BY_DATE], datename, TRUE);
+struct date_state {
+    long start, end;		/* of the list, in the page */
+    long size;			/* of the page */
+    int rows;			/* messages listed */
+    int last;			/* the last one of them */
+    int maxnum;			/* the highest numbered one */
+    int indextable;
+};
 
-    fclose(fp);
+static struct date_state old_date_state;
+static struct emailinfo *old_date_last;	/* old_date_state.last */
+static int date_append_checked;
+static int date_append_ok;
 
-    /* AUDIT biege: depending on the direc. it better to use fchmod(). */
-    if (newfile && chmod(filename, set_filemode) == -1) {
-	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %o.", lang[MSG_CANNOT_CHMOD], filename, set_filemode);
+static char *date_state_name(void)
+{
+    char *name;
+
+    trio_asprintf(&name, "%s%s", set_dir, DATE_INDEX_STATE);
+    return name;
+}
+
+static void date_state_save(struct date_state *st)
+{
+    char *filename = date_state_name();
+    char *data;
+    int rc;
+
+    trio_asprintf(&data, "%sstart %ld\nend %ld\nsize %ld\nrows %d\nlast %d\n"
+		  "maxnum %d\nindextable %d\n", DATE_STATE_HEADER, st->start,
+		  st->end, st->size, st->rows, st->last, st->maxnum,
+		  st->indextable);
+    rc = output_replace(filename, data, strlen(data), set_filemode);
+    if (rc) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %s.",
+		 lang[MSG_COULD_NOT_WRITE], filename, strerror(rc));
 	progerr(errmsg);
     }
+    free(data);
     free(filename);
+}
 
-    if (set_showprogress)
-	putchar('\n');
+static int date_state_load(struct date_state *st)
+{
+    char *filename = date_state_name();
+    char line[MAXLINE];
+    FILE *fp;
+    int found = 0;
+    long n;
+
+    fp = fopen(filename, "r");
+    free(filename);
+    if (fp == NULL)
+	return FALSE;
+    if (fgets(line, sizeof(line), fp) && !strcmp(line, DATE_STATE_HEADER)) {
+	while (fgets(line, sizeof(line), fp)) {
+	    if (sscanf(line, "start %ld", &st->start) == 1
+		|| sscanf(line, "end %ld", &st->end) == 1
+		|| sscanf(line, "size %ld", &st->size) == 1
+		|| sscanf(line, "rows %d", &st->rows) == 1
+		|| sscanf(line, "last %d", &st->last) == 1
+		|| sscanf(line, "maxnum %d", &st->maxnum) == 1)
+		++found;
+	    else if (sscanf(line, "indextable %ld", &n) == 1) {
+		st->indextable = (int)n;
+		++found;
+	    }
+	}
+    }
+    fclose(fp);
+    return found == 7;
 }
 
 /*
-** Write the attachments index...
+** Counts the messages a date index lists, in the order it lists them.
 */
 
-void writeattachments(int amountmsgs, struct emailinfo *email)
+static void date_rows_summary(struct header *hp, struct date_state *st)
 {
-    int newfile;
-    char *filename;
-    FILE *fp;
-    char *attname = index_name[email && email->subdir != NULL][ATTACHMENT_INDEX];
-    time_t start_date_num = email && email->subdir ? email->subdir->first_email->date : firstdatenum;
-    time_t end_date_num = email && email->subdir ? email->subdir->last_email->date : lastdatenum;
-    bool is_first = TRUE; /* used to print the anchor to the first element (WAI) */
-
-    filename = htmlfilename(attname, email, "");
+    while (hp != NULL) {
+	date_rows_summary(hp->left, st);
+	if (!hp->data->is_deleted) {
+	    st->rows++;
+	    st->last = hp->data->msgnum;
+	    if (hp->data->msgnum > st->maxnum)
+		st->maxnum = hp->data->msgnum;
+	}
+	hp = hp->right;
+    }
+}
 
-    if (isfile(filename))
-	newfile = 0;
-    else
-	newfile = 1;
+/*
+** Checks that the messages up to old_date_state.maxnum come first in
+** the date order, just as they were listed, and all newer ones after.
+*/
 
-    if ((fp = fopen(filename, "w")) == NULL) {	/* AUDIT biege: where? */
-	 snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
-	progerr(errmsg);
+static void date_rows_check(struct header *hp, int *seen, int *newer)
+{
+    while (hp != NULL && date_append_ok) {
+	date_rows_check(hp->left, seen, newer);
+	if (!hp->data->is_deleted) {
+	    if (hp->data->msgnum > old_date_state.maxnum)
+		*newer = TRUE;
+	    else if (*newer)
+		date_append_ok = FALSE;	/* an old one after a new one */
+	    else {
+		++*seen;
+		old_date_last = hp->data;
+	    }
+	}
+	hp = hp->right;
     }
+}
+
+/*
+** Returns TRUE if the list of the date index on disk can be kept,
+** and the new messages added after it.
+*/
+
+static int date_appendable(FILE *old, long at, const char *text)
+{
+    size_t len = strlen(text);
+    char *buf = (char *)emalloc(len + 1);
+    int same;
+
+    same = at >= 0 && fseek(old, at, SEEK_SET) == 0
+	&& fread(buf, 1, len, old) == len && !memcmp(buf, text, len);
+    free(buf);
+    return same;
+}
+
+static int date_append_check(void)
+{
+    struct date_state *st = &old_date_state;
+    char *filename, *head;
+    struct stat sb;
+    FILE *old;
+    int seen = 0, newer = FALSE;
+
+    if (date_append_checked)
+	return date_append_ok;
+    date_append_checked = TRUE;
+    date_append_ok = FALSE;
+    if (!set_increment || set_msgsperindexpage > 0 || !date_state_load(st)
+	|| st->indextable != set_indextable || st->rows <= 0)
+	return FALSE;
+
+    date_append_ok = TRUE;
+    old_date_last = NULL;
+    date_rows_check(datelist, &seen, &newer);
+    if (!date_append_ok || seen != st->rows || !old_date_last
+	|| old_date_last->msgnum != st->last) {
+	date_append_ok = FALSE;
+	return FALSE;
+    }
+
+    /* and that the page is still the one described */
+    date_append_ok = FALSE;
+    filename = htmlfilename(index_name[0][DATE_INDEX], NULL, "");
+    if (stat(filename, &sb) == 0 && sb.st_size == st->size
+	&& (old = fopen(filename, "rb")) != NULL) {
+	head = date_list_head();
+	date_append_ok = date_appendable(old, st->start - (long)strlen(head), head)
+	    && date_appendable(old, st->end, date_list_tail(TRUE));
+	free(head);
+	fclose(old);
+    }
+    free(filename);
+    return date_append_ok;
+}
+
+static void print_newer_dates(FILE *fp, struct header *hp, int after,
+			      char *prev_date_str, struct date_state *st)
+{
+    while (hp != NULL) {
+	print_newer_dates(fp, hp->left, after, prev_date_str, st);
+	if (!hp->data->is_deleted && hp->data->msgnum > after) {
+	    print_date_row(fp, hp->data, NULL, prev_date_str);
+	    st->rows++;
+	    st->last = hp->data->msgnum;
+	    if (hp->data->msgnum > st->maxnum)
+		st->maxnum = hp->data->msgnum;
+	}
+	hp = hp->right;
+    }
+}
+
+/*
+** The message list of the date index at the top of the archive, the
+** old one with the new messages added if date_append_check() allows,
+** and where it ends up in the page.
+*/
+
+static void date_top_body(FILE *fp, struct date_state *st)
+{
+    char prev_date_str[DATESTRLEN + 40];
+    char buf[8192];
+    char *filename;
+    FILE *old;
+    long left;
+    size_t n;
+
+    memset(st, 0, sizeof(*st));
+    st->indextable = set_indextable;
+    st->last = st->maxnum = -1;
+
+    if (date_append_check()) {
+	filename = htmlfilename(index_name[0][DATE_INDEX], NULL, "");
+	old = fopen(filename, "rb");
+	free(filename);
+	if (old && fseek(old, old_date_state.start, SEEK_SET) == 0) {
+	    date_list_begin(fp);
+	    st->start = ftell(fp);
+	    left = old_date_state.end - old_date_state.start;
+	    while (left > 0
+		   && (n = fread(buf, 1, left < (long)sizeof(buf) ? (size_t)left : sizeof(buf), old)) > 0) {
+		fwrite(buf, 1, n, fp);
+		left -= n;
+	    }
+	    fclose(old);
+	    if (left)
+		progerr("Couldn't read back the date index.");
+	    st->rows = old_date_state.rows;
+	    st->last = old_date_state.last;
+	    st->maxnum = old_date_state.maxnum;
+	    strcpy(prev_date_str, set_indextable ? "" : index_row(old_date_last)->day);
+	    print_newer_dates(fp, datelist, old_date_state.maxnum, prev_date_str, st);
+	    stats_count("date_rows_appended", st->rows - old_date_state.rows);
+	    st->end = ftell(fp);
+	    fputs(date_list_tail(TRUE), fp);
+	    return;
+	}
+	if (old)
+	    fclose(old);
+    }
+
+    st->start = ftell(fp);
+    print_index_body(fp, date_index_body, NULL);
+    st->end = ftell(fp);
+    date_rows_summary(datelist, st);
+    filename = date_list_head();
+    st->start += strlen(filename);
+    st->end -= strlen(date_list_tail(st->rows));
+    free(filename);
+}
+
+/*
+** With msgsperindexpage, the date, thread, subject and author indexes
+** at the top of the archive are split into pages by message number,
+** message n going on page n / msgsperindexpage and a thread on the
+** page of its first message, so that a page only changes when one of
+** its own messages does. Each page is sorted as its index is.
+*/
+
+struct index_page {
+    mindex_t type;
+    int num;			/* this page */
+    int last;			/* the last page */
+    struct emailinfo **rows;	/* in index order */
+    int count;
+    int threadnum;		/* files_by_thread threads before it */
+    int threads;		/* and on it */
+};
+
+typedef void (*index_writer) (char *, int, struct emailinfo *,
+			      struct index_page *);
+
+static int index_paged(struct emailinfo *email)
+{
+    return set_msgsperindexpage > 0 && email == NULL;
+}
+
+/*
+** The name of page num of an index, e.g. "date-3.html" for
+** "date.html".
+*/
+
+char *index_page_name(mindex_t type, int num)
+{
+    char *indexname = index_name[0][type];
+    char *dot = strrchr(indexname, '.');
+    char *buf;
+
+    if (dot)
+	trio_asprintf(&buf, "%.*s-%d%s", (int)(dot - indexname), indexname,
+		      num, dot);
+    else
+	trio_asprintf(&buf, "%s-%d", indexname, num);
+    return buf;
+}
+
+/*
+** The page of an index that message msgnum is on.
+*/
+
+int index_page_num(mindex_t type, int msgnum)
+{
+    if (type == THREAD_INDEX)
+	return thread_page_num(msgnum);
+    return msgnum / set_msgsperindexpage;
+}
+
+static void count_index_rows(struct header *hp, mindex_t type, int *counts)
+{
+    while (hp != NULL) {
+	count_index_rows(hp->left, type, counts);
+	if (!hp->data->is_deleted && hp->data->msgnum <= max_msgnum)
+	    counts[index_page_num(type, hp->data->msgnum)]++;
+	hp = hp->right;
+    }
+}
+
+static void fill_index_pages(struct header *hp, struct index_page *pages)
+{
+    while (hp != NULL) {
+	fill_index_pages(hp->left, pages);
+	if (!hp->data->is_deleted && hp->data->msgnum <= max_msgnum) {
+	    struct index_page *page =
+		&pages[index_page_num(pages->type, hp->data->msgnum)];
+	    page->rows[page->count++] = hp->data;
+	}
+	hp = hp->right;
+    }
+}
+
+/*
+** The dates of the first and last messages on a page.
+*/
+
+static void index_page_dates(struct index_page *page, time_t *start,
+			     time_t *end)
+{
+    int i;
+
+    for (i = 0; i < page->count; i++) {
+	if (i == 0 || page->rows[i]->date < *start)
+	    *start = page->rows[i]->date;
+	if (i == 0 || page->rows[i]->date > *end)
+	    *end = page->rows[i]->date;
+    }
+}
+
+/*
+** Links to the pages before and after this one.
+*/
+
+static void print_index_page_links(FILE *fp, struct index_page *page)
+{
+    char *name;
+
+    fprintf(fp, "<ul class=\"pages\">\n");
+    if (page->num > 0) {
+	name = index_page_name(page->type, page->num - 1);
+	fprintf(fp, "<li><a href=\"%s\" rel=\"prev\">%s</a></li>\n", name,
+		lang[MSG_PREVIOUS]);
+	free(name);
+    }
+    if (page->num < page->last) {
+	name = index_page_name(page->type, page->num + 1);
+	fprintf(fp, "<li><a href=\"%s\" rel=\"next\">%s</a></li>\n", name,
+		lang[MSG_NEXT]);
+	free(name);
+    }
+    fprintf(fp, "</ul>\n");
+}
+
+/*
+** Writes the pages of an index, and the index itself as a copy of the
+** last one.
+*/
+
+static void write_index_pages(mindex_t type, int amountmsgs,
+			      index_writer writer)
+{
+    struct index_page *pages;
+    struct header *list;
+    int *counts;
+    int npages = index_page_num(type, max_msgnum) + 1;
+    int i;
+    char *name;
+
+    if (type == DATE_INDEX) {
+	/* date.html is a page now, which the state doesn't describe */
+	name = date_state_name();
+	unlink(name);
+	free(name);
+    }
+
+    if (type == SUBJECT_INDEX)
+	list = subjectlist;
+    else if (type == AUTHOR_INDEX)
+	list = authorlist;
+    else
+	list = datelist;
+
+    counts = (int *)emalloc(npages * sizeof(int));
+    memset(counts, 0, npages * sizeof(int));
+    pages = (struct index_page *)emalloc(npages * sizeof(struct index_page));
+    count_index_rows(list, type, counts);
+    for (i = 0; i < npages; i++) {
+	pages[i].type = type;
+	pages[i].num = i;
+	pages[i].last = npages - 1;
+	pages[i].rows = (struct emailinfo **)emalloc((counts[i] + 1) * sizeof(struct emailinfo *));
+	pages[i].count = 0;
+	pages[i].threadnum = pages[i].threads = 0;
+    }
+    fill_index_pages(list, pages);
+
+    for (i = 0; i < npages; i++) {
+	if (i > 0)
+	    pages[i].threadnum = pages[i - 1].threadnum + pages[i - 1].threads;
+	name = index_page_name(type, i);
+	writer(name, pages[i].count, NULL, &pages[i]);
+	free(name);
+    }
+    writer(index_name[0][type], amountmsgs, NULL, &pages[npages - 1]);
+
+    for (i = 0; i < npages; i++)
+	free(pages[i].rows);
+    free(pages);
+    free(counts);
+}
+
+static void date_page_body(FILE *fp, struct index_page *page)
+{
+    char prev_date_str[DATESTRLEN + 40];
+    int i;
+
+    date_list_begin(fp);
+    prev_date_str[0] = '\0';
+    for (i = 0; i < page->count; i++)
+	print_date_row(fp, page->rows[i], NULL, prev_date_str);
+    date_list_end(fp, prev_date_str);
+}
+
+/*
+** Writes one date index, the whole of it or, with page != NULL, one
+** of its pages.
+*/
+
+static void write_date_index(char *datename, int amountmsgs,
+			     struct emailinfo *email, struct index_page *page)
+{
+    int newfile;
+    char *filename;
+    FILE *fp;
+    struct date_state top;
+    time_t start_date_num = email && email->subdir ? email->subdir->first_email->date : firstdatenum;
+    time_t end_date_num = email && email->subdir ? email->subdir->last_email->date : lastdatenum;
+
+    if (page) {
+	/* only what is on the page, so that the other pages stay put */
+	amountmsgs = page->count;
+	index_page_dates(page, &start_date_num, &end_date_num);
+    }
+
+    filename = htmlfilename(datename, email, "");
+
+    if (isfile(filename))
+	newfile = 0;
+    else
+	newfile = 1;
+
+    if ((fp = output_open(filename)) == NULL) { /* AUDIT biege: where? */
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
+	progerr(errmsg);
+    }
+
+    if (set_showprogress)
+	printf("%s \"%s\"...", lang[MSG_WRITING_DATE_INDEX], filename);
+
+    /*
+     * Print out the index file header 
+     */
+    print_index_header(fp, set_label, set_dir, lang[MSG_BY_DATE], datename);
+
+    /* 
+     * Print out archive information links at the top of the index
+     */
+    print_index_header_links(fp, DATE_INDEX, start_date_num, end_date_num,
+			     amountmsgs, email ? email->subdir : NULL);
+    fprintf (fp, "</div>\n");
+
+    /*
+     * Print out the actual message index lists. Here's the beef.
+     */
+    if (page) {
+	print_index_page_links(fp, page);
+	date_page_body(fp, page);
+	print_index_page_links(fp, page);
+    }
+    else if (!email)
+	date_top_body(fp, &top);
+    else
+	print_index_body(fp, date_index_body, email);
+
+    if (!set_indextable) {
+	printlaststats (fp, end_date_num);
+	fprintf (fp, "</div>\n");
+    }
+
+    /* 
+     * Print out archive information links at the bottom of the index
+     */
+    print_index_footer_links(fp, DATE_INDEX, end_date_num, amountmsgs,
+			     email ? email->subdir : NULL);
+
+    /* 
+     * Print the index page footer.
+     */
+    printfooter(fp, ihtmlfooterfile, set_label, set_dir, lang[MSG_BY_DATE], datename, TRUE);
+
+    if (!page && !email)
+	top.size = ftell(fp);
+    output_close(fp);
+
+    /* AUDIT biege: depending on the direc. it better to use fchmod(). */
+    if (newfile && chmod(filename, set_filemode) == -1) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %o.", lang[MSG_CANNOT_CHMOD], filename, set_filemode);
+	progerr(errmsg);
+    }
+    free(filename);
+
+    if (!page && !email)
+	date_state_save(&top);
+
+    if (set_showprogress)
+	putchar('\n');
+}
+
+/*
+** Write the date index...
+** If email != NULL, write index for the subdir in which that email is.
+*/
+
+void writedates(int amountmsgs, struct emailinfo *email)
+{
+    if (index_paged(email))
+	write_index_pages(DATE_INDEX, amountmsgs, write_date_index);
+    else
+	write_date_index(index_name[email && email->subdir != NULL][DATE_INDEX],
+			 amountmsgs, email, NULL);
+}
+
+/*
+** Write the attachments index...
+*/
+
+void writeattachments(int amountmsgs, struct emailinfo *email)
+{
+    int newfile;
+    char *filename;
+    FILE *fp;
+    char *attname = index_name[email && email->subdir != NULL][ATTACHMENT_INDEX];
+    time_t start_date_num = email && email->subdir ? email->subdir->first_email->date : firstdatenum;
+    time_t end_date_num = email && email->subdir ? email->subdir->last_email->date : lastdatenum;
+    bool is_first = TRUE; /* used to print the anchor to the first element (WAI) */
+
+    filename = htmlfilename(attname, email, "");
+
+    if (isfile(filename))
+	newfile = 0;
+    else
+	newfile = 1;
+
+    if ((fp = output_open(filename)) == NULL) {	/* AUDIT biege: where? */
+	 snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
+	progerr(errmsg);
+    }
+
+    if (set_showprogress)
+	printf("%s \"%s\"...", lang[MSG_WRITING_ATTACHMENT_INDEX], filename);
 
-    if (set_showprogress)
-	printf("%s \"%s\"...", lang[MSG_WRITING_ATTACHMENT_INDEX], filename);
-
     /*
      * Print out the index file header 
      */
@@ -2579,7 +3254,7 @@ void writeattachments(int amountmsgs, struct emailinfo *email)
      */
     printfooter(fp, ihtmlfooterfile, set_label, set_dir, lang[MSG_BY_DATE], attname, TRUE);
 
-    fclose(fp);
+    output_close(fp);
 
     if (newfile && chmod(filename, set_filemode) == -1) {
 		snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %o.", lang[MSG_CANNOT_CHMOD], filename, set_filemode);
@@ -2592,20 +3267,45 @@ void writeattachments(int amountmsgs, struct emailinfo *email)
 }
 
 /*
-** Write the thread index...
+** Prints the threads of a thread index, or of one of its pages.
 */
 
-void writethreads(int amountmsgs, struct emailinfo *email)
+static void thread_list(FILE *fp, struct emailinfo *email,
+			struct index_page *page)
+{
+    int threadnum;
+
+    if (page) {
+	threadnum = page->threadnum;
+	print_thread_page(fp, page->num, &threadnum);
+	page->threads = threadnum - page->threadnum;
+    }
+    else
+	print_all_threads(fp, -1, -1, email);
+}
+
+/*
+** Writes one thread index, the whole of it or, with page != NULL, one
+** of its pages.
+*/
+
+static void write_thread_index(char *thrdname, int amountmsgs,
+			       struct emailinfo *email,
+			       struct index_page *page)
 {
     int newfile;
     char *filename;
     FILE *fp;
-    char *thrdname = index_name[email && email->subdir != NULL][THREAD_INDEX];
     time_t start_date_num = email && email->subdir ? email->subdir->first_email->date : firstdatenum;
     time_t end_date_num = email && email->subdir ? email->subdir->last_email->date : lastdatenum;
 
     struct printed *pp;
 
+    if (page) {
+	amountmsgs = page->count;
+	index_page_dates(page, &start_date_num, &end_date_num);
+    }
+
     while (printedlist) {	/* cleanup needed ?? */
 	pp = printedlist;
 	printedlist = printedlist->next;
@@ -2621,7 +3321,7 @@ void writethreads(int amountmsgs, struct emailinfo *email)
     else
 	newfile = 1;
 
-    if ((fp = fopen(filename, "w")) == NULL) {	/* AUDIT biege: where? */
+    if ((fp = output_open(filename)) == NULL) {	/* AUDIT biege: where? */
 	snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
 	progerr(errmsg);
     }
@@ -2638,18 +3338,22 @@ void writethreads(int amountmsgs, struct emailinfo *email)
 			     amountmsgs, email ? email->subdir : NULL);
     fprintf (fp, "</div>\n");
 
+    if (page)
+	print_index_page_links(fp, page);
     if (set_indextable) {
 	fprintf(fp, "<div class=\"center\">\n<table>\n<tr><td><strong>%s</strong></td><td><strong>%s</strong></td><td><strong> %s</strong></td></tr>\n", lang[MSG_CSUBJECT], lang[MSG_CAUTHOR], lang[MSG_CDATE]);
-	print_all_threads(fp, -1, -1, email);
+	thread_list(fp, email, page);
 	fprintf(fp, "</table>\n</div>\n");
     }
     else {
         fprintf (fp, "<div class=\"messages-list\">\n");
 	fprintf(fp, "<ul>\n");
-	print_all_threads(fp, -1, -1, email);
+	thread_list(fp, email, page);
 	fprintf(fp, "</ul>\n");
 	fprintf (fp, "</div>");
     }
+    if (page)
+	print_index_page_links(fp, page);
 
     /* 
      * Print out archive information links at the bottom of the index
@@ -2660,7 +3364,7 @@ void writethreads(int amountmsgs, struct emailinfo *email)
     
     printfooter(fp, ihtmlfooterfile, set_label, set_dir, lang[MSG_BY_THREAD], thrdname, TRUE);
 
-    fclose(fp);
+    output_close(fp);
 
     if (newfile && chmod(filename, set_filemode) == -1) {
 		snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %o.", lang[MSG_CANNOT_CHMOD], filename, set_filemode);
@@ -2673,94 +3377,161 @@ void writethreads(int amountmsgs, struct emailinfo *email)
 }
 
 /*
-** Print the subject index pointers alphabetically.
+** Write the thread index...
 */
 
-void printsubjects(FILE *fp, struct header *hp, char **oldsubject,
-		   int year, int month, struct emailinfo *subdir_email)
+void writethreads(int amountmsgs, struct emailinfo *email)
 {
-  char *subject=NULL, *name=NULL;
+    if (index_paged(email))
+	write_index_pages(THREAD_INDEX, amountmsgs, write_thread_index);
+    else
+	write_thread_index(index_name[email && email->subdir != NULL][THREAD_INDEX],
+			   amountmsgs, email, NULL);
+}
+
+/*
+** Prints the line of a message in a subject index, after the subject
+** when it isn't that of the line before.
+*/
+
+static void print_subject_row(FILE *fp, struct emailinfo *em,
+			      char **oldsubject,
+			      struct emailinfo *subdir_email)
+{
+  struct index_row *row;
+  char *subject;
   const char *startline;
   const char *break_str;
   const char *endline;
-  static char date_str[DATESTRLEN+40]; /* made static for smaller stack */
+  char date_str[DATESTRLEN+40];
   static char *first_attributes = "<a  accesskey=\"j\" name=\"first\" id=\"first\"></a>";
 
+  row = index_row(em);
+  subject = row->unre_subject;
+
+  if (em->subject_key != *oldsubject
+      && strcmp(em->subject_key, *oldsubject)) {
+      if (set_indextable) {
+	  fprintf(fp,
+		  "<tr><td colspan=\"3\"><strong>%s</strong></td></tr>\n",
+		  subject);
+      }
+      else {
+	bool is_first;
+	  if (*oldsubject && *oldsubject[0] != '\0')  { /* close the previous open list */
+	    fprintf(fp, "</ul></li>\n");
+	    is_first = FALSE;
+	  } 
+	  else
+	    is_first = TRUE;
+
+	  fprintf(fp, "<li>%s<dfn>%s</dfn>\n", 
+		  (is_first) ? first_attributes : "", subject);
+	  fprintf(fp, "<ul>\n");
+      }
+  }
+  if(set_indextable) {
+      startline = "<tr><td>&nbsp;</td><td nowrap>";
+      break_str = "</td><td nowrap>";
+      strcpy(date_str, row->indexdate);
+      endline = "</td></tr>";
+  }
+  else {
+      startline = "<li>";
+      break_str = "";
+      snprintf(date_str, sizeof(date_str), "<em>(%s)</em>", row->indexdate);
+      endline = "</li>";
+  }
+  fprintf(fp,
+	  "%s<a href=\"%s\">%s</a>%s <a name=\"%s%d\" id=\"%s%d\">%s</a>%s\n", startline,
+	  ROW_HREF(row, subdir_email),
+	  row->name, break_str,        
+	  set_fragment_prefix, em->msgnum, 
+	  set_fragment_prefix, em->msgnum, date_str, endline);
+  *oldsubject = em->subject_key;
+}
+
+/*
+** Print the subject index pointers alphabetically.
+*/
+
+void printsubjects(FILE *fp, struct header *hp, char **oldsubject,
+		   int year, int month, struct emailinfo *subdir_email)
+{
   if (hp != NULL) {
     printsubjects(fp, hp->left, oldsubject, year, month, subdir_email);
     if ((year == -1 || year_of_datenum(hp->data->date) == year)
 	&& (month == -1 || month_of_datenum(hp->data->date) == month)
 	&& !hp->data->is_deleted
-	&& (!subdir_email || subdir_email->subdir == hp->data->subdir)) {
+	&& (!subdir_email || subdir_email->subdir == hp->data->subdir))
+      print_subject_row(fp, hp->data, oldsubject, subdir_email);
+    printsubjects(fp, hp->right, oldsubject, year, month, subdir_email);
+  }
+}
 
-#ifdef HAVE_ICONV
-        subject = convchars(hp->data->unre_subject, "utf-8");
-        name = convchars(hp->data->name, "utf-8");
-#else
-        subject = convchars(hp->data->subject, hp->data->charset);
-        name = convchars(hp->data->name, hp->data->charset);
-#endif
+static void subject_list_begin(FILE *fp)
+{
+    if (set_indextable) {
+	fprintf(fp, "<div class=\"center\">\n<table>\n<tr><td><strong>%s</strong></td><td><strong>%s</strong></td><td><strong> %s</strong></td></tr>\n", lang[MSG_CSUBJECT], lang[MSG_CAUTHOR], lang[MSG_CDATE]);
+    }
+    else {
+        fprintf (fp, "<div class=\"messages-list\">\n");
+	fprintf(fp, "<ul>\n");
+    }
+}
 
-	if (strcasecmp(hp->data->unre_subject, *oldsubject)) {
-	    if (set_indextable) {
-		fprintf(fp,
-			"<tr><td colspan=\"3\"><strong>%s</strong></td></tr>\n",
-			subject);
-	    }
-	    else {
-	      bool is_first;
-	        if (*oldsubject && *oldsubject[0] != '\0')  { /* close the previous open list */
-		  fprintf(fp, "</ul></li>\n");
-		  is_first = FALSE;
-		} 
-		else
-		  is_first = TRUE;
-
-		fprintf(fp, "<li>%s<dfn>%s</dfn>\n", 
-			(is_first) ? first_attributes : "", subject);
-		fprintf(fp, "<ul>\n");
-	    }
-	}
-	if(set_indextable) {
-	    startline = "<tr><td>&nbsp;</td><td nowrap>";
-	    break_str = "</td><td nowrap>";
-	    strcpy(date_str, getindexdatestr(hp->data->date));
-	    endline = "</td></tr>";
-	}
-	else {
-	    startline = "<li>";
-	    break_str = "";
-	    snprintf(date_str, sizeof(date_str), "<em>(%s)</em>", getindexdatestr(hp->data->date));
-	    endline = "</li>";
-	}
-	fprintf(fp,
-		"%s%s%s</a>%s <a name=\"%s%d\" id=\"%s%d\">%s</a>%s\n", startline,
-		msg_href(hp->data, subdir_email, TRUE), 
-                name, break_str,        
-		set_fragment_prefix, hp->data->msgnum, 
-		set_fragment_prefix, hp->data->msgnum, date_str, endline);
-	*oldsubject = hp->data->unre_subject;
-
-	free(subject);
-	free(name);
+static void subject_list_end(FILE *fp)
+{
+    if (set_indextable) {
+	fprintf(fp, "</table>\n</div>\n");
     }
-    printsubjects(fp, hp->right, oldsubject, year, month, subdir_email);
-  }
+    else {
+	fprintf(fp, "</ul></li>\n");
+	fprintf(fp, "</ul>\n");
+	fprintf (fp, "</div>");
+    }
+}
+
+static void subject_index_body(FILE *fp, struct emailinfo *email)
+{
+    char *oldsubject = "";	/* dummy to start with */
+
+    subject_list_begin(fp);
+    printsubjects(fp, subjectlist, &oldsubject, -1, -1, email);
+    subject_list_end(fp);
+}
+
+static void subject_page_body(FILE *fp, struct index_page *page)
+{
+    char *oldsubject = "";
+    int i;
+
+    subject_list_begin(fp);
+    for (i = 0; i < page->count; i++)
+	print_subject_row(fp, page->rows[i], &oldsubject, NULL);
+    subject_list_end(fp);
 }
 
 /*
-** Prints the subject index.
+** Prints one subject index, the whole of it or, with page != NULL, one
+** of its pages.
 */
 
-void writesubjects(int amountmsgs, struct emailinfo *email)
+static void write_subject_index(char *subjname, int amountmsgs,
+				struct emailinfo *email,
+				struct index_page *page)
 {
     int newfile;
     char *filename;
     FILE *fp;
-    char *subjname = index_name[email && email->subdir != NULL][SUBJECT_INDEX];
     time_t start_date_num = email && email->subdir ? email->subdir->first_email->date : firstdatenum;
     time_t end_date_num = email && email->subdir ? email->subdir->last_email->date : lastdatenum;
 
+    if (page) {
+	amountmsgs = page->count;
+	index_page_dates(page, &start_date_num, &end_date_num);
+    }
+
     filename = htmlfilename(subjname, email, "");
 
     if (isfile(filename))
@@ -2768,7 +3539,7 @@ void writesubjects(int amountmsgs, struct emailinfo *email)
     else
 	newfile = 1;
 
-	if ((fp = fopen(filename, "w")) == NULL) { /* AUDIT biege: where? */
+	if ((fp = output_open(filename)) == NULL) { /* AUDIT biege: where? */
 	    snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
 	progerr(errmsg);
     }
@@ -2785,25 +3556,13 @@ void writesubjects(int amountmsgs, struct emailinfo *email)
 				 amountmsgs, email ? email->subdir : NULL);
 	fprintf (fp, "</div>\n");
 	
-    if (set_indextable) {
-	fprintf(fp, "<div class=\"center\">\n<table>\n<tr><td><strong>%s</strong></td><td><strong>%s</strong></td><td><strong> %s</strong></td></tr>\n", lang[MSG_CSUBJECT], lang[MSG_CAUTHOR], lang[MSG_CDATE]);
-    }
-    else {
-        fprintf (fp, "<div class=\"messages-list\">\n");
-	fprintf(fp, "<ul>\n");
-    }
-    {
-	char *oldsubject = "";	/* dummy to start with */
-	printsubjects(fp, subjectlist, &oldsubject, -1, -1, email);
-    }
-    if (set_indextable) {
-	fprintf(fp, "</table>\n</div>\n");
-    }
-    else {
-	fprintf(fp, "</ul></li>\n");
-	fprintf(fp, "</ul>\n");
-	fprintf (fp, "</div>");
+    if (page) {
+	print_index_page_links(fp, page);
+	subject_page_body(fp, page);
+	print_index_page_links(fp, page);
     }
+    else
+	print_index_body(fp, subject_index_body, email);
 
     /* 
      * Print out archive information links at the bottom of the index
@@ -2815,7 +3574,7 @@ void writesubjects(int amountmsgs, struct emailinfo *email)
 
     printfooter(fp, ihtmlfooterfile, set_label, set_dir, lang[MSG_BY_SUBJECT], subjname, TRUE);
 
-    fclose(fp);
+    output_close(fp);
 
     if (newfile && chmod(filename, set_filemode) == -1) {
 		snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %o.", lang[MSG_CANNOT_CHMOD], filename, set_filemode);
@@ -2828,95 +3587,160 @@ void writesubjects(int amountmsgs, struct emailinfo *email)
 }
 
 /*
-** Prints the author index links sorted alphabetically.
+** Prints the subject index.
 */
 
-void printauthors(FILE *fp, struct header *hp, char **oldname,
-		  int year, int month, struct emailinfo *subdir_email)
+void writesubjects(int amountmsgs, struct emailinfo *email)
+{
+    if (index_paged(email))
+	write_index_pages(SUBJECT_INDEX, amountmsgs, write_subject_index);
+    else
+	write_subject_index(index_name[email && email->subdir != NULL][SUBJECT_INDEX],
+			    amountmsgs, email, NULL);
+}
+
+/*
+** Prints the line of a message in an author index, after the author
+** when it isn't that of the line before.
+*/
+
+static void print_author_row(FILE *fp, struct emailinfo *em, char **oldname,
+			     struct emailinfo *subdir_email)
 {
-  char *subj, *tmpname;
+  struct index_row *row;
+  char *tmpname;
   const char *startline;
   const char *break_str;
   const char *endline;
-  static char date_str[DATESTRLEN+40]; /* made static for smaller stack */
+  char date_str[DATESTRLEN+40];
   static char *first_attributes = "<a  accesskey=\"j\" name=\"first\" id=\"first\"></a>";
 
+  row = index_row(em);
+  tmpname = row->name;
+  if (em->name_key != *oldname
+      && strcmp(em->name_key, *oldname)) {
+
+    if(set_indextable)
+      fprintf(fp,
+	      "<tr><td colspan=\"3\"><strong>%s</strong></td></tr>",
+	      tmpname);
+    else {
+      bool is_first;
+
+      if (*oldname && *oldname[0] != '\0') { /* close the previous open list */
+	fprintf(fp, "</ul></li>\n");
+	is_first = FALSE;
+      }
+      else
+	is_first = TRUE;
+
+      fprintf(fp, "<li>%s<dfn>%s</dfn>\n", 
+	      (is_first) ? first_attributes : "",
+	      tmpname);
+      fprintf(fp, "<ul>\n");
+    }
+  }
+  if(set_indextable) {
+    startline = "<tr><td>&nbsp;</td><td>";
+    break_str = "</td><td nowrap>";
+    strcpy(date_str, row->indexdate);
+    endline = "</td></tr>";
+  }
+  else {
+    startline = "<li>";
+    break_str = "&nbsp;";
+    snprintf(date_str, sizeof(date_str), "<em>(%s)</em>", row->indexdate);
+    endline = "</li>";
+  }
+  fprintf(fp,"%s<a href=\"%s\">%s</a>%s<a name=\"%s%d\" id=\"%s%d\">%s</a>%s\n",
+	  startline, ROW_HREF(row, subdir_email), row->subject, break_str,
+	  set_fragment_prefix, em->msgnum, set_fragment_prefix, em->msgnum, 
+	  date_str, endline);
+
+  *oldname = em->name_key;  /* avoid copying */
+}
+
+/*
+** Prints the author index links sorted alphabetically.
+*/
+
+void printauthors(FILE *fp, struct header *hp, char **oldname,
+		  int year, int month, struct emailinfo *subdir_email)
+{
   if (hp != NULL) {
     printauthors(fp, hp->left, oldname, year, month, subdir_email);
     if ((year == -1 || year_of_datenum(hp->data->date) == year)
 	&& (month == -1 || month_of_datenum(hp->data->date) == month)
 	&& !hp->data->is_deleted
-	&& (!subdir_email || subdir_email->subdir == hp->data->subdir)) {
+	&& (!subdir_email || subdir_email->subdir == hp->data->subdir))
+      print_author_row(fp, hp->data, oldname, subdir_email);
+    printauthors(fp, hp->right, oldname, year, month, subdir_email);
+  }
+}
 
-#ifdef HAVE_ICONV
-      subj = convchars(hp->data->subject, "utf-8");
-      tmpname = convchars(hp->data->name,"utf-8");
-#else
-      subj = convchars(hp->data->subject, hp->data->charset);
-      tmpname = convchars(hp->data->name,hp->data->charset);
-#endif
-      if (strcasecmp(hp->data->name, *oldname)) {
+static void author_list_begin(FILE *fp)
+{
+    if (set_indextable) {
+		fprintf(fp, "<div class=\"center\">\n<table>\n<tr><td><strong>%s</strong></td><td><strong>%s</strong></td><td><strong> %s</strong></td></tr>\n", lang[MSG_CAUTHOR], lang[MSG_CSUBJECT], lang[MSG_CDATE]);
+    }
+    else {
+        fprintf(fp, "<div class=\"messages-list\">\n");
+	fprintf(fp, "<ul>\n");
+    }
+}
 
-	if(set_indextable)
-	  fprintf(fp,
-		  "<tr><td colspan=\"3\"><strong>%s</strong></td></tr>",
-		  tmpname);
-	else {
-	  bool is_first;
+static void author_list_end(FILE *fp)
+{
+    if (set_indextable) {
+	fprintf(fp, "</table>\n</div>\n");
+    }
+    else {
+        fprintf(fp, "</ul></li>\n");
+	fprintf(fp, "</ul>\n");
+	fprintf(fp, "</div>\n");
+    }
+}
 
-	  if (*oldname && *oldname[0] != '\0') { /* close the previous open list */
-	    fprintf(fp, "</ul></li>\n");
-	    is_first = FALSE;
-	  }
-	  else
-	    is_first = TRUE;
+static void author_index_body(FILE *fp, struct emailinfo *email)
+{
+    char *prevauthor = "";
 
-	  fprintf(fp, "<li>%s<dfn>%s</dfn>\n", 
-		  (is_first) ? first_attributes : "",
-		  tmpname);
-	  fprintf(fp, "<ul>\n");
-	}
-      }
-      if(set_indextable) {
-	startline = "<tr><td>&nbsp;</td><td>";
-	break_str = "</td><td nowrap>";
-	strcpy(date_str, getindexdatestr(hp->data->date));
-	endline = "</td></tr>";
-      }
-      else {
-	startline = "<li>";
-	break_str = "&nbsp;";
-	snprintf(date_str, sizeof(date_str), "<em>(%s)</em>", getindexdatestr(hp->data->date));
-	endline = "</li>";
-      }
-      fprintf(fp,"%s%s%s</a>%s<a name=\"%s%d\" id=\"%s%d\">%s</a>%s\n",
-	      startline, msg_href(hp->data, subdir_email, TRUE), subj, break_str,
-	      set_fragment_prefix, hp->data->msgnum, set_fragment_prefix, hp->data->msgnum, 
-	      date_str, endline);
-      if(subj)
-	free(subj);
-      if(tmpname)
-	free(tmpname);
+    author_list_begin(fp);
+    printauthors(fp, authorlist, &prevauthor, -1, -1, email);
+    author_list_end(fp);
+}
 
-      *oldname = hp->data->name;	/* avoid copying */
-    }
-    printauthors(fp, hp->right, oldname, year, month, subdir_email);
-  }
+static void author_page_body(FILE *fp, struct index_page *page)
+{
+    char *prevauthor = "";
+    int i;
+
+    author_list_begin(fp);
+    for (i = 0; i < page->count; i++)
+	print_author_row(fp, page->rows[i], &prevauthor, NULL);
+    author_list_end(fp);
 }
 
 /*
-** Prints the author index file and links sorted alphabetically.
+** Prints one author index, the whole of it or, with page != NULL, one
+** of its pages.
 */
 
-void writeauthors(int amountmsgs, struct emailinfo *email)
+static void write_author_index(char *authname, int amountmsgs,
+			       struct emailinfo *email,
+			       struct index_page *page)
 {
     int newfile;
     char *filename;
     FILE *fp;
-    char *authname = index_name[email && email->subdir != NULL][AUTHOR_INDEX];
     time_t start_date_num = email && email->subdir ? email->subdir->first_email->date : firstdatenum;
     time_t end_date_num = email && email->subdir ? email->subdir->last_email->date : lastdatenum;
 
+    if (page) {
+	amountmsgs = page->count;
+	index_page_dates(page, &start_date_num, &end_date_num);
+    }
+
     filename = htmlfilename(authname, email, "");
 
     if (isfile(filename))
@@ -2924,7 +3748,7 @@ void writeauthors(int amountmsgs, struct emailinfo *email)
     else
 	newfile = 1;
 
-	if ((fp = fopen(filename, "w")) == NULL) { /* AUDIT biege: where? */
+	if ((fp = output_open(filename)) == NULL) { /* AUDIT biege: where? */
 	     snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
 	progerr(errmsg);
     }
@@ -2941,25 +3765,13 @@ void writeauthors(int amountmsgs, struct emailinfo *email)
 			     amountmsgs, email ? email->subdir : NULL);
     fprintf (fp, "</div>\n");
 
-    if (set_indextable) {
-		fprintf(fp, "<div class=\"center\">\n<table>\n<tr><td><strong>%s</strong></td><td><strong>%s</strong></td><td><strong> %s</strong></td></tr>\n", lang[MSG_CAUTHOR], lang[MSG_CSUBJECT], lang[MSG_CDATE]);
-    }
-    else {
-        fprintf(fp, "<div class=\"messages-list\">\n");
-	fprintf(fp, "<ul>\n");
-    }
-    {
-	char *prevauthor = "";
-	printauthors(fp, authorlist, &prevauthor, -1, -1, email);
-    }
-    if (set_indextable) {
-	fprintf(fp, "</table>\n</div>\n");
-    }
-    else {
-        fprintf(fp, "</ul></li>\n");
-	fprintf(fp, "</ul>\n");
-	fprintf(fp, "</div>\n");
+    if (page) {
+	print_index_page_links(fp, page);
+	author_page_body(fp, page);
+	print_index_page_links(fp, page);
     }
+    else
+	print_index_body(fp, author_index_body, email);
 
     /* 
      * Print out archive information links at the bottom 
@@ -2972,7 +3784,7 @@ void writeauthors(int amountmsgs, struct emailinfo *email)
 
     printfooter(fp, ihtmlfooterfile, set_label, set_dir, lang[MSG_BY_AUTHOR], authname, TRUE);
 
-    fclose(fp);
+    output_close(fp);
 
     if (newfile && chmod(filename, set_filemode) == -1) {
 	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %o.", lang[MSG_CANNOT_CHMOD], filename, set_filemode);
@@ -2984,12 +3796,25 @@ void writeauthors(int amountmsgs, struct emailinfo *email)
 	putchar('\n');
 }
 
+/*
+** Prints the author index file and links sorted alphabetically.
+*/
+
+void writeauthors(int amountmsgs, struct emailinfo *email)
+{
+    if (index_paged(email))
+	write_index_pages(AUTHOR_INDEX, amountmsgs, write_author_index);
+    else
+	write_author_index(index_name[email && email->subdir != NULL][AUTHOR_INDEX],
+			   amountmsgs, email, NULL);
+}
+
 /*
 ** Pretty-prints the items for the haof
 */
 void printhaofitems(FILE *fp, struct header *hp, int year, int month, struct emailinfo *subdir_email)
 {
-  char *subj, *from_name, *from_emailaddr;
+  struct index_row *row;
 
   if (hp != NULL) {
     struct emailinfo *em = hp->data;
@@ -2998,26 +3823,21 @@ void printhaofitems(FILE *fp, struct header *hp, int year, int month, struct ema
 	&& (month == -1 || month_of_datenum(em->date) == month)
         && !em->is_deleted && (!subdir_email || subdir_email->subdir == em->subdir)) {
 
-#ifdef HAVE_ICONV
-      subj = convchars(em->subject, "utf-8");
-      from_name = convchars(em->name, "utf-8");
-      from_emailaddr = convchars(em->emailaddr, "utf-8");
-#else
-      subj = convchars(em->subject, em->charset);
-      from_name = convchars(em->name, em->charset);
-      from_emailaddr = convchars(em->emailaddr, em->charset);
-#endif
-
-      fprintf(fp, "      <mail>\n" "        <subject>%s</subject>\n" "        <date>%s</date>\n" "        <fromname>%s</fromname>\n" "        <fromemail>%s</fromemail>\n" "        <message-id>%s</message-id>\n" "        <file>\"%s\"</file>\n" "      </mail>\n\n", subj, getdatestr(em->date), from_name, from_emailaddr, em->msgid, msg_relpath(em, subdir_email));
+      row = index_row(em);
 
-      free(subj);
-      free(from_name);
-      free(from_emailaddr);
+      fprintf(fp, "      <mail>\n" "        <subject>%s</subject>\n" "        <date>%s</date>\n" "        <fromname>%s</fromname>\n" "        <fromemail>%s</fromemail>\n" "        <message-id>%s</message-id>\n" "        <file>\"%s\"</file>\n" "      </mail>\n\n", row->subject, row->date, row->name, row->emailaddr, em->msgid, ROW_HREF(row, subdir_email));
     }
     printhaofitems(fp, hp->right, year, month, subdir_email);
   }
 }
 
+static void haof_body(FILE *fp, struct emailinfo *email)
+{
+    fprintf(fp, "  <mails>\n");
+    printhaofitems(fp, datelist, -1, -1, email);
+    fprintf(fp, "  </mails>\n");
+}
+
 /*
 ** Write the XML based hypermail archive overview file
 */
@@ -3035,7 +3855,7 @@ void writehaof(int amountmsgs, struct emailinfo *email)
     else
 	newfile = 1;
 
-	if ((fp = fopen(filename, "w")) == NULL) { /* AUDIT biege: where? */
+	if ((fp = output_open(filename)) == NULL) { /* AUDIT biege: where? */
 	    snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
 	progerr(errmsg);
     }
@@ -3054,12 +3874,10 @@ void writehaof(int amountmsgs, struct emailinfo *email)
 
     print_haof_indices(fp, email ? email->subdir : NULL);
 	    
-    fprintf(fp, "  <mails>\n");
-    printhaofitems(fp, datelist, -1, -1, email);
-    fprintf(fp, "  </mails>\n");
+    print_index_body(fp, haof_body, email);
     fprintf(fp, "  </haof>\n");
 
-    fclose(fp);
+    output_close(fp);
 
     if (newfile && chmod(filename, set_filemode) == -1) {
 	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %o.", lang[MSG_CANNOT_CHMOD], filename, set_filemode);
@@ -3074,6 +3892,149 @@ void writehaof(int amountmsgs, struct emailinfo *email)
 
 
 
+/*
+** Prints a message list into memory. Runs in its own thread, so on
+** failure it just leaves the list to be printed by the page writer.
+*/
+
+static void *render_index_body(void *arg)
+{
+    struct index_body *b = (struct index_body *)arg;
+    FILE *fp;
+
+#ifdef HAVE_OPEN_MEMSTREAM
+    if ((fp = open_memstream(&b->text, &b->len)) == NULL)
+	return arg;
+    b->print(fp, b->email);
+    if (fclose(fp) == EOF) {
+	free(b->text);
+	b->text = NULL;
+    }
+#else
+    long len;
+
+    if ((fp = tmpfile()) == NULL)
+	return arg;
+    b->print(fp, b->email);
+    if (fflush(fp) == 0 && (len = ftell(fp)) >= 0
+	&& (b->text = (char *)malloc(len + 1)) != NULL) {
+	rewind(fp);
+	b->len = fread(b->text, 1, len, fp);
+	if (b->len != (size_t)len) {
+	    free(b->text);
+	    b->text = NULL;
+	}
+    }
+    fclose(fp);
+#endif
+    return arg;
+}
+
+/*
+** Prints the message lists of the indexes that are about to be written
+** for the folder email is in (or the top of the archive), one thread
+** for each. The thread and attachment indexes go through shared static
+** buffers (msg_href(), message_name()...) and are left to their writers.
+** The index rows have to be made beforehand, with make_index_rows().
+*/
+
+static void prerender_indices(int level, struct emailinfo *email)
+{
+    int i;
+
+    index_body_count = 0;
+    if (show_index[level][DATE_INDEX]
+	&& !(level == 0 && (index_paged(email) || date_append_check())))
+	index_bodies[index_body_count++].print = date_index_body;
+    if (show_index[level][SUBJECT_INDEX] && !(level == 0 && index_paged(email)))
+	index_bodies[index_body_count++].print = subject_index_body;
+    if (show_index[level][AUTHOR_INDEX] && !(level == 0 && index_paged(email)))
+	index_bodies[index_body_count++].print = author_index_body;
+    if (set_writehaof)
+	index_bodies[index_body_count++].print = haof_body;
+    for (i = 0; i < index_body_count; i++) {
+	index_bodies[i].email = email;
+	index_bodies[i].text = NULL;
+	index_bodies[i].len = 0;
+    }
+
+#ifdef HAVE_PTHREAD
+    if (index_body_count > 1) {
+	pthread_t workers[4];
+	int started[4];
+
+	for (i = 1; i < index_body_count; i++)
+	    started[i] = !pthread_create(&workers[i], NULL, render_index_body,
+					 &index_bodies[i]);
+	render_index_body(&index_bodies[0]);
+	for (i = 1; i < index_body_count; i++) {
+	    if (started[i])
+		pthread_join(workers[i], NULL);
+	}
+	return;
+    }
+#endif
+    /* nothing to gain from printing a single list ahead of time */
+    index_body_count = 0;
+}
+
+/*
+** Drops whatever prerender_indices() printed that wasn't used.
+*/
+
+static void release_indices(void)
+{
+    int i;
+
+    for (i = 0; i < index_body_count; i++)
+	if (index_bodies[i].text)
+	    free(index_bodies[i].text);
+    index_body_count = 0;
+}
+
+/*
+** Writes the indexes at the top of the archive.
+*/
+
+void write_indices(int amountmsgs)
+{
+    stats_begin("prerender");
+    make_index_rows(datelist);
+    prerender_indices(0, NULL);
+    stats_end("prerender");
+    if (show_index[0][DATE_INDEX]) {
+	stats_begin("date");
+	writedates(amountmsgs, NULL);
+	stats_end("date");
+    }
+    if (show_index[0][THREAD_INDEX]) {
+	stats_begin("thread");
+	writethreads(amountmsgs, NULL);
+	stats_end("thread");
+    }
+    if (show_index[0][SUBJECT_INDEX]) {
+	stats_begin("subject");
+	writesubjects(amountmsgs, NULL);
+	stats_end("subject");
+    }
+    if (show_index[0][AUTHOR_INDEX]) {
+	stats_begin("author");
+	writeauthors(amountmsgs, NULL);
+	stats_end("author");
+    }
+    if (set_attachmentsindex) {
+	stats_begin("attachment");
+	writeattachments(amountmsgs, NULL);
+	stats_end("attachment");
+    }
+    if (set_writehaof) {
+	stats_begin("haof");
+	writehaof(amountmsgs, NULL);
+	stats_end("haof");
+    }
+    release_indices();
+}
+
 static int count_messages(struct header *hp, int year, int mo, long *first_date, long *last_date)
 {
     if (hp != NULL) {
@@ -3140,7 +4101,7 @@ static void printmonths(FILE *fp, char *summary_filename, int amountmsgs)
 		    continue;
 		snprintf(buf1, sizeof(buf1), "%sby%s", month_str, save_name[j]);
 		filename = htmlfilename(buf1, NULL, "");
-		fp1 = fopen(filename, "w");
+		fp1 = output_open(filename);
 		if (!fp1) {
 	    	    snprintf(errmsg, sizeof(errmsg), "can't open %s", filename);
 		    progerr(errmsg);
@@ -3195,15 +4156,17 @@ static void printmonths(FILE *fp, char *summary_filename, int amountmsgs)
 
 		printfooter(fp1, ihtmlfooterfile, set_label, set_dir, subject_title, 
 			    save_name[j], FALSE);
-		fclose(fp1);
 		if (!count) {
+		    output_discard(fp1);
 		    remove(filename);
+		    compress_remove(filename);
 		    if (started_line)
 		        fprintf(fp, "<td></td>");
 		    else
 			++empties;
 		}
 		else {
+		    output_close(fp1);
 		    if (!started_line) {
 			fprintf(fp, "<tr><td>%s</td><td>%d %s</td>", month_str_pub, count, lang[MSG_ARTICLES]);
 			while (empties--)
@@ -3240,13 +4203,13 @@ void write_summary_indices(int amount_new)
 		char *filename;
 		FILE *fp;
 		filename = htmlfilename("summary", NULL, set_htmlsuffix);
-		fp = fopen(filename, "w");	/* AUDIT biege: where? */
+		fp = output_open(filename);	/* AUDIT biege: where? */
 		if (!fp) {
 			snprintf(errmsg, sizeof(errmsg), "Couldn't write \"%s\".", filename);
 			progerr(errmsg);
 		}
 		printmonths(fp, filename, amount_new);
-		fclose(fp);
+		output_close(fp);
 		chmod(filename, set_filemode);
 		free(filename);
 	}
@@ -3280,7 +4243,7 @@ void write_toplevel_indices(int amountmsgs)
 
     if (!show_index[0][FOLDERS_INDEX])
 	fp = NULL;
-    else if ((fp = fopen(filename, "w")) == NULL) {
+    else if ((fp = output_open(filename)) == NULL) {
         snprintf(errmsg, sizeof(errmsg), "%s \"%s\".", lang[MSG_COULD_NOT_WRITE], filename);
 	progerr(errmsg);
     }
@@ -3322,10 +4285,13 @@ void write_toplevel_indices(int amountmsgs)
 	while (sd->next_subdir)
 	    sd = sd->next_subdir;
     saved_set_dateformat = set_dateformat;
+    make_index_rows(datelist);	/* once, not for each folder */
     for (; sd != NULL; sd = set_reverse_folders ? sd->prior_subdir : sd->next_subdir) {
 	int started_line = 0;
 	if (!datelist->data)
 	    continue;
+	set_dateformat = saved_set_dateformat;
+	prerender_indices(1, sd->first_email);
 	for (j = 0; j <= ATTACHMENT_INDEX; ++j) {
             /* apply offset so the period column's href points to index.html */
 	    k = (j + offset) % (ATTACHMENT_INDEX + 1);
@@ -3413,6 +4379,7 @@ void write_toplevel_indices(int amountmsgs)
 	      fprintf (fp, "</td>\n");
 	    }
 	}
+	release_indices();
 	if (started_line && fp)
 	    fprintf(fp, "    <td align=\"right\" class=\"count\">%d</td>\n  </tr>\n", sd->count);
     }
@@ -3426,7 +4393,7 @@ void write_toplevel_indices(int amountmsgs)
        */
       print_index_footer_links(fp, FOLDERS_INDEX, lastdatenum, amountmsgs, NULL);
       printfooter(fp, ihtmlfooterfile, set_label, set_dir, subject, filename, TRUE);
-      fclose(fp);
+      output_close(fp);
       
       if (newfile && chmod(filename, set_filemode) == -1) {
 	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %o.", lang[MSG_CANNOT_CHMOD], filename,
@@ -3439,37 +4406,63 @@ void write_toplevel_indices(int amountmsgs)
 
 /*
 ** This writes out the message index... a file giving the old msgno
-** and the hash string that corresponds to it.
+** and the hash string that corresponds to it. Slots already in the
+** index from startnum on are kept, so an update only writes those of
+** its new messages; startnum 0 starts it over.
 */
 void write_messageindex(int startnum, int maxnum)
 {
-    int num;
+    int num, fd, slots;
     struct emailinfo *email;
 
-    FILE *fp;
     char *filename;
     char *buf;
-
-    struct body *bp;
+    char *slot;
+    size_t len;
 
     if (set_showprogress)
 	printf("%s \"%s\"...    ", lang[MSG_WRITING_ARTICLES], set_dir);
 
-    /* write the intial message and number of messages in the index */
-	filename = messageindex_name();
-	fp = fopen(filename, "w");
-	fprintf(fp, "%.04d %.04d\n", startnum, maxnum - 1);
+    filename = msgindex_filename();
+    fd = open(filename, O_RDWR | O_CREAT, set_filemode);
+    if (fd == -1) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\".",
+		 lang[MSG_COULD_NOT_WRITE], filename);
+	progerr(errmsg);
+    }
+    slots = msgindex_slots(fd);
+    if (slots == -1 || startnum == 0) {
+	if (msgindex_init(fd)) {
+	    snprintf(errmsg, sizeof(errmsg), "%s \"%s\".",
+		     lang[MSG_COULD_NOT_WRITE], filename);
+	    progerr(errmsg);
+	}
+	slots = 0;
+    }
+    if (startnum > slots)
+	startnum = slots;	/* older ones are missing too */
 
     /* write the reference to the message filenames */
-    num = startnum;
-    while (num <  maxnum) {
-		if ((bp = hashnumlookup(num, &email)) != NULL) {
-	  buf = message_name(email);
-	  fprintf(fp, "%.04d %s\n", num, buf);
-	}
-      num++;
+    len = (maxnum > startnum ? maxnum - startnum : 0) * MSGINDEX_SLOT;
+    buf = (char *)emalloc(len + 1);
+    memset(buf, 0, len + 1);
+    for (num = startnum, slot = buf; num < maxnum;
+	 num++, slot += MSGINDEX_SLOT) {
+	if (hashnumlookup(num, &email) != NULL)
+	    strncpy(slot, message_name(email), MSGINDEX_SLOT - 1);
     }
-    fclose(fp);
-    chmod(filename, set_filemode);
+    if ((len && pwrite(fd, buf, len, msgindex_offset(startnum)) != (ssize_t)len)
+	|| ftruncate(fd, msgindex_offset(maxnum))) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\".",
+		 lang[MSG_COULD_NOT_WRITE], filename);
+	progerr(errmsg);
+    }
+    close(fd);
+    free(buf);
+    free(filename);
+
+    /* the text index of older versions is out of date now */
+    filename = messageindex_name();
+    unlink(filename);
     free(filename);
 } /* end write_messageindex () */
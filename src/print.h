@@ -15,6 +15,8 @@ char *print_leading_whitespace(FILE *, char *);
 void update_deletions(int);
 void writearticles(int, int);
 void writedates(int, struct emailinfo *);
+char *index_page_name(mindex_t, int);
+int index_page_num(mindex_t, int);
 void writesubjects(int, struct emailinfo *);
 void writethreads(int, struct emailinfo *);
 void writeauthors(int, struct emailinfo *);
@@ -44,6 +46,8 @@ void ConvURLs(FILE *, char *, char *, char *, char *);
 char *ConvURLsString(char *, char *, char *, char *);
 void write_summary_indices(int);
 void write_toplevel_indices(int);
+void write_indices(int);
+void free_index_rows(struct header *);
 struct emailinfo *nextinthread(int);
 void init_index_names(void);
 
@@ -38,184 +38,331 @@
 **
 */
 
-int printfile(FILE *fp, char *format, char *label, char *subject,
-	      char *dir, char *name, char *email, char *message_id,
-	      char *charset, char *date, char *filename)
+/*
+** Templates are compiled the first time they're used into a list of
+** segments: literal text, with the cookies whose value is fixed by the
+** configuration (%G, %m, %v, ...) already expanded into it, and the
+** cookies that are filled in for each page. %a, %b and %g are among
+** the latter: a batch job that shares the batch's compiled templates
+** has its own -a, -b and generation time. Printing a page then only
+** needs to copy the literal chunks and fill in the per-page values.
+** Templates are looked up by their text: a template string can be
+** freed and another one read in at the same address.
+*/
+
+struct tmpl_segment {
+    char cookie;		/* 0 for literal text */
+    char *text;
+    size_t len;
+};
+
+struct template {
+    char *source;
+    int count;
+    struct tmpl_segment *segs;
+    struct template *next;
+};
+
+static struct template *templates;
+
+static void add_segment(struct template *tp, char cookie, struct Push *lit)
 {
-    register char *cp;
-    register char *aptr;
+    struct tmpl_segment *seg;
+
+    if (PUSH_STRLEN(*lit)) {
+	seg = &tp->segs[tp->count++];
+	seg->cookie = 0;
+	seg->len = PUSH_STRLEN(*lit);
+	seg->text = PUSH_STRING(*lit);
+	INIT_PUSH(*lit);
+    }
+    if (cookie) {
+	seg = &tp->segs[tp->count++];
+	seg->cookie = cookie;
+	seg->text = NULL;
+	seg->len = 0;
+    }
+}
+
+static struct template *compile_template(const char *format)
+{
+    struct template *tp;
+    struct Push lit;
+    const char *aptr = format;
     char c;
-    char *ptr,*tmpptr=NULL;
-    size_t tmplen;
+    int max = 1;
 
-    aptr = format;
+    for (tp = templates; tp != NULL; tp = tp->next)
+	if (!strcmp(tp->source, format))
+	    return tp;
 
+    /* each cookie adds at most a placeholder and the literal before it */
+    while ((c = *aptr++))
+	if (c == '%')
+	    max += 2;
+
+    tp = (struct template *)emalloc(sizeof(struct template));
+    tp->source = strsav(format);
+    tp->count = 0;
+    tp->segs = (struct tmpl_segment *)emalloc(max * sizeof(struct tmpl_segment));
+    INIT_PUSH(lit);
+
+    aptr = format;
     while ((c = *aptr++)) {
 	if (c == '\\') {
 	    switch (*aptr++) {
 	    case 'n':		/* Add the \n character */
-		putc('\n', fp);
+		PushByte(&lit, '\n');
 		continue;
 	    case 't':		/* Add the \t character */
-		putc('\t', fp);
+		PushByte(&lit, '\t');
 		continue;
+	    case '\0':
+		--aptr;
+		break;
 	    default:
 		break;
 	    }			/* end switch */
 	}
 	else if (c == '%') {
-            char nextone = *aptr++;
+	    char nextone = *aptr++;
 	    switch (nextone) {
 	    case '%':		/* Add the % character */
-		putc('%', fp);
-		continue;
-	    case '~':		/* %~ - storage directory */
-		for (cp = dir; *cp; cp++)
-		    putc(*cp, fp);
-		continue;
-	    case 'A':		/* %e - email address of message author */
-		if (email && name) {
-#ifdef HAVE_ICONV
-		  tmpptr=i18n_convstring(name,"UTF-8",charset,&tmplen);
-		  cp = convchars(tmpptr,charset);
-		  if(tmpptr)
-		    free(tmpptr);
-		  fprintf(fp,
-			"<meta name=\"Author\" content=\"%s (%s)\" />",
-			cp, obfuscate_email_address(email));
-		  if (cp)
-		    free(cp);
-#else
-		fprintf(fp,
-			"<meta name=\"Author\" content=\"%s (%s)\" />",
-			tmpptr=convchars(name,charset), obfuscate_email_address(email));
-		if (tmpptr)
-		  free(tmpptr);
-#endif
-		}
-		continue;
-	    case 'a':		/* %a - Other Archives URL */
-		if (set_archives) {
-		    for (cp = set_archives; *cp; cp++)
-			putc(*cp, fp);
-		}
+		PushByte(&lit, '%');
 		continue;
 	    case 'B':
-	      printf("Warning: the %%B option has been disabled. Use a\n"
-		     "style sheet instead. See the INSTALL file for more info.\n");
-	      continue;
-	    case 'b':		/* %b - About this archive URL */
-		if (set_about) {
-		    for (cp = set_about; *cp; cp++)
-			putc(*cp, fp);
-		}
-		continue;
-	    case 'c':
-		if (charset && *charset) {
-		    /* only output this if we have a charset */
-		    fprintf(fp, "<meta http-equiv=\"Content-Type\""
-			    " content=\"text/html; charset=%s\" />\n",
-			    charset);
-		}
-		continue;
-
-	    case 'D':		/* %D - date of message */
-		if (date) {
-		    fprintf(fp,
-			    "<meta name=\"Date\" content=\"%s\" />",
-			    date);
-		}
-		continue;
-	    case 'e':		/* %e - email address of message author */
-		if (email) {
-		    for (cp = email; *cp; cp++)
-			putc(*cp, fp);
-		}
-		continue;
-	    case 'f':		/* %f - file name */
-		if (filename) {
-		    for (cp = filename; *cp; cp++)
-			putc(*cp, fp);
-		}
-		continue;
-	    case 'g':		/* %g - date and time archive generated */
-		for (cp = getlocaltime(); *cp; cp++)
-		    putc(*cp, fp);
+		printf("Warning: the %%B option has been disabled. Use a\n"
+		       "style sheet instead. See the INSTALL file for more info.\n");
 		continue;
 	    case 'G':		/* %G - Language code */
-		if (set_language) {
-		    for (cp = set_language; *cp; cp++)
-			putc(*cp, fp);
-		}
+		if (set_language)
+		    PushString(&lit, set_language);
 		continue;
 	    case 'h':		/* %h - Hypermail Resource Center */
-		for (cp = HMURL; *cp; cp++)
-		    putc(*cp, fp);
-		continue;
-	    case 'i':		/* %m - Message-ID of message */
-		if (message_id) {
-		    for (cp = message_id; *cp; cp++)
-			putc(*cp, fp);
-		}
-		continue;
-	    case 'l':		/* %l - Archive label  */
-		for (cp = label; *cp; cp++)
-		    putc(*cp, fp);
+		PushString(&lit, HMURL);
 		continue;
 	    case 'm':		/* %m - mailto */
-		if (set_mailto) {
-		    for (cp = set_mailto; *cp; cp++)
-			putc(*cp, fp);
-		}
+		if (set_mailto)
+		    PushString(&lit, set_mailto);
 		continue;
 	    case 'p':		/* %p - PROGNAME */
-		for (cp = PROGNAME; *cp; cp++)
-		    putc(*cp, fp);
+		PushString(&lit, PROGNAME);
 		continue;
-	    case 's':		/* %s - Subject of message or Index Title */
-		for (ptr = cp = convchars(subject, charset); *cp; cp++)
-		    putc(*cp, fp);
-		free(ptr);
+	    case 'v':		/* %v - VERSION */
+		PushString(&lit, VERSION);
 		continue;
-	    case 'S':		/* %s - Subject of message or Index Title */
-#ifdef HAVE_ICONV
-	        tmpptr=i18n_convstring(subject,"UTF-8",charset, &tmplen);
-		fprintf(fp, "<meta name=\"Subject\" content=\"%s\" />",
-			cp = convchars(tmpptr,charset));
-#else
-		fprintf(fp, "<meta name=\"Subject\" content=\"%s\" />",
-			cp = convchars(subject, charset));
-#endif
-		free(cp);
+	    case 'u':		/* %u - Expanded Version link */
+		PushString(&lit, "<a href=\"" HMURL "\">" PROGNAME " " VERSION "</a>");
 		continue;
+	    case '~':
+	    case 'a':
+	    case 'A':
+	    case 'b':
+	    case 'c':
+	    case 'D':
+	    case 'e':
+	    case 'f':
+	    case 'g':
+	    case 'i':
+	    case 'l':
+	    case 's':
+	    case 'S':
 	    case 't':
-	      {
-		struct emailinfo *ep;
-		if(hashnumlookup(0, &ep))
-		    fprintf(fp, ep->subdir ? ep->subdir->rel_path_to_top : "");
+		add_segment(tp, nextone, &lit);
 		continue;
-	      }
-	    case 'v':		/* %v - VERSION */
-		for (cp = VERSION; *cp; cp++)
-		    putc(*cp, fp);
-		continue;
-	    case 'u':		/* %u - Expanded Version link */
-		fprintf(fp, "<a href=\"%s\">%s %s</a>",
-			HMURL, PROGNAME, VERSION);
+	    case '\0':
+		PushByte(&lit, '%');
+		--aptr;
 		continue;
 	    default:
-		putc('%', fp);
-		putc(nextone, fp);
+		PushByte(&lit, '%');
+		PushByte(&lit, nextone);
 		continue;
 	    }			/* end switch */
 	}
-	putc(c, fp);
+	PushByte(&lit, c);
     }				/* end while */
+    add_segment(tp, 0, &lit);
+
+    tp->next = templates;
+    templates = tp;
+    return tp;
+}
+
+/*
+** Compiles the header and footer templates ahead of their first use.
+*/
+
+void compile_templates(void)
+{
+    char *formats[4];
+    int i;
+
+    formats[0] = ihtmlheaderfile;
+    formats[1] = ihtmlfooterfile;
+    formats[2] = mhtmlheaderfile;
+    formats[3] = mhtmlfooterfile;
+    for (i = 0; i < 4; i++)
+	if (formats[i])
+	    compile_template(formats[i]);
+}
+
+/*
+** Frees the compiled templates.
+*/
+
+void free_templates(void)
+{
+    struct template *tp;
+    int i;
+
+    while ((tp = templates) != NULL) {
+	templates = tp->next;
+	for (i = 0; i < tp->count; i++)
+	    if (tp->segs[i].text)
+		free(tp->segs[i].text);
+	free(tp->segs);
+	free(tp->source);
+	free(tp);
+    }
+}
+
+int printfile(FILE *fp, char *format, char *label, char *subject,
+	      char *dir, char *name, char *email, char *message_id,
+	      char *charset, char *date, char *filename)
+{
+    struct template *tp = compile_template(format);
+    struct tmpl_segment *seg, *end;
+    char *cp;
+    char *tmpptr=NULL;
+    size_t tmplen;
+
+    for (seg = tp->segs, end = seg + tp->count; seg < end; seg++) {
+	switch (seg->cookie) {
+	case 0:
+	    fwrite(seg->text, 1, seg->len, fp);
+	    break;
+	case '~':		/* %~ - storage directory */
+	    fputs(dir, fp);
+	    break;
+	case 'a':		/* %a - Other Archives URL */
+	    if (set_archives)
+		fputs(set_archives, fp);
+	    break;
+	case 'A':		/* %A - author META TAG */
+	    if (email && name) {
+#ifdef HAVE_ICONV
+		tmpptr=i18n_convstring(name,"UTF-8",charset,&tmplen);
+		cp = convchars(tmpptr,charset);
+		if(tmpptr)
+		    free(tmpptr);
+		fprintf(fp,
+			"<meta name=\"Author\" content=\"%s (%s)\" />",
+			cp, obfuscate_email_address(email));
+		if (cp)
+		    free(cp);
+#else
+		fprintf(fp,
+			"<meta name=\"Author\" content=\"%s (%s)\" />",
+			tmpptr=convchars(name,charset), obfuscate_email_address(email));
+		if (tmpptr)
+		    free(tmpptr);
+#endif
+	    }
+	    break;
+	case 'b':		/* %b - About this archive URL */
+	    if (set_about)
+		fputs(set_about, fp);
+	    break;
+	case 'c':
+	    if (charset && *charset) {
+		/* only output this if we have a charset */
+		fprintf(fp, "<meta http-equiv=\"Content-Type\""
+			" content=\"text/html; charset=%s\" />\n",
+			charset);
+	    }
+	    break;
+	case 'D':		/* %D - date of message */
+	    if (date) {
+		fprintf(fp,
+			"<meta name=\"Date\" content=\"%s\" />",
+			date);
+	    }
+	    break;
+	case 'e':		/* %e - email address of message author */
+	    if (email)
+		fputs(email, fp);
+	    break;
+	case 'f':		/* %f - file name */
+	    if (filename)
+		fputs(filename, fp);
+	    break;
+	case 'g':		/* %g - date and time archive generated */
+	    fputs(getlocaltime(), fp);
+	    break;
+	case 'i':		/* %i - Message-ID of message */
+	    if (message_id)
+		fputs(message_id, fp);
+	    break;
+	case 'l':		/* %l - Archive label  */
+	    fputs(label, fp);
+	    break;
+	case 's':		/* %s - Subject of message or Index Title */
+	    fputs(cp = convchars(subject, charset), fp);
+	    free(cp);
+	    break;
+	case 'S':		/* %S - Subject META TAG */
+#ifdef HAVE_ICONV
+	    tmpptr=i18n_convstring(subject,"UTF-8",charset, &tmplen);
+	    fprintf(fp, "<meta name=\"Subject\" content=\"%s\" />",
+		    cp = convchars(tmpptr,charset));
+#else
+	    fprintf(fp, "<meta name=\"Subject\" content=\"%s\" />",
+		    cp = convchars(subject, charset));
+#endif
+	    free(cp);
+	    break;
+	case 't':
+	  {
+	    struct emailinfo *ep;
+	    if(hashnumlookup(0, &ep))
+		fputs(ep->subdir ? ep->subdir->rel_path_to_top : "", fp);
+	    break;
+	  }
+	}
+    }
 
-    fflush(fp);
     return (0);
 }
 
+/*
+** The style sheet emitted when none is configured, built at compile time
+** rather than with one fprintf per line on every page.
+*/
+
+static const char default_style[] =
+    "<style type=\"text/css\">\n"
+    "/*<![CDATA[*/\n"
+    "/* To be incorporated in the main stylesheet, don't code it in hypermail! */\n"
+    "body {color: black; background: #ffffff;}\n"
+    "dfn {font-weight: bold;}\n"
+    "pre { background-color:inherit;}\n"
+    ".head { border-bottom:1px solid black;}\n"
+    ".foot { border-top:1px solid black;}\n"
+    "th {font-style:italic;}\n"
+    "table { margin-left:2em;}"
+    "map ul {list-style:none;}\n"
+    "#mid { font-size:0.9em;}\n"
+    "#received { float:right;}\n"
+    "address { font-style:inherit;}\n"
+    "/*]]>*/\n"
+    ".quotelev1 {color : #990099;}\n"
+    ".quotelev2 {color : #ff7700;}\n"
+    ".quotelev3 {color : #007799;}\n"
+    ".quotelev4 {color : #95c500;}\n"
+    ".period {font-weight: bold;}\n"
+    "</style>\n";
+
 /*
 ** Prints the standard page header 
 */
@@ -248,8 +395,8 @@ void print_main_header(FILE *fp, bool index_header, char *label, char *name,
 	fprintf(fp, "<meta http-equiv=\"Content-Type\""
 		" content=\"text/html; charset=%s\" />\n", charset);
     }
-    fprintf(fp, "<meta name=\"generator\" content=\"%s %s, see %s\" />\n",
-                PROGNAME, VERSION, HMURL);
+    fputs("<meta name=\"generator\" content=\"" PROGNAME " " VERSION
+	  ", see " HMURL "\" />\n", fp);
 
     /* 
      * Strip off any trailing whitespace in TITLE so weblint is happy. 
@@ -338,31 +485,7 @@ void print_main_header(FILE *fp, bool index_header, char *label, char *name,
        * if style sheets are not specified, emit a default one.
        */
        /* @@ JK: the new css */
-      fprintf (fp, "<style type=\"text/css\">\n");
-      
-      fprintf (fp,"/*<![CDATA[*/\n");
-      fprintf (fp, "/* To be incorporated in the main stylesheet, don't code it in hypermail! */\n");
-      fprintf (fp, "body {color: black; background: #ffffff;}\n");
-      fprintf (fp, "dfn {font-weight: bold;}\n");
-      fprintf (fp, "pre { background-color:inherit;}\n");
-      fprintf (fp, ".head { border-bottom:1px solid black;}\n");
-      fprintf (fp, ".foot { border-top:1px solid black;}\n");
-      fprintf (fp, "th {font-style:italic;}\n");
-      fprintf (fp, "table { margin-left:2em;}");
-
-      /* JK: This was the WAI rule before */
-      /* fprintf (fp, "#body {background-color:#fff;}\n"); */
-      fprintf (fp, "map ul {list-style:none;}\n");
-      fprintf (fp, "#mid { font-size:0.9em;}\n");
-      fprintf (fp, "#received { float:right;}\n");
-      fprintf (fp, "address { font-style:inherit;}\n");
-      fprintf (fp, "/*]]>*/\n");
-      fprintf(fp, ".quotelev1 {color : #990099;}\n");
-      fprintf(fp, ".quotelev2 {color : #ff7700;}\n");
-      fprintf(fp, ".quotelev3 {color : #007799;}\n");
-      fprintf(fp, ".quotelev4 {color : #95c500;}\n");
-      fprintf (fp, ".period {font-weight: bold;}\n");
-      fprintf (fp, "</style>\n");
+      fputs(default_style, fp);
     }
 
     if (ihtmlheadfile)
@@ -446,7 +569,7 @@ void printfooter(FILE *fp, char *htmlfooter, char *label, char *dir,
     else {
 	fprintf(fp, "<p><small><em>\n");
 	fprintf(fp, "%s ", lang[MSG_ARCHIVE_GENERATED_BY]);
-	fprintf(fp, "<a href=\"%s\">%s %s</a>\n", HMURL, PROGNAME, VERSION);
+	fputs("<a href=\"" HMURL "\">" PROGNAME " " VERSION "</a>\n", fp);
 	fprintf(fp, ": %s\n", getlocaltime());
 	fprintf(fp, "</em></small></p>\n");
     }
@@ -5,6 +5,9 @@
 int printfile(FILE *, char *, char *, char *, char *, char *, char *, 
               char *, char *, char *, char *);
 
+void compile_templates(void);
+void free_templates(void);
+
 void print_main_header(FILE *, bool, char *, char *, char *, char *, char *,
 		       char *, char *, int, int);
 
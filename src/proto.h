@@ -9,6 +9,7 @@
 
 time_t convtoyearsecs(char *);
 char *getlocaltime(void);
+void reset_localtime(void);
 void gettimezone(void);
 void getthisyear(void);
 char *getdatestr(time_t);
@@ -42,6 +43,7 @@ char *dirpath(char *);
 void readconfigs(char *, int);
 
 int find_max_msgnum(void);
+void archive_state_save(void);
 int is_empty_archive(void);
 void symlink_latest(void);
 struct emailsubdir *msg_subdir(int, time_t);
@@ -54,8 +56,13 @@ int matches_existing(int);
 
 char *messageindex_name(void);
 int find_max_msgnum_id(void);
-char **read_msgnum_id_table(int);
-void free_msgnum_id_table(char **, int);
+char *msgindex_filename(void);
+int msgindex_slots(int);
+int msgindex_init(int);
+off_t msgindex_offset(int);
+void msgindex_load(void);
+const char *msgindex_lookup(int);
+void msgindex_unload(void);
 char *message_name(struct emailinfo *);
 
 /*
@@ -76,7 +83,10 @@ char **valid_language(char *, char **);
 ** lock.c functions
 */
 void lock_archive(char *);
+void lock_archive_mode(char *, int);
 void unlock_archive(void);
+char **read_lock_args(int *, char **);
+int run_read_locked(char *, char **);
 
 /*
 ** mem.c function
@@ -110,6 +120,7 @@ char *strsav(const char *);
 char *strreplace(char *, char *);
 void strcpymax(char *, const char *, int);
 void strtolower (char *);
+char *casefold(const char *);
 char *stripzone(char *);
 int numstrchr(char *, char);
 char *getvalue(char *);
@@ -145,9 +156,12 @@ const char *get_quote_prefix(void);
 const char *find_quote_prefix(struct body *bp, int is_reply);
 char *unquote(char *line);
 char *remove_hypermail_tags(char *line);
-int compute_quoted_percent(struct body *bp);
+int analyze_body(struct body *bp, int is_reply, int guess_prefix);
+int body_isquote(const struct body *bp);
+int body_quote_run(const struct body *bp);
 int is_sig_start(const char *line);
 int find_quote_depth(char *);
+char *quote_class(int);
 char *find_quote_class(char *);
 
 #ifdef NOTDEF
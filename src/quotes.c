@@ -305,9 +305,8 @@ int find_quote_depth(char *line)
     return cnt;
 }
 
-char *find_quote_class(char *line)
+char *quote_class(int quote_depth)
 {
-    int quote_depth = find_quote_depth(line);
     if (quote_depth > 4) quote_depth = ((quote_depth - 1) % 4) + 1;
     if (quote_depth >= 4) return "quotelev4";
     if (quote_depth >= 3) return "quotelev3";
@@ -316,33 +315,96 @@ char *find_quote_class(char *line)
     return "";
 }
 
+char *find_quote_class(char *line)
+{
+    return quote_class(find_quote_depth(line));
+}
+
+/*
+** Numbers the lines of a quote, from start up to end, with how many
+** quoted lines are left from each of them.
+*/
+
+static void count_quote_run(struct body *start, struct body *end)
+{
+    struct body *bp;
+    int n = 0;
+
+    for (bp = start; bp != end; bp = bp->next)
+	++n;
+    for (bp = start; bp != end; bp = bp->next)
+	bp->quote_run = n--;
+}
+
 /*
-** Find out what percent of the body consists of lines appearing
-** to be quotes of other messages.
+** Classifies each line of a body once for printbody() and what it
+** calls: whether it is a quote, how deep, how many quoted lines run on
+** from it, and whether it starts a signature. What is a quote depends
+** on the quote prefix, so that is guessed first if asked to. Returns
+** the percentage of the lines after the header that are quotes.
 */
 
-int compute_quoted_percent(struct body *bp)
+int analyze_body(struct body *bp, int is_reply, int guess_prefix)
 {
+    struct body *run = NULL;	/* first line of the quote we're in */
     int inheader = 1;
-    int insig = 0;
     int count_quoted = 0;
     int count_lines = 0;
-    while (bp != NULL) {
+
+    if (guess_prefix)
+	find_quote_prefix(bp, is_reply);
+
+    for (; bp != NULL; bp = bp->next) {
+	bp->analyzed = TRUE;
+	bp->quoted = isquote(bp->line) ? TRUE : FALSE;
+	bp->sig = is_sig_start(bp->line) ? TRUE : FALSE;
+	bp->quote_depth = bp->quoted ? find_quote_depth(bp->line) : 0;
+	bp->quote_run = 0;
+	if (bp->quoted && !run)
+	    run = bp;
+	else if (!bp->quoted && run) {
+	    count_quote_run(run, bp);
+	    run = NULL;
+	}
+
 	if ((bp->line)[0] == '\n')
 	    inheader = 0;
-	else if (inheader) {
-	    bp = bp->next;
+	else if (inheader)
 	    continue;
-	}
-	if (is_sig_start(bp->line))
-	    insig = 1;
-
-	if (isquote(bp->line))
+	if (bp->quoted)
 	    ++count_quoted;
 	++count_lines;
-	bp = bp->next;
     }
+    if (run)
+	count_quote_run(run, NULL);
     if (!count_lines)
 	return 0;
     return (int)(100 * count_quoted / (float)count_lines);
 }
+
+/*
+** isquote() of a line of a body, from analyze_body() if it has been
+** there.
+*/
+
+int body_isquote(const struct body *bp)
+{
+    return bp->analyzed ? bp->quoted : isquote(bp->line);
+}
+
+/*
+** The number of quoted lines from this one on.
+*/
+
+int body_quote_run(const struct body *bp)
+{
+    int count = 0;
+
+    if (bp && bp->analyzed)
+	return bp->quote_run;
+    while (bp && isquote(bp->line)) {
+	++count;
+	bp = bp->next;
+    }
+    return count;
+}
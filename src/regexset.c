@@ -0,0 +1,482 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+/*
+** Matching a line against a whole list of regular expressions.
+**
+** The filter options are checked against every header, and the
+** full_body ones against every line of every message, so each list is
+** compiled once into a regex_set: the patterns themselves, JIT
+** compiled when PCRE supports it, and an Aho-Corasick automaton over
+** the literal text each pattern can't match without. One pass of the
+** automaton over a line tells which patterns could possibly match it,
+** and only those are handed to pcre_exec(). For the usual filters,
+** that is none of them for almost every line.
+*/
+
+#include "hypermail.h"
+#include "setup.h"
+#include "regexset.h"
+
+#ifdef __LCC__
+#include "../lcc/pcre.h"
+#else
+#include <pcre.h>
+#endif
+
+#ifndef PCRE_STUDY_JIT_COMPILE
+#define PCRE_STUDY_JIT_COMPILE 0
+#endif
+
+struct regex_set {
+    struct hmlist *list;	/* the option the set was built from */
+    int count;
+    pcre **code;
+    pcre_extra **extra;
+    bool *always;		/* no required literal, always run */
+    unsigned *seen;		/* == stamp: a literal was found */
+    unsigned stamp;
+
+    /* the automaton: state 0 is the root */
+    int nstates;
+    int *delta;			/* nstates * 256 transitions */
+    int *output;		/* first pattern ending in a state, or -1 */
+    int *dict;			/* next state with output on the fail chain */
+    int *next_output;		/* per pattern: next one ending there */
+
+    struct regex_set *next;
+};
+
+static struct regex_set *sets;
+
+#ifdef PCRE_CONFIG_JIT
+static pcre_jit_stack *jit_stack;
+#endif
+
+/*
+** Returns the longest run of plain characters that every match of re
+** has to contain, or NULL if there's none we can be sure about. This
+** errs on the side of giving up: alternatives, inline options and
+** escapes with arguments all make the whole pattern a candidate for
+** every line.
+*/
+
+static int quantifier_min(const char *s, int *len)
+{
+    const char *p = s + 1;
+    int min = 0;
+
+    if (!isdigit((unsigned char)*p))
+	return -1;
+    while (isdigit((unsigned char)*p))
+	min = min * 10 + (*p++ - '0');
+    if (*p == ',')
+	while (isdigit((unsigned char)*++p))
+	    ;
+    if (*p != '}')
+	return -1;
+    *len = p - s + 1;
+    return min;
+}
+
+static const char *skip_class(const char *p)
+{
+    /* p points at the '[' */
+    ++p;
+    if (*p == '^')
+	++p;
+    if (*p == ']')
+	++p;
+    while (*p && *p != ']') {
+	if (*p == '\\' && p[1])
+	    p += 2;
+	else if (*p == '[' && p[1] == ':') {
+	    const char *end = strstr(p + 2, ":]");
+	    if (!end)
+		return NULL;
+	    p = end + 2;
+	}
+	else
+	    ++p;
+    }
+    return *p ? p + 1 : NULL;
+}
+
+static const char *skip_group(const char *p)
+{
+    int depth = 0;
+
+    /* p points at the '(' */
+    while (*p) {
+	if (*p == '\\' && p[1])
+	    p += 2;
+	else if (*p == '[') {
+	    if ((p = skip_class(p)) == NULL)
+		return NULL;
+	}
+	else {
+	    if (*p == '(')
+		++depth;
+	    else if (*p == ')' && --depth == 0)
+		return p + 1;
+	    ++p;
+	}
+    }
+    return NULL;
+}
+
+static char *required_literal(const char *re)
+{
+    char *cur = (char *)emalloc(strlen(re) + 1);
+    char *best = NULL;
+    int curlen = 0, bestlen = 0;
+    bool last_literal = FALSE;
+    const char *p = re;
+
+    if (strstr(re, "(?")) {
+	free(cur);
+	return NULL;
+    }
+
+#define FLUSH() do { if (curlen > bestlen) { \
+	    if (!best) best = (char *)emalloc(strlen(re) + 1); \
+	    memcpy(best, cur, curlen); bestlen = curlen; } \
+	curlen = 0; last_literal = FALSE; } while (0)
+
+    while (*p) {
+	int qlen;
+	int min;
+
+	switch (*p) {
+	case '\\':
+	    if (!p[1] || p[1] == 'Q')
+		goto give_up;
+	    if (isalnum((unsigned char)p[1])) {
+		/* only the escapes that stand for one character class */
+		if (!strchr("dDsSwWbBAzZGhHvVRXntrefa", p[1]))
+		    goto give_up;
+		FLUSH();
+	    }
+	    else {
+		cur[curlen++] = p[1];
+		last_literal = TRUE;
+	    }
+	    p += 2;
+	    break;
+	case '.':
+	case '^':
+	case '$':
+	    FLUSH();
+	    ++p;
+	    break;
+	case '[':
+	    FLUSH();
+	    if ((p = skip_class(p)) == NULL)
+		goto give_up;
+	    break;
+	case '(':
+	    FLUSH();
+	    if ((p = skip_group(p)) == NULL)
+		goto give_up;
+	    break;
+	case ')':
+	case '|':
+	    goto give_up;
+	case '*':
+	case '?':
+	    /* the previous atom is optional */
+	    if (last_literal)
+		--curlen;
+	    FLUSH();
+	    ++p;
+	    if (*p == '?' || *p == '+')
+		++p;
+	    break;
+	case '+':
+	    FLUSH();
+	    ++p;
+	    if (*p == '?' || *p == '+')
+		++p;
+	    break;
+	case '{':
+	    if ((min = quantifier_min(p, &qlen)) != -1) {
+		if (min == 0 && last_literal)
+		    --curlen;
+		FLUSH();
+		p += qlen;
+		if (*p == '?' || *p == '+')
+		    ++p;
+		break;
+	    }
+	    /* not a quantifier, so a plain '{' */
+	    /* fall through */
+	default:
+	    cur[curlen++] = *p++;
+	    last_literal = TRUE;
+	    break;
+	}
+    }
+    FLUSH();
+#undef FLUSH
+    free(cur);
+    if (best)
+	best[bestlen] = '\0';
+    return best;
+
+  give_up:
+    free(cur);
+    if (best)
+	free(best);
+    return NULL;
+}
+
+/*
+** Builds the automaton over the literals of a set; literals[i] is
+** NULL for the patterns that have none.
+*/
+
+static void build_automaton(struct regex_set *set, char **literals)
+{
+    int total = 1, i, c;
+    int *fail, *queue;
+    int head = 0, tail = 0;
+
+    for (i = 0; i < set->count; i++)
+	if (literals[i])
+	    total += strlen(literals[i]);
+
+    set->delta = (int *)emalloc(total * 256 * sizeof(int));
+    set->output = (int *)emalloc(total * sizeof(int));
+    set->dict = (int *)emalloc(total * sizeof(int));
+    set->next_output = (int *)emalloc(set->count * sizeof(int));
+    fail = (int *)emalloc(total * sizeof(int));
+    queue = (int *)emalloc(total * sizeof(int));
+
+    for (i = 0; i < total * 256; i++)
+	set->delta[i] = -1;
+    set->output[0] = -1;
+    set->nstates = 1;
+
+    /* the trie */
+    for (i = 0; i < set->count; i++) {
+	const unsigned char *lp = (const unsigned char *)literals[i];
+	int state = 0;
+
+	set->next_output[i] = -1;
+	if (!lp)
+	    continue;
+	for (; *lp; lp++) {
+	    int *t = &set->delta[state * 256 + *lp];
+	    if (*t == -1) {
+		*t = set->nstates;
+		set->output[set->nstates] = -1;
+		++set->nstates;
+	    }
+	    state = *t;
+	}
+	/* keep the outputs of a state in pattern order */
+	if (set->output[state] == -1)
+	    set->output[state] = i;
+	else {
+	    int k = set->output[state];
+	    while (set->next_output[k] != -1)
+		k = set->next_output[k];
+	    set->next_output[k] = i;
+	}
+    }
+
+    /* fail links, breadth first, turning the trie into a full DFA */
+    fail[0] = 0;
+    set->dict[0] = -1;
+    for (c = 0; c < 256; c++) {
+	int *t = &set->delta[c];
+	if (*t == -1)
+	    *t = 0;
+	else {
+	    fail[*t] = 0;
+	    set->dict[*t] = -1;
+	    queue[tail++] = *t;
+	}
+    }
+    while (head < tail) {
+	int state = queue[head++];
+
+	for (c = 0; c < 256; c++) {
+	    int *t = &set->delta[state * 256 + c];
+	    int f = set->delta[fail[state] * 256 + c];
+	    if (*t == -1)
+		*t = f;
+	    else {
+		fail[*t] = f;
+		set->dict[*t] = set->output[f] != -1 ? f : set->dict[f];
+		queue[tail++] = *t;
+	    }
+	}
+    }
+    free(fail);
+    free(queue);
+}
+
+static struct regex_set *regex_set_of(struct hmlist *list)
+{
+    struct regex_set *set;
+    struct hmlist *tlist;
+    char **literals;
+    int i;
+
+    for (set = sets; set != NULL; set = set->next)
+	if (set->list == list)
+	    return set;
+
+    set = (struct regex_set *)emalloc(sizeof(struct regex_set));
+    memset(set, 0, sizeof(struct regex_set));
+    set->list = list;
+    for (tlist = list; tlist != NULL; tlist = tlist->next)
+	++set->count;
+    set->code = (pcre **)emalloc(set->count * sizeof(pcre *));
+    set->extra = (pcre_extra **)emalloc(set->count * sizeof(pcre_extra *));
+    set->always = (bool *)emalloc(set->count * sizeof(bool));
+    set->seen = (unsigned *)emalloc(set->count * sizeof(unsigned));
+    literals = (char **)emalloc(set->count * sizeof(char *));
+
+#ifdef PCRE_CONFIG_JIT
+    if (!jit_stack)
+	jit_stack = pcre_jit_stack_alloc(32 * 1024, 1024 * 1024);
+#endif
+
+    for (i = 0, tlist = list; tlist != NULL; i++, tlist = tlist->next) {
+	const char *errptr;
+	int epos;
+
+	set->code[i] = pcre_compile(tlist->val, 0, &errptr, &epos, NULL);
+	if (!set->code[i]) {
+	    snprintf(errmsg, sizeof(errmsg), "Error at position %d of regular expression '%s': %s", epos, tlist->val, errptr);
+	    progerr(errmsg);
+	}
+	set->extra[i] = pcre_study(set->code[i], PCRE_STUDY_JIT_COMPILE, &errptr);
+	if (errptr) {
+	    snprintf(errmsg, sizeof(errmsg), "Error studying regular expression '%s': %s", tlist->val, errptr);
+	    progerr(errmsg);
+	}
+#ifdef PCRE_CONFIG_JIT
+	if (set->extra[i] && jit_stack)
+	    pcre_assign_jit_stack(set->extra[i], NULL, jit_stack);
+#endif
+	literals[i] = required_literal(tlist->val);
+	set->always[i] = (literals[i] == NULL);
+	set->seen[i] = 0;
+    }
+
+    build_automaton(set, literals);
+    for (i = 0; i < set->count; i++)
+	if (literals[i])
+	    free(literals[i]);
+    free(literals);
+
+    set->next = sets;
+    sets = set;
+    return set;
+}
+
+/*
+** Runs the automaton over str and marks the patterns whose literal it
+** contains.
+*/
+
+static void regex_set_scan(struct regex_set *set, const char *str, int len)
+{
+    const unsigned char *s = (const unsigned char *)str;
+    const unsigned char *end = s + len;
+    const int *delta = set->delta;
+    int state = 0;
+
+    if (++set->stamp == 0) {	/* wrapped around, start over */
+	memset(set->seen, 0, set->count * sizeof(unsigned));
+	set->stamp = 1;
+    }
+    if (set->nstates == 1)
+	return;
+    while (s < end) {
+	int found;
+
+	state = delta[state * 256 + *s++];
+	for (found = set->output[state] != -1 ? state : set->dict[state];
+	     found != -1; found = set->dict[found]) {
+	    int k;
+	    for (k = set->output[found]; k != -1; k = set->next_output[k])
+		set->seen[k] = set->stamp;
+	}
+    }
+}
+
+#define CANDIDATE(set, i) ((set)->always[i] || (set)->seen[i] == (set)->stamp)
+
+/*
+** Builds the set for list ahead of its first use.
+*/
+
+void regex_prepare(struct hmlist *list)
+{
+    if (list)
+	regex_set_of(list);
+}
+
+/*
+** Returns the position of the first pattern in list that matches str,
+** of length len, or -1.
+*/
+
+int regex_first(struct hmlist *list, const char *str, int len)
+{
+    struct regex_set *set;
+    int i;
+
+    if (list == NULL)
+	return -1;
+    set = regex_set_of(list);
+    regex_set_scan(set, str, len);
+    for (i = 0; i < set->count; i++)
+	if (CANDIDATE(set, i)
+	    && pcre_exec(set->code[i], set->extra[i], str, len, 0, 0,
+			 NULL, 0) >= 0)
+	    return i;
+    return -1;
+}
+
+/*
+** Sets matched[i] for every pattern i in list that matches str, of
+** length len. Patterns already marked aren't tried again. Returns the
+** number of patterns marked by this call.
+*/
+
+int regex_all(struct hmlist *list, const char *str, int len, bool *matched)
+{
+    struct regex_set *set;
+    int i, count = 0;
+
+    if (list == NULL)
+	return 0;
+    set = regex_set_of(list);
+    regex_set_scan(set, str, len);
+    for (i = 0; i < set->count; i++)
+	if (!matched[i] && CANDIDATE(set, i)
+	    && pcre_exec(set->code[i], set->extra[i], str, len, 0, 0,
+			 NULL, 0) >= 0) {
+	    matched[i] = TRUE;
+	    ++count;
+	}
+    return count;
+}
@@ -0,0 +1,7 @@
+/*
+** regexset.c functions
+*/
+
+void regex_prepare(struct hmlist *);
+int regex_first(struct hmlist *, const char *, int);
+int regex_all(struct hmlist *, const char *, int, bool *);
@@ -25,6 +25,7 @@
 #include "struct.h"
 #include "print.h"
 #include "search.h"
+#include "stats.h"
 
 static int bigram_count = 0;
 static struct reply *replylist_tmp;
@@ -693,6 +694,10 @@ static void check_match(struct bigram_list *bigram, struct body *bp, char *ptr,
 ** Find the best match for a line from the bodies of prior messages  
 */
 
+static int count_tokens = 0;
+static int count_matches = 0;
+static int count_searched = 0;
+
 int search_for_quote(char *search_line, char *exact_line, int max_msgnum, String_Match * match_info)
 {
     char *ptr = search_line;
@@ -700,9 +705,6 @@ int search_for_quote(char *search_line, char *exact_line, int max_msgnum, String
     int last_itok = 0;
     int search_len = strlen(search_line);
 	const char *stop_ptr = search_line + (search_len >= 80 ? 40 : (search_len + 1) / 2);
-    static int count_tokens = 0;
-    static int count_matches = 0;
-    static int count_searched = 0;
     const char *match_start_ptr = ptr;
     const char *next_match_start_ptr;
     char *next_exact_ptr;
@@ -770,3 +772,21 @@ int search_for_quote(char *search_line, char *exact_line, int max_msgnum, String
     match_info->msgnum = -1;
     return FALSE;
 }
+
+/*
+** Hands the sizes of the token and bigram indexes, and how much the
+** quote search used them, to --stats.
+*/
+
+void search_stats(void)
+{
+    if (!bigram_count)
+	return;
+    stats_count("bigrams", bigram_count);
+    stats_count("search_tokens", next_itoken - 1);
+    stats_count("token_tree_inserts", b_times_entered);
+    stats_count("token_tree_steps", b_loops_done);
+    stats_count("quote_searches", count_searched);
+    stats_count("quote_search_tokens", count_tokens);
+    stats_count("quote_search_candidates", count_matches);
+}
@@ -16,5 +16,6 @@ struct body *tokenize_body(struct body *bp, char *token, char **ptr,
 			   int *bigram_index, int ignore);
 void analyze_headers(int amount_new);
 void set_alt_replylist(struct reply *r);
+void search_stats(void);
 
 #endif				/* SEARCH_H_INCLUDED */
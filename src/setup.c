@@ -13,6 +13,7 @@
 #include "setup.h"
 #include "struct.h"
 #include "print.h"
+#include "compress.h"
 
 char *set_fragment_prefix;
 char *set_antispam_at;
@@ -49,6 +50,7 @@ int set_show_msg_links;
 int set_show_index_links;
 bool set_usetable;
 bool set_indextable;
+bool set_sort_fold_unicode;
 bool set_iquotes;
 bool set_eurodate;
 bool set_gmtime;
@@ -86,6 +88,11 @@ int set_thrdlevels;
 int set_dirmode;
 int set_filemode;
 
+bool set_compress_output_only;
+int set_compress_threads;
+bool set_sync_output;
+bool set_skip_unchanged_pages;
+
 int set_locktime;
 
 int set_searchbackmsgnum;
@@ -128,6 +135,7 @@ struct hmlist *set_avoid_indices = NULL;
 struct hmlist *set_avoid_top_indices = NULL;
 struct hmlist *set_filter_out = NULL;
 struct hmlist *set_filter_require = NULL;
+struct hmlist *set_compress_output = NULL;
 struct hmlist *set_filter_out_full_body = NULL;
 struct hmlist *set_filter_require_full_body = NULL;
 struct hmlist *set_applemail_ua_value;
@@ -146,12 +154,14 @@ char *set_mhtmlfooter;
 char *set_attachmentlink;
 char *set_unsafe_chars;
 char *set_filename_base;
+char *set_attachment_store;
 
 char *set_folder_by_date;
 char *set_latest_folder;
 char *set_base_url;
 char *set_describe_folder;
 int set_msgsperfolder;
+int set_msgsperindexpage;
 
 bool set_iso2022jp;
 
@@ -356,6 +366,11 @@ struct Config cfg[] = {
      "# message index Subject/Author/Date listings using a nice table\n"
      "# format. Set to Off if you want the original Hypermail index look.\n", FALSE},
 
+    {"sort_fold_unicode", &set_sort_fold_unicode, BFALSE, CFG_SWITCH,
+     "# Set this to On to have the author and subject indexes ignore the\n"
+     "# case of accented Latin, Greek and Cyrillic letters in UTF-8\n"
+     "# names and subjects, not only that of ASCII letters.\n", FALSE},
+
     {"iquotes", &set_iquotes, BTRUE, CFG_SWITCH,
      "# Set this to On to italicize quoted lines.\n", FALSE},
 
@@ -437,6 +452,28 @@ struct Config cfg[] = {
      "# This is an octal number representing the file permissions\n"
      "# that new files are set to when they are created.\n", FALSE},
 
+    {"compress_output", &set_compress_output, NULL, CFG_LIST,
+     "# Write a precompressed copy of every generated page next to it,\n"
+     "# for web servers that can send those directly. Values are\n"
+     "# gzip (page.html.gz) and brotli (page.html.br).\n", FALSE},
+
+    {"compress_output_only", &set_compress_output_only, BFALSE, CFG_SWITCH,
+     "# Set this to On to keep only the compressed copies of the pages\n"
+     "# requested by compress_output. Can't be used with incremental\n"
+     "# updates, as hypermail needs to read back its own pages.\n", FALSE},
+
+    {"compress_threads", &set_compress_threads, INT(0), CFG_INTEGER,
+     "# Number of threads used to compress the pages. 0 means one per\n"
+     "# online CPU.\n", FALSE},
+
+    {"sync_output", &set_sync_output, BFALSE, CFG_SWITCH,
+     "# Set this to On to flush the pages written during the run to\n"
+     "# disk before hypermail exits.\n", FALSE},
+
+    {"skip_unchanged_pages", &set_skip_unchanged_pages, BFALSE, CFG_SWITCH,
+     "# Set this to On to leave alone the pages that would be rewritten\n"
+     "# with the same contents, apart from the archive generation date.\n", FALSE},
+
     {"mailcommand", &set_mailcommand, MAILCOMMAND, CFG_STRING,
      "# This specifies the mail command to use when converting\n"
      "# email addresses to links. The variables $TO, $SUBJECT,\n"
@@ -588,7 +625,7 @@ struct Config cfg[] = {
 
     {"locktime", &set_locktime, INT(3600), CFG_INTEGER,
      "# Specify number of seconds to wait for a lock before we\n"
-     "# override it! .\n", FALSE},
+     "# give up.\n", FALSE},
 
     {"dateformat", &set_dateformat, NULL, CFG_STRING,
      "# Format (see strftime(3)) for displaying dates.\n", FALSE},
@@ -710,6 +747,14 @@ struct Config cfg[] = {
      "# html files. Deleted/expired messages ARE COUNTED for the purpose\n"
      "# of deciding how many messages to put in a subdirectory.\n", FALSE},
 
+    {"msgsperindexpage", &set_msgsperindexpage, INT(0), CFG_INTEGER,
+     "# Split the date, thread, subject and author indexes at the top of\n"
+     "# the archive into pages of this many messages, by message number\n"
+     "# (for the thread index, that of the first message of the thread),\n"
+     "# each sorted as the index is and linked to the pages before and\n"
+     "# after it. The indexes themselves are then copies of their last\n"
+     "# page. 0 writes a single page.\n", FALSE},
+
     {"describe_folder", &set_describe_folder, NULL, CFG_STRING,
      "# Controls the labels used in folders.html to describe the\n"
      "# directories created by the folder_by_date or msgsperfolder\n"
@@ -912,6 +957,11 @@ struct Config cfg[] = {
      "# option is set to plus a file name extension if one can be found\n"
      "# in the name supplied by the message. This option is mainly for\n"
      "# languages that use different character sets from English.\n", FALSE},
+
+    {"attachment_store", &set_attachment_store, NULL, CFG_STRING,
+     "# Store each distinct attachment only once, in the att-store\n"
+     "# directory, and make the attachment files of the messages links\n"
+     "# to it. Set to hardlink or symlink.\n", FALSE},
 };
 
 /* ---------------------------------------------------------------- */
@@ -1110,6 +1160,46 @@ void PostConfig(void)
 	printf("Warning: the body option has been disabled. See the\n"
 	       "INSTALL file for instructions on replacing it with a style sheet.\n");
 
+    if (set_compress_output) {
+	struct hmlist *hl;
+	for (hl = set_compress_output; hl != NULL; hl = hl->next) {
+	    switch (compress_format(hl->val)) {
+	    case COMPRESS_GZIP:
+#ifndef HAVE_LIBZ
+		printf("Error: compress_output=%s needs hypermail to be built with zlib.\n", hl->val);
+		exit(0);
+#endif
+		break;
+	    case COMPRESS_BROTLI:
+#ifndef HAVE_BROTLI
+		printf("Error: compress_output=%s needs hypermail to be built with brotli.\n", hl->val);
+		exit(0);
+#endif
+		break;
+	    default:
+		printf("Error: unknown compress_output format \"%s\".\n", hl->val);
+		exit(0);
+	    }
+	}
+    }
+    else if (set_compress_output_only) {
+	printf("Warning: the compress_output_only option will be ignored as\n"
+	       "compress_output is not set.\n");
+	set_compress_output_only = 0;
+    }
+
+    if (set_attachment_store) {
+	if (!*set_attachment_store) {
+	    free(set_attachment_store);
+	    set_attachment_store = NULL;
+	}
+	else if (strcmp(set_attachment_store, "hardlink")
+		 && strcmp(set_attachment_store, "symlink")) {
+	    printf("Error: attachment_store must be hardlink or symlink.\n");
+	    exit(0);
+	}
+    }
+
     if (set_save_alts < 0 || set_save_alts > 2) {
         printf("Error: save_alts option value must be between 0 and 2.\n");
         exit(0);
@@ -1362,6 +1452,11 @@ void dump_config(void)
     printf("set_readone = %d\n",set_readone);
     printf("set_reverse = %d\n",set_reverse);
     printf("set_showprogress = %d\n",set_showprogress);
+    printf("set_compress_output_only = %d\n",set_compress_output_only);
+    printf("set_attachment_store = %s\n",set_attachment_store ? set_attachment_store : "Not used");
+    printf("set_compress_threads = %d\n",set_compress_threads);
+    printf("set_sync_output = %d\n",set_sync_output);
+    printf("set_skip_unchanged_pages = %d\n",set_skip_unchanged_pages);
     printf("set_showheaders = %d\n",set_showheaders);
     printf("set_showhtml = %d\n",set_showhtml);
     printf("set_showbr = %d\n",set_showbr);
@@ -1370,6 +1465,7 @@ void dump_config(void)
     printf("set_show_msg_links = %d\n",set_show_msg_links);
     printf("set_usetable = %d\n",set_usetable);
     printf("set_indextable = %d\n",set_indextable);
+    printf("set_sort_fold_unicode = %d\n",set_sort_fold_unicode);
     printf("set_iquotes = %d\n",set_iquotes);
     printf("set_eurodate = %d\n",set_eurodate);
     printf("set_isodate = %d\n",set_isodate);
@@ -1397,6 +1493,7 @@ void dump_config(void)
     printf("set_monthly_index = %d\n",set_monthly_index);
     printf("set_yearly_index = %d\n",set_yearly_index);
     printf("set_msgsperfolder = %d\n",set_msgsperfolder);
+    printf("set_msgsperindexpage = %d\n",set_msgsperindexpage);
     printf("set_iso2022jp = %d\n",set_iso2022jp);
     printf("set_delete_incremental = %d\n",set_delete_incremental);
     printf("set_delete_level = %d\n",set_delete_level);
@@ -1481,6 +1578,7 @@ void dump_config(void)
     print_list("set_show_headers", set_show_headers);
     print_list("set_avoid_top_indices", set_avoid_top_indices);
     print_list("set_avoid_indices", set_avoid_indices);
+    print_list("set_compress_output", set_compress_output);
     print_list("set_annotated", set_annotated);
     print_list("set_deleted", set_deleted);
     print_list("set_expires", set_expires);
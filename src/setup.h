@@ -68,6 +68,7 @@ extern int set_show_msg_links;
 extern int set_show_index_links;
 extern bool set_usetable;
 extern bool set_indextable;
+extern bool set_sort_fold_unicode;
 extern bool set_iquotes;
 extern bool set_eurodate;
 extern bool set_gmtime;
@@ -104,6 +105,10 @@ extern int set_showhtml;
 extern int set_thrdlevels;
 extern int set_dirmode;
 extern int set_filemode;
+extern bool set_compress_output_only;
+extern int set_compress_threads;
+extern bool set_sync_output;
+extern bool set_skip_unchanged_pages;
 extern int set_locktime;
 extern int set_searchbackmsgnum;
 extern int set_quote_hide_threshold;
@@ -143,6 +148,7 @@ extern struct hmlist *set_avoid_indices;
 extern struct hmlist *set_avoid_top_indices;
 extern struct hmlist *set_filter_out;
 extern struct hmlist *set_filter_require;
+extern struct hmlist *set_compress_output;
 extern struct hmlist *set_filter_out_full_body;
 extern struct hmlist *set_filter_require_full_body;
 extern struct hmlist *set_applemail_ua_value;
@@ -162,6 +168,7 @@ extern char *set_mhtmlfooter;
 extern char *set_attachmentlink;
 extern char *set_unsafe_chars;
 extern char *set_filename_base;
+extern char *set_attachment_store;
 extern bool set_linkquotes;
 
 extern char *set_antispamdomain;
@@ -170,6 +177,7 @@ extern char *set_folder_by_date;
 extern char *set_latest_folder;
 extern char *set_base_url;
 extern int set_msgsperfolder;
+extern int set_msgsperindexpage;
 extern char *set_describe_folder;
 
 extern bool set_iso2022jp;
@@ -0,0 +1,528 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+
+/*
+** Where each message came from: the mailbox it was read from and where
+** in it, and with the append option where it is in the archive's own
+** mailbox. That is kept in the archive, so that a later run can read an
+** old message straight from its mailbox with a single pread() instead
+** of piecing it together again from the HTML page.
+**
+** parsemail() calls source_begin() when it opens the mailboxes,
+** source_boundary() where a message ends and source_set() once it knows
+** which message that was.
+*/
+
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "hypermail.h"
+#include "setup.h"
+#include "struct.h"
+#include "parse.h"
+#include "output.h"
+#include "base64.h"
+#include "source.h"
+
+#define SOURCES_HEADER "# hypermail message sources 1\n"
+
+/* messages bigger than this are left to the HTML pages */
+#define MAX_SOURCE_LENGTH (16 * 1024 * 1024)
+
+struct source_pos {
+    int file;			/* in files[], or -1 */
+    long offset;
+    long length;
+};
+
+struct message_source {
+    struct source_pos in;	/* the mailbox it was read from */
+    struct source_pos app;	/* the append option's mailbox */
+};
+
+static struct message_source *sources;	/* by message number */
+static int nsources;
+
+static char **files;		/* absolute names of the mailboxes */
+static int *fds;		/* and their descriptors, or -1 */
+static int nfiles;
+
+/* the mailboxes parsemail() is reading, and the message it's in */
+static int cur_in = -1, cur_app = -1;
+static long start_in, start_app, end_in, end_app;
+
+static int file_index(const char *name)
+{
+    int i;
+
+    for (i = 0; i < nfiles; i++)
+	if (!strcmp(files[i], name))
+	    return i;
+    files = (char **)realloc(files, (nfiles + 1) * sizeof(char *));
+    fds = (int *)realloc(fds, (nfiles + 1) * sizeof(int));
+    if (!files || !fds)
+	progerr("source: out of memory");
+    files[nfiles] = strsav(name);
+    fds[nfiles] = -1;
+    return nfiles++;
+}
+
+/*
+** The index of a mailbox parsemail() opened, or -1 when it can't be
+** read again later: stdin, a pipe, or a file it can't tell the offsets
+** in.
+*/
+
+static int mailbox_index(const char *name, FILE *fp)
+{
+    struct stat st;
+    char *path;
+    char cwd[MAXFILELEN];
+    int i;
+
+    if (name == NULL || fp == NULL || fstat(fileno(fp), &st)
+	|| !S_ISREG(st.st_mode) || fseek(fp, 0L, SEEK_CUR))
+	return -1;
+    if (*name == PATH_SEPARATOR || !getcwd(cwd, sizeof(cwd)))
+	return file_index(name);
+    trio_asprintf(&path, "%s%c%s", cwd, PATH_SEPARATOR, name);
+    i = file_index(path);
+    free(path);
+    return i;
+}
+
+static struct message_source *source_of(int num)
+{
+    if (num < 0)
+	return NULL;
+    if (num >= nsources) {
+	int n = nsources ? nsources : 1024, i;
+
+	while (n <= num)
+	    n *= 2;
+	sources = (struct message_source *)
+	    realloc(sources, n * sizeof(struct message_source));
+	if (!sources)
+	    progerr("source: out of memory");
+	for (i = nsources; i < n; i++)
+	    sources[i].in.file = sources[i].app.file = -1;
+	nsources = n;
+    }
+    return &sources[num];
+}
+
+/*
+** parsemail() is about to read mailbox from fp, and with the append
+** option to write it to appendname through fpo.
+*/
+
+void source_begin(const char *mailbox, FILE *fp, const char *appendname,
+		  FILE *fpo)
+{
+    cur_in = (fp != stdin) ? mailbox_index(mailbox, fp) : -1;
+    cur_app = -1;
+    if (fpo && !fseek(fpo, 0L, SEEK_END))
+	cur_app = mailbox_index(appendname, fpo);
+    start_in = cur_in != -1 ? ftell(fp) : 0;
+    start_app = cur_app != -1 ? ftell(fpo) : 0;
+    end_in = start_in;
+    end_app = start_app;
+}
+
+/*
+** The message being read ends pending bytes before the current
+** positions of fp and fpo, which is where the next one starts.
+*/
+
+void source_boundary(FILE *fp, FILE *fpo, int pending)
+{
+    if (cur_in != -1)
+	end_in = ftell(fp) - pending;
+    if (cur_app != -1)
+	end_app = ftell(fpo) - pending;
+}
+
+/*
+** The message that ended at the last source_boundary() is emp, or was
+** dropped if emp is NULL.
+*/
+
+void source_set(struct emailinfo *emp)
+{
+    struct message_source *sp = emp ? source_of(emp->msgnum) : NULL;
+
+    if (sp) {
+	sp->in.file = (cur_in != -1 && end_in > start_in) ? cur_in : -1;
+	sp->in.offset = start_in;
+	sp->in.length = end_in - start_in;
+	sp->app.file = (cur_app != -1 && end_app > start_app) ? cur_app : -1;
+	sp->app.offset = start_app;
+	sp->app.length = end_app - start_app;
+    }
+    start_in = end_in;
+    start_app = end_app;
+}
+
+static char *read_pos(struct source_pos *pos)
+{
+    char *buf;
+
+    if (pos->file < 0 || pos->length <= 0 || pos->length > MAX_SOURCE_LENGTH)
+	return NULL;
+    if (fds[pos->file] == -1)
+	fds[pos->file] = open(files[pos->file], O_RDONLY);
+    if (fds[pos->file] == -1)
+	return NULL;
+    buf = (char *)emalloc(pos->length + 1);
+    if (pread(fds[pos->file], buf, pos->length, pos->offset)
+	!= pos->length || strncmp(buf, "From ", 5)) {
+	free(buf);
+	return NULL;
+    }
+    buf[pos->length] = '\0';
+    return buf;
+}
+
+/*
+** Finds the empty line that ends the header in buf, with LF or CRLF
+** line ends. Returns NULL if there is none.
+*/
+
+static char *header_end(char *buf)
+{
+    char *p;
+
+    for (p = buf; (p = strchr(p, '\n')) != NULL;) {
+	++p;
+	if (*p == '\n' || (*p == '\r' && p[1] == '\n'))
+	    return p;
+    }
+    return NULL;
+}
+
+/*
+** The value of header field in the header that starts at head, with
+** any continuation lines, or NULL.
+*/
+
+static char *header_value(const char *head, const char *field)
+{
+    int len = strlen(field);
+    const char *p;
+
+    for (p = head; *p && *p != '\n'; p = strchr(p, '\n') + 1) {
+	if (!strncasecmp(p, field, len) && p[len] == ':') {
+	    struct Push buff;
+	    const char *q = p + len + 1;
+
+	    INIT_PUSH(buff);
+	    for (;;) {
+		const char *eol = strchr(q, '\n');
+		if (!eol)
+		    eol = q + strlen(q);
+		PushNString(&buff, q, eol - q);
+		if (*eol != '\n' || (eol[1] != ' ' && eol[1] != '\t'))
+		    break;
+		q = eol + 1;
+	    }
+	    RETURN_PUSH(buff);
+	}
+	if (!strchr(p, '\n'))
+	    break;
+    }
+    return NULL;
+}
+
+/*
+** Reads message num as it was in its mailbox, "From " line and all,
+** provided it still is there: its Message-ID has to be msgid. Returns
+** NULL otherwise.
+*/
+
+char *source_read(int num, const char *msgid)
+{
+    struct message_source *sp;
+    struct source_pos *pos[2];
+    int i;
+
+    if (num < 0 || num >= nsources || msgid == NULL || !*msgid)
+	return NULL;
+    sp = &sources[num];
+    pos[0] = &sp->app;		/* the archive's own copy first */
+    pos[1] = &sp->in;
+    for (i = 0; i < 2; i++) {
+	char *buf = read_pos(pos[i]);
+	char *end, *value;
+	char save;
+
+	if (buf == NULL)
+	    continue;
+	if ((end = header_end(buf)) != NULL) {
+	    save = *end;
+	    *end = '\0';
+	    value = header_value(strchr(buf, '\n') + 1, "Message-ID");
+	    *end = save;
+	    if (value) {
+		char *line, *id;
+		int same;
+
+		trio_asprintf(&line, "Message-ID:%s", value);
+		id = getid(line);
+		same = !strcmp(id, msgid);
+		free(id);
+		free(line);
+		free(value);
+		if (same)
+		    return buf;
+	    }
+	}
+	free(buf);
+    }
+    return NULL;
+}
+
+/*
+** Makes the body of message num from its mailbox, the way
+** parse_old_html() would from its page: decoded, but in the message's
+** own charset, as the page has it. That is only done for a plain text
+** message that is still where it was; for anything else this
+** returns NULL, and the caller has to use the page. *inreply gets the
+** message it says it replies to, if it has none yet.
+*/
+
+struct body *source_body(int num, const char *msgid, char **inreply)
+{
+    char *raw = source_read(num, msgid);
+    char *type, *encoding;
+    char *body, *p;
+    struct body *bp = NULL, *lp = NULL;
+    struct Push text;
+    int decode = 0;		/* 1 quoted-printable, 2 base64 */
+
+    if (raw == NULL)
+	return NULL;
+    body = header_end(raw);	/* source_read() found one */
+    p = body + ((*body == '\r') ? 2 : 1);
+    *body = '\0';		/* ends the header */
+    body = p;
+    p = strchr(raw, '\n');	/* after the "From " line */
+    p = p ? p + 1 : raw;
+
+    type = header_value(p, "Content-Type");
+    encoding = header_value(p, "Content-Transfer-Encoding");
+    if (type) {
+	char *t = type;
+	while (isspace((unsigned char)*t))
+	    t++;
+	if (strncasecmp(t, "text/plain", 10)
+	    || (t[10] && t[10] != ';' && !isspace((unsigned char)t[10]))) {
+	    free(type);
+	    if (encoding)
+		free(encoding);
+	    free(raw);
+	    return NULL;
+	}
+	free(type);
+    }
+    if (encoding) {
+	char *e = encoding;
+	while (isspace((unsigned char)*e))
+	    e++;
+	if (!strncasecmp(e, "quoted-printable", 16))
+	    decode = 1;
+	else if (!strncasecmp(e, "base64", 6))
+	    decode = 2;
+	else if (strncasecmp(e, "7bit", 4) && strncasecmp(e, "8bit", 4)
+		 && strncasecmp(e, "binary", 6)) {
+	    free(encoding);
+	    free(raw);
+	    return NULL;
+	}
+	free(encoding);
+    }
+
+    /* decode the body into text, one line at a time */
+    INIT_PUSH(text);
+    for (p = body; *p;) {
+	char *eol = strchr(p, '\n');
+	int len = eol ? eol - p + 1 : (int)strlen(p);
+	char *line = (char *)emalloc(len + 2);
+	char *out = (char *)emalloc(len + 2);
+	int outlen, soft;
+
+	memcpy(line, p, len);
+	line[len] = '\0';
+	p += len;
+	if (decode == 1) {
+	    outlen = qpDecode(line, out, &soft);
+	    PushNString(&text, out, outlen);
+	}
+	else if (decode == 2) {
+	    base64Decode(line, out, &outlen);
+	    PushNString(&text, out, outlen);
+	}
+	else
+	    PushString(&text, line);
+	free(line);
+	free(out);
+    }
+
+    /* and make the body list of its lines */
+    p = PUSH_STRING(text);
+    if (p && *p != '\n')
+	bp = addbody(bp, &lp, "\n", 0);
+    for (; p && *p;) {
+	char *eol = strchr(p, '\n');
+	char save;
+
+	if (eol)
+	    ++eol;
+	else
+	    eol = p + strlen(p);
+	save = *eol;
+	*eol = '\0';
+	bp = addbody(bp, &lp, p, 0);
+	if (inreply && !*inreply) {
+	    char *reply = getreply(p);
+	    if (*reply)
+		*inreply = reply;
+	    else
+		free(reply);
+	}
+	*eol = save;
+	p = eol;
+    }
+    if (!bp)
+	bp = addbody(bp, &lp, "\0", 0);
+    if (PUSH_STRING(text))
+	free(PUSH_STRING(text));
+    free(raw);
+    return bp;
+}
+
+static char *sources_name(char *dir)
+{
+    char *name;
+
+    trio_asprintf(&name, (dir[strlen(dir) - 1] == PATH_SEPARATOR)
+		  ? "%s%s" : "%s/%s", dir, MESSAGE_SOURCES);
+    return name;
+}
+
+/*
+** Reads where the messages already in the archive came from.
+*/
+
+void source_load(char *dir)
+{
+    char *filename = sources_name(dir);
+    FILE *fp = fopen(filename, "r");
+    char line[MAXLINE];
+    int *map = NULL, nmap = 0;
+
+    free(filename);
+    if (fp == NULL)
+	return;
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, SOURCES_HEADER)) {
+	fclose(fp);
+	return;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+	struct message_source *sp;
+	int num, in, app;
+	long in_off, in_len, app_off, app_len;
+
+	if (!strncmp(line, "file\t", 5)) {
+	    char *name = strchr(line + 5, '\t');
+	    int n = atoi(line + 5);
+
+	    if (!name || n < 0 || n > 65536)
+		continue;
+	    name[strcspn(name, "\n")] = '\0';
+	    if (n >= nmap) {
+		map = (int *)realloc(map, (n + 1) * sizeof(int));
+		if (!map)
+		    progerr("source: out of memory");
+		while (nmap <= n)
+		    map[nmap++] = -1;
+	    }
+	    map[n] = file_index(name + 1);
+	    continue;
+	}
+	if (sscanf(line, "%d\t%d\t%ld\t%ld\t%d\t%ld\t%ld", &num, &in,
+		   &in_off, &in_len, &app, &app_off, &app_len) != 7
+	    || !(sp = source_of(num)))
+	    continue;
+	sp->in.file = (in >= 0 && in < nmap) ? map[in] : -1;
+	sp->in.offset = in_off;
+	sp->in.length = in_len;
+	sp->app.file = (app >= 0 && app < nmap) ? map[app] : -1;
+	sp->app.offset = app_off;
+	sp->app.length = app_len;
+    }
+    fclose(fp);
+    if (map)
+	free(map);
+}
+
+/*
+** Saves where the messages came from, or removes the file when none
+** can be read again.
+*/
+
+void source_save(char *dir)
+{
+    char *filename = sources_name(dir);
+    struct Push buff;
+    char numbuf[128];
+    int i, rc, any = 0;
+
+    INIT_PUSH(buff);
+    PushString(&buff, SOURCES_HEADER);
+    for (i = 0; i < nfiles; i++) {
+	sprintf(numbuf, "file\t%d\t", i);
+	PushString(&buff, numbuf);
+	PushString(&buff, files[i]);
+	PushByte(&buff, '\n');
+    }
+    for (i = 0; i < nsources && i <= max_msgnum; i++) {
+	struct message_source *sp = &sources[i];
+
+	if (sp->in.file == -1 && sp->app.file == -1)
+	    continue;
+	sprintf(numbuf, "%d\t%d\t%ld\t%ld\t%d\t%ld\t%ld\n", i,
+		sp->in.file, sp->in.offset, sp->in.length,
+		sp->app.file, sp->app.offset, sp->app.length);
+	PushString(&buff, numbuf);
+	any = 1;
+    }
+    if (!any) {
+	unlink(filename);
+	free(PUSH_STRING(buff));
+	free(filename);
+	return;
+    }
+    rc = output_replace(filename, PUSH_STRING(buff), PUSH_STRLEN(buff),
+			set_filemode);
+    if (rc) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %s.",
+		 lang[MSG_COULD_NOT_WRITE], filename, strerror(rc));
+	progerr(errmsg);
+    }
+    free(PUSH_STRING(buff));
+    free(filename);
+}
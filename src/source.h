@@ -0,0 +1,13 @@
+/*
+** source.c functions
+*/
+
+void source_begin(const char *, FILE *, const char *, FILE *);
+void source_boundary(FILE *, FILE *, int);
+void source_set(struct emailinfo *);
+
+char *source_read(int, const char *);
+struct body *source_body(int, const char *, char **);
+
+void source_load(char *);
+void source_save(char *);
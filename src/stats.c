@@ -0,0 +1,382 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+/*
+** Run statistics, for the --stats command line flag.
+**
+** The main steps of a run are bracketed with stats_begin()/stats_end().
+** Each phase records the wall clock and CPU time spent in it, and the
+** emalloc() calls and bytes read and written meanwhile. Phases nest;
+** beginning a phase that already ran under the same parent adds to it,
+** so per-part work like MIME decoding shows up as one phase with a
+** call count. At the end, stats_report() writes the phases, the
+** counters other modules handed in with stats_count(), and the shape
+** of the main data structures as one JSON object.
+**
+** Everything here is a no-op unless --stats was given. The byte and
+** allocation counters are updated atomically through STATS_ADD(), as
+** the index rendering and compression threads add to them too; a
+** phase still counts whatever those threads did while it ran.
+*/
+
+#include "hypermail.h"
+#include "setup.h"
+#include "stats.h"
+#include "intern.h"
+
+#include <sys/time.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+char *stats_file;
+long stats_allocs;
+long stats_alloc_bytes;
+long stats_read_bytes;
+long stats_written_bytes;
+
+#if defined(HAVE_PTHREAD) && !defined(__ATOMIC_RELAXED)
+#include <pthread.h>
+
+static pthread_mutex_t counter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void stats_add(long *counter, long n)
+{
+    pthread_mutex_lock(&counter_lock);
+    *counter += n;
+    pthread_mutex_unlock(&counter_lock);
+}
+
+long stats_get(long *counter)
+{
+    long value;
+
+    pthread_mutex_lock(&counter_lock);
+    value = *counter;
+    pthread_mutex_unlock(&counter_lock);
+    return value;
+}
+#endif
+
+#define MAX_PHASES  64
+#define MAX_DEPTH   8
+#define MAX_COUNTERS 32
+
+struct phase {
+    const char *name;
+    int parent;			/* index in phases, -1 at the top */
+    int depth;
+    long calls;
+    double wall, cpu;
+    long allocs, alloc_bytes, read_bytes, written_bytes;
+    /* where the current call started */
+    double wall0, cpu0;
+    long allocs0, alloc_bytes0, read_bytes0, written_bytes0;
+};
+
+static struct phase phases[MAX_PHASES];
+static int nphases;
+static int stack[MAX_DEPTH];
+static int depth;
+
+static struct {
+    const char *name;
+    long value;
+} counters[MAX_COUNTERS];
+static int ncounters;
+
+static double start_wall, start_cpu;
+
+static double wall_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double cpu_now(void)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+    struct rusage ru;
+
+    if (!getrusage(RUSAGE_SELF, &ru))
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+	    + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+#endif
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+/*
+** Looks for --stats or --stats=file in the arguments and takes it out,
+** so getopt() never sees it. Without a file name, the statistics go
+** to stderr.
+*/
+
+void stats_args(int *argcp, char **argv)
+{
+    int i, j;
+
+    for (i = 1; i < *argcp; i++) {
+	if (!strcmp(argv[i], "--"))
+	    break;
+	if (!strcmp(argv[i], "--stats") || !strncmp(argv[i], "--stats=", 8)) {
+	    stats_file = argv[i][7] ? argv[i] + 8 : "-";
+	    for (j = i; j < *argcp; j++)
+		argv[j] = argv[j + 1];
+	    --*argcp;
+	    --i;
+	}
+    }
+    if (stats_file) {
+	start_wall = wall_now();
+	start_cpu = cpu_now();
+    }
+}
+
+void stats_begin(const char *name)
+{
+    int parent = depth ? stack[depth - 1] : -1;
+    struct phase *p;
+    int i;
+
+    if (!stats_file)
+	return;
+    if (depth == MAX_DEPTH)
+	progerr("stats: phases nested too deeply");
+    for (i = 0; i < nphases; i++)
+	if (phases[i].parent == parent && !strcmp(phases[i].name, name))
+	    break;
+    if (i == nphases) {
+	if (nphases == MAX_PHASES)
+	    progerr("stats: too many phases");
+	p = &phases[nphases++];
+	memset(p, 0, sizeof(*p));
+	p->name = name;
+	p->parent = parent;
+	p->depth = depth;
+    }
+    p = &phases[i];
+    stack[depth++] = i;
+    ++p->calls;
+    p->wall0 = wall_now();
+    p->cpu0 = cpu_now();
+    p->allocs0 = STATS_GET(stats_allocs);
+    p->alloc_bytes0 = STATS_GET(stats_alloc_bytes);
+    p->read_bytes0 = STATS_GET(stats_read_bytes);
+    p->written_bytes0 = STATS_GET(stats_written_bytes);
+}
+
+void stats_end(const char *name)
+{
+    struct phase *p;
+
+    if (!stats_file)
+	return;
+    p = depth ? &phases[stack[depth - 1]] : NULL;
+    if (!p || strcmp(p->name, name)) {
+	snprintf(errmsg, sizeof(errmsg), "stats: phase \"%s\" ended out of order",
+		 name);
+	progerr(errmsg);
+	return;
+    }
+    --depth;
+    p->wall += wall_now() - p->wall0;
+    p->cpu += cpu_now() - p->cpu0;
+    p->allocs += STATS_GET(stats_allocs) - p->allocs0;
+    p->alloc_bytes += STATS_GET(stats_alloc_bytes) - p->alloc_bytes0;
+    p->read_bytes += STATS_GET(stats_read_bytes) - p->read_bytes0;
+    p->written_bytes += STATS_GET(stats_written_bytes) - p->written_bytes0;
+}
+
+/*
+** Starts the statistics over for a batch job forked from the batch,
+** going to file, or nowhere if that is NULL.
+*/
+
+void stats_restart(char *file)
+{
+    stats_file = file;
+    if (!stats_file)
+	return;
+    nphases = depth = ncounters = 0;
+    stats_allocs = stats_alloc_bytes = 0;
+    stats_read_bytes = stats_written_bytes = 0;
+    start_wall = wall_now();
+    start_cpu = cpu_now();
+}
+
+/*
+** Adds value to the counter name, which must be a string constant.
+*/
+
+void stats_count(const char *name, long value)
+{
+    int i;
+
+    if (!stats_file)
+	return;
+    for (i = 0; i < ncounters; i++)
+	if (!strcmp(counters[i].name, name)) {
+	    counters[i].value += value;
+	    return;
+	}
+    if (ncounters < MAX_COUNTERS) {
+	counters[ncounters].name = name;
+	counters[ncounters++].value = value;
+    }
+}
+
+static void tree_shape(struct header *hp, int level, long *nodes, int *maxdepth)
+{
+    while (hp) {
+	++*nodes;
+	if (level > *maxdepth)
+	    *maxdepth = level;
+	tree_shape(hp->left, level + 1, nodes, maxdepth);
+	hp = hp->right;
+	++level;
+    }
+}
+
+static void print_tree(FILE *fp, const char *name, struct header *hp)
+{
+    long nodes = 0;
+    int maxdepth = 0;
+
+    tree_shape(hp, 1, &nodes, &maxdepth);
+    fprintf(fp, ",\n    \"%s\": {\"nodes\": %ld, \"depth\": %d}", name, nodes,
+	    maxdepth);
+}
+
+static void print_structures(FILE *fp)
+{
+    struct hashemail *hep;
+    struct reply *rp;
+    long entries = 0, used = 0, replies = 0;
+    long strings, lookups, bytes;
+    int i, longest = 0;
+
+    for (i = 0; i < HASHSIZE; i++) {
+	int chain = 0;
+	for (hep = etable[i]; hep != NULL; hep = hep->next)
+	    ++chain;
+	entries += chain;
+	if (chain)
+	    ++used;
+	if (chain > longest)
+	    longest = chain;
+    }
+    fprintf(fp, "  \"structures\": {\n");
+    fprintf(fp, "    \"email_hash\": {\"buckets\": %d, \"entries\": %ld, "
+	    "\"used\": %ld, \"longest_chain\": %d, \"mean_chain\": %.2f}",
+	    HASHSIZE, entries, used, longest,
+	    used ? (double)entries / used : 0.0);
+    print_tree(fp, "date_tree", datelist);
+    print_tree(fp, "subject_tree", subjectlist);
+    print_tree(fp, "author_tree", authorlist);
+    for (rp = replylist; rp != NULL; rp = rp->next)
+	++replies;
+    fprintf(fp, ",\n    \"replies\": %ld", replies);
+    intern_stats(&strings, &lookups, &bytes);
+    fprintf(fp, ",\n    \"interned\": {\"strings\": %ld, \"lookups\": %ld, "
+	    "\"bytes\": %ld}\n  }", strings, lookups, bytes);
+}
+
+static void print_string(FILE *fp, const char *s)
+{
+    putc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(fp, "\\%c", *s);
+	else if ((unsigned char)*s < ' ')
+	    fprintf(fp, "\\u%04x", *s);
+	else
+	    putc(*s, fp);
+    }
+    putc('"', fp);
+}
+
+/*
+** Writes everything as JSON to the --stats file.
+*/
+
+void stats_report(void)
+{
+    FILE *fp;
+    int i;
+#ifdef HAVE_SYS_RESOURCE_H
+    struct rusage ru;
+    long maxrss = getrusage(RUSAGE_SELF, &ru) ? 0 : ru.ru_maxrss;
+#else
+    long maxrss = 0;
+#endif
+
+    if (!stats_file)
+	return;
+    if (!strcmp(stats_file, "-"))
+	fp = stderr;
+    else if ((fp = fopen(stats_file, "w")) == NULL) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\".",
+		 lang[MSG_COULD_NOT_WRITE], stats_file);
+	progerr(errmsg);
+    }
+
+    fprintf(fp, "{\n  \"version\": ");
+    print_string(fp, VERSION);
+    fprintf(fp, ",\n  \"archive\": ");
+    print_string(fp, set_dir ? set_dir : "");
+    fprintf(fp, ",\n  \"messages\": %d,\n", max_msgnum + 1);
+    fprintf(fp, "  \"wall_seconds\": %.6f,\n  \"cpu_seconds\": %.6f,\n",
+	    wall_now() - start_wall, cpu_now() - start_cpu);
+    fprintf(fp, "  \"max_rss_kb\": %ld,\n", maxrss);
+    fprintf(fp, "  \"allocs\": %ld,\n  \"alloc_bytes\": %ld,\n",
+	    STATS_GET(stats_allocs), STATS_GET(stats_alloc_bytes));
+    fprintf(fp, "  \"read_bytes\": %ld,\n  \"written_bytes\": %ld,\n",
+	    STATS_GET(stats_read_bytes), STATS_GET(stats_written_bytes));
+
+    fprintf(fp, "  \"phases\": [");
+    for (i = 0; i < nphases; i++) {
+	struct phase *p = &phases[i];
+	fprintf(fp, "%s\n    {\"name\": ", i ? "," : "");
+	print_string(fp, p->name);
+	fprintf(fp, ", \"parent\": ");
+	if (p->parent == -1)
+	    fprintf(fp, "null");
+	else
+	    print_string(fp, phases[p->parent].name);
+	fprintf(fp, ", \"depth\": %d, \"calls\": %ld, \"wall_seconds\": %.6f, "
+		"\"cpu_seconds\": %.6f, \"allocs\": %ld, \"alloc_bytes\": %ld, "
+		"\"read_bytes\": %ld, \"written_bytes\": %ld}",
+		p->depth, p->calls, p->wall, p->cpu, p->allocs,
+		p->alloc_bytes, p->read_bytes, p->written_bytes);
+    }
+    fprintf(fp, "\n  ],\n");
+
+    fprintf(fp, "  \"counters\": {");
+    for (i = 0; i < ncounters; i++) {
+	fprintf(fp, "%s\n    ", i ? "," : "");
+	print_string(fp, counters[i].name);
+	fprintf(fp, ": %ld", counters[i].value);
+    }
+    fprintf(fp, "\n  },\n");
+
+    print_structures(fp);
+    fprintf(fp, "\n}\n");
+
+    if (fp != stderr)
+	fclose(fp);
+}
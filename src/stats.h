@@ -0,0 +1,35 @@
+/*
+** stats.c functions
+*/
+
+extern char *stats_file;
+extern long stats_allocs;
+extern long stats_alloc_bytes;
+extern long stats_read_bytes;
+extern long stats_written_bytes;
+
+/*
+** The byte and allocation counters are also bumped by the compression
+** workers and the index rendering threads, so they are only touched
+** through these.
+*/
+#if defined(HAVE_PTHREAD) && defined(__ATOMIC_RELAXED)
+#define STATS_ADD(counter, n) \
+	((void)__atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED))
+#define STATS_GET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#elif defined(HAVE_PTHREAD)
+void stats_add(long *, long);
+long stats_get(long *);
+#define STATS_ADD(counter, n) stats_add(&(counter), (n))
+#define STATS_GET(counter) stats_get(&(counter))
+#else
+#define STATS_ADD(counter, n) ((void)((counter) += (n)))
+#define STATS_GET(counter) (counter)
+#endif
+
+void stats_args(int *, char **);
+void stats_restart(char *);
+void stats_begin(const char *);
+void stats_end(const char *);
+void stats_count(const char *, long);
+void stats_report(void);
@@ -663,6 +663,60 @@ void strtolower(char *string)
   }
 }
 
+/*
+** The lower case of an upper case letter from the Latin-1, Latin
+** Extended-A, Greek or Cyrillic blocks, or c itself. The two are always
+** the same length in UTF-8.
+*/
+
+static int fold_letter(int c)
+{
+    if ((c >= 0xc0 && c <= 0xde && c != 0xd7)
+	|| (c >= 0x391 && c <= 0x3a9 && c != 0x3a2)
+	|| (c >= 0x410 && c <= 0x42f))
+	return c + 0x20;
+    if (c >= 0x400 && c <= 0x40f)
+	return c + 0x50;
+    if (c == 0x178)
+	return 0xff;
+    if ((c >= 0x100 && c <= 0x137) || (c >= 0x14a && c <= 0x177))
+	return c | 1;
+    if (((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e))
+	&& (c & 1))
+	return c + 1;
+    return c;
+}
+
+/*
+** The key a name or subject is sorted and grouped by in the indexes:
+** the string with its letters in lower case, so that two keys compare
+** with strcmp() the way the strings do with strcasecmp(). With
+** sort_fold_unicode, the non-ASCII letters fold_letter() knows about
+** are folded too, when the string is UTF-8.
+**
+** Returns an ALLOCATED string.
+*/
+
+char *casefold(const char *string)
+{
+    char *key = strsav(string);
+    unsigned char *p;
+
+    for (p = (unsigned char *)key; *p; p++) {
+	if (set_sort_fold_unicode && *p >= 0xc2 && *p <= 0xdf
+	    && (p[1] & 0xc0) == 0x80) {
+	    int c = fold_letter(((p[0] & 0x1f) << 6) | (p[1] & 0x3f));
+
+	    p[0] = 0xc0 | (c >> 6);
+	    p[1] = 0x80 | (c & 0x3f);
+	    p++;
+	}
+	else if (!set_sort_fold_unicode || *p < 0x80)
+	    *p = tolower(*p);
+    }
+    return key;
+}
+
 #ifndef HAVE_STRCASESTR
 /*
 ** strcasestr() - case insensitive strstr()
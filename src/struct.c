@@ -30,14 +30,12 @@ int rbs_bigtime = 0;
 #include "struct.h"
 #include "parse.h"
 #include "getname.h"
+#include "thread.h"
+#include "intern.h"
 
 #define HAVE_PCRE
 #ifdef HAVE_PCRE
-#ifdef __LCC__
-#include "../lcc/pcre.h"
-#else
-#include <pcre.h>
-#endif
+#include "regexset.h"
 #endif
 
 struct body *hashnumlookup(int, struct emailinfo **);
@@ -68,6 +66,7 @@ void reinit_structs()
 	    etable[i] = NULL;
 	}
     }
+    thread_reset();
 }
 
 void fill_email_dates(struct emailinfo *e, char *date, char *fromdate, char *isodate, char *isofromdate)
@@ -245,11 +244,12 @@ struct emailinfo *addhash(int num, char *date, char *name, char *email, char *ms
     e->msgnum = num;
     if (num > max_msgnum)
         max_msgnum = num;
-    e->emailaddr = strsav(email);
+    /* these repeat a lot, so they are shared; see intern.c */
+    e->emailaddr = intern(email);
     if ((name == NULL) || (*name == '\0'))
-	e->name = strsav(email);
+	e->name = e->emailaddr;
     else
-	e->name = strsav(name);
+	e->name = intern(name);
 
     fill_email_dates(e, date, fromdate, isodate, isofromdate);
     e->subdir = msg_subdir(e->msgnum, set_use_sender_date ? e->date
@@ -261,16 +261,22 @@ struct emailinfo *addhash(int num, char *date, char *name, char *email, char *ms
 	++e->subdir->count;
     }
     e->msgid = strsav(msgid);
-    e->subject = strsav(subject);
-    e->unre_subject = unre(subject);
-    e->inreplyto = strsav(inreply);
-    e->charset = strsav(charset);
+    e->subject = intern(subject);
+    e->unre_subject = intern_free(unre(subject));
+    e->name_key = intern_free(casefold(e->name));
+    e->subject_key = intern_free(casefold(e->unre_subject));
+    e->inreplyto = intern(inreply);
+    e->references = NULL;
+    e->charset = intern(charset);
     e->flags = 0;
     e->is_deleted = 0;
     e->deletion_completed = -1;
     e->exp_time = -1;
     e->bodylist = sp;
     e->initial_next_in_thread = -1;
+    e->attachments = NULL;
+    e->index_row = NULL;
+    e->pagename = NULL;
 
     /* Added by Daniel 1999-03-19, we need this hash later to find the mail
        we replied to */
@@ -308,6 +314,8 @@ struct emailinfo *addhash(int num, char *date, char *name, char *email, char *ms
     h->data = e;
     etable[hashval] = h;
 
+    thread_add_message(e);
+
     return e;			/* the actual mail struct pointer */
 }
 
@@ -455,140 +463,6 @@ struct emailinfo *hashmsgidlookup(char *msgid, int *issubjmatch)
     return NULL;
 }
 
-/*
- * Given an "in-reply-to:" field and a message number, this function
- * retrieves information about the message that this message is a 
- * reply to.
- * If all else fails but a reply is
- * found by comparing subjects, maybereply is set to 1.
-*/
-
-struct emailinfo *hashreplylookup(int msgnum, char *inreply, char *subject, int *maybereply)
-{
-    struct hashemail *ep;
-
-#if DEBUG_THREAD > 1
-	fprintf(stderr, "hashreplynumlookup(%d, '%s'...)\n", msgnum, (inreply == NULL) ? "" : inreply);
-#endif
-    *maybereply = 0;
-
-    if ((inreply != NULL) && *inreply) {
-
-	ep = etable[hash(inreply)];
-	while (ep) {
-	    if (strcmp(inreply, ep->data->msgid) == 0) {
-#if DEBUG_THREAD
-				fprintf(stderr, "match on msgid   %4d %4d\n", msgnum, ep->data->msgnum);
-#endif
-		return ep->data;
-	    }
-	    ep = ep->next;
-	}
-
-	ep = etable[hash(inreply)];
-	while (ep) {
-			if ((msgnum != ep->data->msgnum) && (strstr(inreply, ep->data->datestr))) {
-#if DEBUG_THREAD
-				fprintf(stderr, "match on date    %4d %4d\n", msgnum, ep->data->msgnum);
-#endif
-		return ep->data;
-	    }
-	    ep = ep->next;
-	}
-
-	ep = etable[hash(inreply)];
-	while (ep != NULL) {
-			if ((msgnum != ep->data->msgnum) && (strcmp(inreply, ep->data->subject) == 0)) {
-		*maybereply = 1;
-#if DEBUG_THREAD
-				fprintf(stderr, "match on subject %4d %4d\n", msgnum, ep->data->msgnum);
-#endif
-		return ep->data;
-	    }
-	    ep = ep->next;
-	}
-
-    }				/* end of matching on inreply */
-
-    /* No match so far.  Now try matching on the subject, removing
-     * one instance of "re: " from the front of the subject each
-     * time round the loop.
-     */
-    {
-#define MAX_SUBJ_LEN 300
-
-	char *s, *saved_s;
-	struct emailinfo *lowest_so_far = NULL;
-	int match = 0;
-
-        size_t subj_len;
-
-        subj_len = strlen(subject) > MAX_SUBJ_LEN ? MAX_SUBJ_LEN : strlen(subject);
-        s = emalloc(subj_len + 1);
-        saved_s = strncpy(s, subject, subj_len);
-        s[subj_len] = '\0';
-
-#ifdef NOTDEF
-/* AUDIT biege: can we trigger a DoS here by using a very long "Subject"? */
-
-	s = emalloc(strlen(subject) + 1);	
-	saved_s = strcpy(s, subject);
-#endif
-
-        if (isre(s, NULL))
-            do {
-#if DEBUG_THREAD > 1
-                fprintf(stderr, "extra %s\n", s);
-#endif
-                ep = etable[hash(s)];
-                while (ep != NULL) {
-					if ((strcasecmp(s, ep->data->subject) == 0) && (msgnum != ep->data->msgnum)) {
-                        match = 1;
-						if (lowest_so_far == NULL || ep->data->msgnum < lowest_so_far->msgnum)
-                            lowest_so_far = ep->data;
-                    }
-                    ep = ep->next;
-                }
-                s = oneunre(s);
-            } while (s != NULL);
-
-	free(saved_s);
-
-	if (match) {
-	    *maybereply = 1;
-	    if (lowest_so_far != NULL && lowest_so_far->msgnum < msgnum) {
-#if DEBUG_THREAD
-				fprintf(stderr, "match on extra   %4d %4d\n", msgnum, lowest_so_far->msgnum);
-#endif
-		return lowest_so_far;
-	    }
-	    else {
-#if DEBUG_THREAD
-				fprintf(stderr, "match on extra   %4d %4d discarded - less than %d\n", msgnum, lowest_so_far ? lowest_so_far->msgnum : -1, msgnum);
-#endif
-		return NULL;
-	    }
-	}
-    }
-
-#if DEBUG_THREAD
-    fprintf(stderr, "match NO MATCH   %4d\n", msgnum);
-#endif
-    return NULL;
-}
-
-/*
-** Same as the above function, but only returns the article number.
-*/
-
-int hashreplynumlookup(int msgnum, char *inreply, char *subject, int *maybereply)
-{
-    struct emailinfo *email = hashreplylookup(msgnum, inreply, subject,
-					      maybereply);
-    return email != NULL ? email->msgnum : -1;
-}
-
-
 /*
  * From an article's number, retrieve all information associated with
  * that article.
@@ -1090,6 +964,10 @@ struct reply *addreply2(struct reply *rp, struct emailinfo *from_email, struct e
 {
 #ifdef FASTREPLYCODE
     struct reply *tempnode;
+#endif
+    thread_touch(from_email);
+    thread_touch(email);
+#ifdef FASTREPLYCODE
     for (tempnode = rp; tempnode != NULL; tempnode = tempnode->next) {
 	if (tempnode->msgnum == email->msgnum) { /* duplicate? */
 	    if (tempnode->maybereply)
@@ -1174,10 +1052,14 @@ struct header *addheader(struct header *hp, struct emailinfo *email, int sorttyp
 
     switch (sorttype) {
     case 1:
-	isbigger = (strcasecmp(email->name, hp->data->name) > 0) ? 0 : 1;
+	/* equal keys are the same pointer; see intern.c */
+	isbigger = (email->name_key != hp->data->name_key
+		    && strcmp(email->name_key, hp->data->name_key) > 0) ? 0 : 1;
 	break;
     case 0:
-		isbigger = (strcasecmp(email->unre_subject, hp->data->unre_subject) > 0) ? 0 : 1;
+	isbigger = (email->subject_key != hp->data->subject_key
+		    && strcmp(email->subject_key,
+			      hp->data->subject_key) > 0) ? 0 : 1;
 	break;
     case 2:
 	yearsecs = email->fromdate;
@@ -1368,84 +1250,19 @@ int inlist_pos(struct hmlist *listname, char *wildcard)
     return -1;
 }
 
-static int regex_index(struct hmlist *listname, int index)
-{
-	static int start[5] = { -1, -1, -1, -1, -1 };
-    if (start[0] == -1) {
-	struct hmlist *tlist;
-	start[1] = start[0] = 0;
-	for (tlist = set_filter_out; tlist != NULL; tlist = tlist->next)
-	    ++start[1];
-	start[2] = start[1];
-	for (tlist = set_filter_require; tlist != NULL; tlist = tlist->next)
-	    ++start[2];
-	start[3] = start[2];
-	for (tlist = set_filter_out_full_body; tlist != NULL; tlist = tlist->next)
-	    ++start[3];
-	start[4] = start[3];
-	for (tlist = set_filter_require_full_body; tlist != NULL; tlist = tlist->next)
-	    ++start[4];
-    }
-	if (index == -1)
-		return start[4];
-	if (listname == set_filter_out)
-		return start[0] + index;
-	if (listname == set_filter_require)
-		return start[1] + index;
-	if (listname == set_filter_out_full_body)
-		return start[2] + index;
-	if (listname == set_filter_require_full_body)
-		return start[3] + index;
-    return -1;
-}
-
 /*
 ** like inlist_pos, but does regex search
 */
 
 int inlist_regex_pos(struct hmlist *listname, char *str)
 {
+#ifdef HAVE_PCRE
+    return regex_first(listname, str, strlen(str));
+#else
     struct hmlist *tlist;
     int i;
 
     for (i = 0, tlist = listname; tlist != NULL; i++, tlist = tlist->next) {
-#ifdef HAVE_PCRE
-	int r;
-	const char *errptr;
-	int epos;
-	int index = regex_index(listname, i);
-	static pcre *p, **pcre_list;
-	static pcre_extra *extra, **extra_list;
-	if (!pcre_list) {
-	    int n = regex_index(NULL, -1);
-	    int i;
-			pcre_list = (pcre **) emalloc(n * sizeof(pcre *));
-			extra_list = (pcre_extra **) emalloc(n * sizeof(pcre_extra *));
-	    for (i = 0; i < n; ++i) {
-	        pcre_list[i] = NULL;
-	        extra_list[i] = NULL;
-	    }
-	}
-	if ((p = pcre_list[index]) == NULL) {
-	    p = pcre_compile(tlist->val, 0, &errptr, &epos, NULL);
-	    if (!p) {
-		snprintf(errmsg, sizeof(errmsg), "Error at position %d of regular expression '%s': %s", epos, tlist->val, errptr);
-		progerr(errmsg);
-	    }
-	    extra = pcre_study(p, 0, &errptr);
-	    if (errptr) {
-		snprintf(errmsg, sizeof(errmsg), "Error studying regular expression '%s': %s", tlist->val, errptr);
-		progerr(errmsg);
-	    }
-	    pcre_list[index] = p;
-	    extra_list[index] = extra;
-	}
-	extra = extra_list[index];
-	r = pcre_exec(p, extra, str, strlen(str), 0, 0, NULL, 0);
-	
-	if (r >= 0)
-	    return i;
-#else
 	static int warned = 0;
 	if (set_showprogress && !warned) {
 	    warned = 1;
@@ -1453,9 +1270,9 @@ int inlist_regex_pos(struct hmlist *listname, char *str)
 	}
 	if (strstr(tlist->val, str))
 	    return i;
-#endif
     }
     return -1;
+#endif
 }
 
 /*
@@ -11,10 +11,7 @@ struct emailinfo *addhash(int, char *, char *, char *, char *, char *, char *,
 
 int insert_in_lists(struct emailinfo *, const bool *, int);
 
-struct emailinfo *hashreplylookup(int, char *, char *, int *);
-
 struct emailinfo *hashmsgidlookup(char *, int *);
-int hashreplynumlookup(int, char *, char *, int *);
 struct emailinfo *hashlookupbymsgid(char *);
 int insert_older_msgs(int);
 
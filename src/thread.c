@@ -0,0 +1,988 @@
+/*
+** This program and library is free software; you can redistribute it and/or
+** modify it under the terms of the GNU (Library) General Public License
+** as published by the Free Software Foundation; either version 2
+** of the License, or any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+** GNU (Library) General Public License for more details.
+**
+** You should have received a copy of the GNU (Library) General Public License
+** along with this program; if not, write to the Free Software
+** Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA
+*/
+
+/*
+** Threading: finding the message a message replies to, and building
+** replylist and threadlist from that.
+**
+** addhash() enters every message in four maps here, keyed by message
+** id, by date, by subject, and by subject without regard to case. The
+** parent of a message is then looked up, in this order, by
+**
+**   1. the In-Reply-To id,
+**   2. the References ids, newest first,
+**   3. the In-Reply-To field being the date of a message,
+**   4. the In-Reply-To field being the subject of a message,
+**   5. the subject with one, two, ... "Re:"s taken off, which picks
+**      the oldest message with such a subject.
+**
+** The last two are only guesses, and set maybereply. Each step is one
+** hash lookup, where it used to be a walk along an etable chain, and
+** crossindex() keeps an index of the replies it has already added
+** instead of searching replylist for them, so threading takes time in
+** proportion to the number of messages.
+*/
+
+#include "hypermail.h"
+#include "setup.h"
+#include "struct.h"
+#include "parse.h"
+#include "stats.h"
+#include "print.h"
+#include "output.h"
+#include "thread.h"
+
+#define MAX_SUBJ_LEN 300
+
+#define STATE_HEADER "# hypermail thread state 1\n"
+
+static void thread_free_state(void);
+
+/*
+** A map entry holds the two messages a lookup can want for a key, so
+** that a message can be skipped when it is the one looking: the two
+** newest ones, or in a "lowest" map the two with the lowest numbers.
+*/
+
+struct thread_key {
+    const char *key;		/* points into the first message's copy */
+    unsigned hashval;
+    struct emailinfo *e[2];
+    struct thread_key *next;
+};
+
+struct thread_map {
+    struct thread_key **table;
+    unsigned size;		/* a power of two */
+    unsigned count;
+    int nocase;
+    int lowest;
+};
+
+static struct thread_map by_msgid = { NULL, 0, 0, 0, 0 };
+static struct thread_map by_date = { NULL, 0, 0, 0, 0 };
+static struct thread_map by_subject = { NULL, 0, 0, 0, 0 };
+static struct thread_map by_subject_nocase = { NULL, 0, 0, 1, 1 };
+
+static unsigned key_hash(const char *s, int len, int nocase)
+{
+    unsigned h = 2166136261U;
+    int i;
+
+    for (i = 0; i < len; i++) {
+	h ^= nocase ? tolower((unsigned char)s[i]) : (unsigned char)s[i];
+	h *= 16777619U;
+    }
+    return h;
+}
+
+/* the entry for the first len characters of key */
+static struct thread_key *map_find(struct thread_map *map, const char *key,
+				   int len)
+{
+    struct thread_key *k;
+    unsigned h;
+
+    if (!map->table)
+	return NULL;
+    h = key_hash(key, len, map->nocase);
+    for (k = map->table[h & (map->size - 1)]; k != NULL; k = k->next)
+	if (k->hashval == h
+	    && !(map->nocase ? strncasecmp(k->key, key, len)
+		 : strncmp(k->key, key, len)) && !k->key[len])
+	    return k;
+    return NULL;
+}
+
+static void map_grow(struct thread_map *map)
+{
+    unsigned size = map->size ? map->size * 2 : 1024;
+    struct thread_key **table = (struct thread_key **)
+	emalloc(size * sizeof(struct thread_key *));
+    struct thread_key *k, *next;
+    unsigned i;
+
+    memset(table, 0, size * sizeof(struct thread_key *));
+    for (i = 0; i < map->size; i++)
+	for (k = map->table[i]; k != NULL; k = next) {
+	    next = k->next;
+	    k->next = table[k->hashval & (size - 1)];
+	    table[k->hashval & (size - 1)] = k;
+	}
+    if (map->table)
+	free(map->table);
+    map->table = table;
+    map->size = size;
+}
+
+static void map_add(struct thread_map *map, const char *key,
+		    struct emailinfo *e)
+{
+    struct thread_key *k;
+    int len;
+
+    if (!key)
+	return;
+    len = strlen(key);
+    if ((k = map_find(map, key, len)) == NULL) {
+	if (map->count >= map->size)
+	    map_grow(map);
+	k = (struct thread_key *)emalloc(sizeof(struct thread_key));
+	k->key = key;
+	k->hashval = key_hash(key, len, map->nocase);
+	k->e[0] = k->e[1] = NULL;
+	k->next = map->table[k->hashval & (map->size - 1)];
+	map->table[k->hashval & (map->size - 1)] = k;
+	++map->count;
+    }
+    if (!map->lowest) {
+	k->e[1] = k->e[0];
+	k->e[0] = e;
+    }
+    else if (!k->e[0] || e->msgnum < k->e[0]->msgnum) {
+	k->e[1] = k->e[0];
+	k->e[0] = e;
+    }
+    else if (!k->e[1] || e->msgnum < k->e[1]->msgnum)
+	k->e[1] = e;
+}
+
+static void map_free(struct thread_map *map)
+{
+    struct thread_key *k, *next;
+    unsigned i;
+
+    for (i = 0; i < map->size; i++)
+	for (k = map->table[i]; k != NULL; k = next) {
+	    next = k->next;
+	    free(k);
+	}
+    if (map->table)
+	free(map->table);
+    map->table = NULL;
+    map->size = map->count = 0;
+}
+
+/* the message for key that isn't msgnum */
+static struct emailinfo *map_other(struct thread_map *map, const char *key,
+				   int msgnum)
+{
+    struct thread_key *k = map_find(map, key, strlen(key));
+
+    if (!k)
+	return NULL;
+    if (k->e[0] && k->e[0]->msgnum != msgnum)
+	return k->e[0];
+    if (k->e[1] && k->e[1]->msgnum != msgnum)
+	return k->e[1];
+    return NULL;
+}
+
+/*
+** Called by addhash() for every message it adds.
+*/
+
+void thread_add_message(struct emailinfo *e)
+{
+    map_add(&by_msgid, e->msgid, e);
+    map_add(&by_date, e->datestr, e);
+    map_add(&by_subject, e->subject, e);
+    map_add(&by_subject_nocase, e->subject, e);
+}
+
+/*
+** Forgets all messages, along with the hash table.
+*/
+
+void thread_reset(void)
+{
+    map_free(&by_msgid);
+    map_free(&by_date);
+    map_free(&by_subject);
+    map_free(&by_subject_nocase);
+    thread_free_state();
+}
+
+/*
+** The message the References ids name, trying the newest first. The
+** ids are separated by spaces.
+*/
+
+static struct emailinfo *references_lookup(int msgnum, char *inreply,
+					   char *references)
+{
+    char *end = references + strlen(references);
+    char *start;
+    struct thread_key *k;
+
+    while (end > references) {
+	for (start = end; start > references && start[-1] != ' '; start--)
+	    ;
+	if (end > start
+	    && !(inreply && !strncmp(inreply, start, end - start)
+		 && !inreply[end - start])
+	    && (k = map_find(&by_msgid, start, end - start)) != NULL
+	    && k->e[0]->msgnum != msgnum)
+	    return k->e[0];
+	end = start > references ? start - 1 : start;
+    }
+    return NULL;
+}
+
+static struct emailinfo *parent_lookup(int msgnum, char *inreply,
+				       char *references, char *subject,
+				       int *maybereply)
+{
+    struct emailinfo *e;
+    struct thread_key *k;
+
+    *maybereply = 0;
+
+    if (inreply && *inreply
+	&& (k = map_find(&by_msgid, inreply, strlen(inreply))) != NULL) {
+#if DEBUG_THREAD
+	fprintf(stderr, "match on msgid   %4d %4d\n", msgnum, k->e[0]->msgnum);
+#endif
+	return k->e[0];
+    }
+
+    if (references
+	&& (e = references_lookup(msgnum, inreply, references)) != NULL) {
+#if DEBUG_THREAD
+	fprintf(stderr, "match on refs    %4d %4d\n", msgnum, e->msgnum);
+#endif
+	return e;
+    }
+
+    if (inreply && *inreply) {
+	if ((e = map_other(&by_date, inreply, msgnum)) != NULL) {
+#if DEBUG_THREAD
+	    fprintf(stderr, "match on date    %4d %4d\n", msgnum, e->msgnum);
+#endif
+	    return e;
+	}
+	if ((e = map_other(&by_subject, inreply, msgnum)) != NULL) {
+	    *maybereply = 1;
+#if DEBUG_THREAD
+	    fprintf(stderr, "match on subject %4d %4d\n", msgnum, e->msgnum);
+#endif
+	    return e;
+	}
+    }
+
+    /* No match so far.  Now try matching on the subject, removing
+     * one instance of "re: " from the front of the subject each
+     * time round the loop.
+     */
+    if (subject) {
+	struct emailinfo *lowest_so_far = NULL;
+	size_t subj_len = strlen(subject) > MAX_SUBJ_LEN ? MAX_SUBJ_LEN
+	    : strlen(subject);
+	char *s = emalloc(subj_len + 1);
+	char *next;
+
+	strncpy(s, subject, subj_len);
+	s[subj_len] = '\0';
+
+	if (isre(s, NULL)) {
+	    char *level = s;
+	    while (level != NULL) {
+		e = map_other(&by_subject_nocase, level, msgnum);
+		if (e && (!lowest_so_far || e->msgnum < lowest_so_far->msgnum))
+		    lowest_so_far = e;
+		next = oneunre(level);
+		if (level != s)
+		    free(level);
+		level = next;
+	    }
+	}
+	free(s);
+
+	if (lowest_so_far) {
+	    *maybereply = 1;
+	    if (lowest_so_far->msgnum < msgnum) {
+#if DEBUG_THREAD
+		fprintf(stderr, "match on extra   %4d %4d\n", msgnum,
+			lowest_so_far->msgnum);
+#endif
+		return lowest_so_far;
+	    }
+	    return NULL;
+	}
+    }
+
+#if DEBUG_THREAD
+    fprintf(stderr, "match NO MATCH   %4d\n", msgnum);
+#endif
+    return NULL;
+}
+
+/*
+ * Given an "in-reply-to:" field and a message number, this function
+ * retrieves information about the message that this message is a
+ * reply to.
+ * If all else fails but a reply is
+ * found by comparing subjects, maybereply is set to 1.
+*/
+
+struct emailinfo *hashreplylookup(int msgnum, char *inreply, char *subject, int *maybereply)
+{
+    return parent_lookup(msgnum, inreply, NULL, subject, maybereply);
+}
+
+/*
+** Same as the above function, but only returns the article number.
+*/
+
+int hashreplynumlookup(int msgnum, char *inreply, char *subject, int *maybereply)
+{
+    struct emailinfo *email = hashreplylookup(msgnum, inreply, subject,
+					      maybereply);
+    return email != NULL ? email->msgnum : -1;
+}
+
+/*
+** The message email replies to, using its References as well.
+*/
+
+struct emailinfo *thread_parent(struct emailinfo *email, int *maybereply)
+{
+    return parent_lookup(email->msgnum, email->inreplyto, email->references,
+			 email->subject, maybereply);
+}
+
+#ifdef FASTREPLYCODE
+/*
+** What addreply2() does, but with reply_to[] indexing the node of each
+** message in replylist and last_reply[] the end of each message's own
+** replylist, so that neither list is searched.
+*/
+
+static void add_reply(struct emailinfo *from_email, struct emailinfo *email,
+		      int maybereply, struct reply **reply_to,
+		      struct reply **last_reply)
+{
+    struct reply *rp = reply_to[email->msgnum];
+
+    if (rp) {			/* duplicate? */
+	if (rp->maybereply)
+	    rp->maybereply = maybereply;
+	return;
+    }
+    if (from_email->replylist && !last_reply[from_email->msgnum]) {
+	for (rp = from_email->replylist; rp->next != NULL; rp = rp->next)
+	    ;
+	last_reply[from_email->msgnum] = rp;
+    }
+    from_email->replylist = addreply(from_email->replylist,
+				     from_email->msgnum, email, maybereply,
+				     &last_reply[from_email->msgnum]);
+    replylist = addreply(replylist, from_email->msgnum, email, maybereply,
+			 &replylist_end);
+    reply_to[email->msgnum] = replylist_end;
+}
+#endif
+
+/*
+** Cross-indexes - adds to a list of replies. If a message is a reply to
+** another, the number of the message it's replying to is added to the list.
+** This list is searched upon printing.
+*/
+
+void crossindex(void)
+{
+    int num, maybereply;
+    struct emailinfo *email, *email2;
+    long links = 0, maybes = 0;
+#ifdef FASTREPLYCODE
+    struct reply **reply_to, **last_reply;
+    struct reply *rp;
+#endif
+
+    if (!set_linkquotes)
+        replylist = NULL;
+
+#ifdef FASTREPLYCODE
+    reply_to = (struct reply **)emalloc((max_msgnum + 1)
+					* sizeof(struct reply *));
+    last_reply = (struct reply **)emalloc((max_msgnum + 1)
+					  * sizeof(struct reply *));
+    memset(reply_to, 0, (max_msgnum + 1) * sizeof(struct reply *));
+    memset(last_reply, 0, (max_msgnum + 1) * sizeof(struct reply *));
+    replylist_end = NULL;
+    for (rp = replylist; rp != NULL; rp = rp->next) {
+	if (rp->msgnum >= 0 && rp->msgnum <= max_msgnum && !reply_to[rp->msgnum])
+	    reply_to[rp->msgnum] = rp;
+	replylist_end = rp;
+    }
+#endif
+
+    for (num = 0; num <= max_msgnum; num++) {
+	if (!hashnumlookup(num, &email))
+	    continue;
+	if ((email2 = thread_parent(email, &maybereply)) == NULL)
+	    continue;
+
+	/*  make sure there is no recursion between the message
+	    and reply lookup if a message and its reply-to were
+	    archived in reverse, both messages share the same
+	    subject (regardless of Re), and the message itself was
+	    a reply to a non-archived message. */
+	if (maybereply && !strcmp(email2->inreplyto, email->msgid))
+	    continue;
+
+	if (set_linkquotes) {
+	    int found_num = 0;
+#ifdef FASTREPLYCODE
+	    rp = reply_to[email2->msgnum];
+	    found_num = rp && rp->frommsgnum == num;
+#else
+	    struct reply *rp;
+	    for (rp = replylist; rp != NULL; rp = rp->next)
+		if (rp->msgnum == email2->msgnum && rp->frommsgnum == num) {
+		    found_num = 1;
+		    break;
+		}
+#endif
+	    if (found_num || maybereply || num <= email2->msgnum)
+		continue;
+	}
+#ifdef FASTREPLYCODE
+	add_reply(email2, email, maybereply, reply_to, last_reply);
+#else
+	replylist = addreply(replylist, email2->msgnum, email, maybereply,
+			     &replylist_end);
+#endif
+	++links;
+	if (maybereply)
+	    ++maybes;
+    }
+
+#ifdef FASTREPLYCODE
+    free(reply_to);
+    free(last_reply);
+#endif
+    stats_count("thread_links", links);
+    stats_count("thread_subject_links", maybes);
+
+#if DEBUG_THREAD
+    {
+	struct reply *r;
+	r = replylist;
+	fprintf(stderr, "START of replylist after crossindex\n");
+	fprintf(stderr, "- msgnum frommsgnum maybereply msgid\n");
+	while (r != NULL) {
+	    fprintf(stderr, "- %d %d %d '%s'\n",
+		    r->data->msgnum,
+		    r->frommsgnum, r->maybereply, r->data->msgid);
+	    r = r->next;
+	}
+	fprintf(stderr, "END of replylist after crossindex\n");
+    }
+#endif
+}
+
+/*
+** What the threading below keeps about each message, indexed by its
+** number, so that a linkquotes run can redo just the threads whose
+** replies it changed, and knows which pages need a new "Next in
+** thread" link without looking at all of them.
+*/
+
+#define THREAD_TOUCHED 1	/* its replies changed after threading */
+#define THREAD_CHANGED 2	/* its next in thread may not be the one
+				   its page links to */
+
+static int thread_size;		/* entries in each of these */
+static int *thread_root;	/* first message of its thread, or -1 */
+static int *date_rank;		/* place in datelist, or -1 */
+static struct reply **thread_first;	/* by first message: the node */
+static struct reply **thread_last;	/* and the end of thread node */
+static char *thread_flags;
+static int *touched;
+static int ntouched;
+static int *changed;
+static int nchanged;
+static int current_root = -1;
+static int next_rank;
+
+static void thread_free_state(void)
+{
+    if (thread_size) {
+	free(thread_root);
+	free(date_rank);
+	free(thread_first);
+	free(thread_last);
+	free(thread_flags);
+	free(touched);
+	free(changed);
+    }
+    thread_size = ntouched = nchanged = next_rank = 0;
+    current_root = -1;
+}
+
+static void thread_alloc(void)
+{
+    int i;
+
+    thread_free_state();
+    thread_size = max_msgnum + 1;
+    if (thread_size < 1)
+	thread_size = 1;
+    thread_root = (int *)emalloc(thread_size * sizeof(int));
+    date_rank = (int *)emalloc(thread_size * sizeof(int));
+    thread_first = (struct reply **)emalloc(thread_size
+					    * sizeof(struct reply *));
+    thread_last = (struct reply **)emalloc(thread_size
+					   * sizeof(struct reply *));
+    thread_flags = (char *)emalloc(thread_size);
+    touched = (int *)emalloc(thread_size * sizeof(int));
+    changed = (int *)emalloc(thread_size * sizeof(int));
+    for (i = 0; i < thread_size; i++) {
+	thread_root[i] = date_rank[i] = -1;
+	thread_first[i] = thread_last[i] = NULL;
+	thread_flags[i] = 0;
+    }
+}
+
+/*
+** Appends a message, or the end of thread marker when email is NULL,
+** to threadlist. Being in threadlist doesn't make a message a reply,
+** so isreply is left as it was.
+*/
+
+static void thread_append(int fromnum, struct emailinfo *email)
+{
+    struct reply *last = threadlist ? threadlist_end : NULL;
+#ifdef FASTREPLYCODE
+    int isreply = email ? email->isreply : 0;
+#endif
+
+    threadlist = addreply(threadlist, fromnum, email, 0, &threadlist_end);
+    if (email == NULL)
+	return;
+#ifdef FASTREPLYCODE
+    email->isreply = isreply;
+#endif
+    if (email->msgnum < thread_size)
+	thread_root[email->msgnum] = current_root;
+
+    /* the message before it in the thread now has it as next */
+    if (last && last->msgnum != -1 && last->data
+	&& last->data->initial_next_in_thread != email->msgnum
+	&& last->msgnum < thread_size
+	&& !(thread_flags[last->msgnum] & THREAD_CHANGED)) {
+	thread_flags[last->msgnum] |= THREAD_CHANGED;
+	changed[nchanged++] = last->msgnum;
+    }
+}
+
+/*
+** Checks for replies to replies to a message, etc.
+** Replies are added to the thread list.
+*/
+
+#ifdef FASTREPLYCODE
+static void crossindexthread2(int num)
+{
+    struct emailinfo *ep;
+    /* the message at each level, and where in its replies we are */
+    struct {
+	int num;
+	struct reply *rp;
+    } *stack;
+    int depth = 0, size = 64;
+
+    if(!hashnumlookup(num, &ep)) {
+	char errmsg[512];
+        snprintf(errmsg, sizeof(errmsg),
+                 "internal error crossindexthread2 %d", num);
+	progerr(errmsg);
+    }
+
+    stack = emalloc(size * sizeof(*stack));
+    stack[0].num = num;
+    stack[0].rp = ep->replylist;
+    depth = 1;
+    while (depth) {
+	struct reply *rp = stack[depth - 1].rp;
+
+	if (rp == NULL) {
+	    --depth;
+	    continue;
+	}
+	stack[depth - 1].rp = rp->next;
+	if (!(rp->data->flags & USED_THREAD)) {
+	    rp->data->flags |= USED_THREAD;
+	    thread_append(stack[depth - 1].num, rp->data);
+	    if (depth == size) {
+		size *= 2;
+		stack = realloc(stack, size * sizeof(*stack));
+		if (!stack)
+		    progerr("crossindexthread2: out of memory");
+	    }
+	    stack[depth].num = rp->msgnum;
+	    stack[depth].rp = rp->data->replylist;
+	    ++depth;
+	}
+    }
+    free(stack);
+}
+#else
+static void crossindexthread2(int num)
+{
+    struct reply *rp;
+
+    for (rp = replylist; rp != NULL; rp = rp->next) {
+	if (!(rp->data->flags & USED_THREAD) && (rp->frommsgnum == num)) {
+	    rp->data->flags |= USED_THREAD;
+	    thread_append(num, rp->data);
+	    printedlist = markasprinted(printedthreadlist, rp->msgnum);
+	    crossindexthread2(rp->msgnum);
+	}
+    }
+}
+#endif
+
+
+/*
+** Adds a thread that starts with email to threadlist.
+*/
+
+static void thread_start(struct emailinfo *email)
+{
+    email->flags |= USED_THREAD;
+    current_root = email->msgnum;
+    thread_append(email->msgnum, email);
+    if (email->msgnum < thread_size)
+	thread_first[email->msgnum] = threadlist_end;
+    crossindexthread2(email->msgnum);
+    thread_append(-1, NULL);
+    if (email->msgnum < thread_size)
+	thread_last[email->msgnum] = threadlist_end;
+}
+
+/*
+** First, print out the threads in order by date...
+** Each message number is appended to a thread list. Threads and individual
+** messages are separated by a -1.
+*/
+
+static void crossindexthread1(struct header *hp)
+{
+    int isreply;
+
+#ifndef FASTREPLYCODE
+    struct reply *rp;
+#endif
+
+    for (; hp != NULL; hp = hp->right) {
+	crossindexthread1(hp->left);
+
+	if (hp->data->msgnum < thread_size)
+	    date_rank[hp->data->msgnum] = next_rank++;
+
+#ifdef FASTREPLYCODE
+	isreply = hp->data->isreply;
+#else
+	for (isreply = 0, rp = replylist; rp != NULL; rp = rp->next) {
+	    if (rp->msgnum == hp->data->msgnum) {
+		isreply = 1;
+		break;
+	    }
+	}
+#endif
+
+	/* If this message is not a reply to any other messages then it
+	 * is the first message in a thread.  If it hasn't already
+	 * been dealt with, then add it to the thread list, followed by
+	 * any descendants and then the end of thread marker.
+	 */
+	if (!isreply && !wasprinted(printedthreadlist, hp->data->msgnum) &&
+	    !(hp->data->flags & USED_THREAD))
+	    thread_start(hp->data);
+    }
+}
+
+/*
+** Builds threadlist from datelist, after crossindex().
+*/
+
+void thread_build(void)
+{
+    thread_alloc();
+    threadlist = NULL;
+    threadlist_end = NULL;
+    printedthreadlist = NULL;
+    crossindexthread1(datelist);
+}
+
+/*
+** The first message of the thread msgnum is in, or msgnum itself when
+** it isn't in one.
+*/
+
+int thread_root_num(int msgnum)
+{
+    if (msgnum >= 0 && msgnum < thread_size && thread_root[msgnum] != -1)
+	return thread_root[msgnum];
+    return msgnum;
+}
+
+/*
+** Called whenever a message gets a new reply, or loses one, after
+** thread_build(), so that thread_update() redoes its thread.
+*/
+
+void thread_touch(struct emailinfo *email)
+{
+    if (email && email->msgnum >= 0 && email->msgnum < thread_size
+	&& !(thread_flags[email->msgnum] & THREAD_TOUCHED)) {
+	thread_flags[email->msgnum] |= THREAD_TOUCHED;
+	touched[ntouched++] = email->msgnum;
+    }
+}
+
+#ifdef FASTREPLYCODE
+static int compare_rank(const void *a, const void *b)
+{
+    return date_rank[(*(struct emailinfo *const *)a)->msgnum]
+	- date_rank[(*(struct emailinfo *const *)b)->msgnum];
+}
+
+/*
+** Redoes the threads of the touched messages, and any thread one of
+** their messages now has a reply in, and puts them back in threadlist
+** among the others where crossindexthread1() would have.
+*/
+
+static void rethread_touched(void)
+{
+    char *redone = (char *)emalloc(thread_size);
+    int *roots = (int *)emalloc(thread_size * sizeof(int));
+    int *keep = (int *)emalloc(thread_size * sizeof(int));
+    struct emailinfo **redo;
+    struct reply *rp, *cp, *end;
+    int nroots = 0, nkeep = 0, nredo = 0, i, k, r;
+
+    memset(redone, 0, thread_size);
+    for (i = 0; i < ntouched; i++) {
+	r = thread_root[touched[i]];
+	if (r >= 0 && !redone[r]) {
+	    redone[r] = 1;
+	    roots[nroots++] = r;
+	}
+    }
+    for (i = 0; i < nroots; i++) {
+	for (rp = thread_first[roots[i]]; rp != thread_last[roots[i]];
+	     rp = rp->next) {
+	    for (cp = rp->data->replylist; cp != NULL; cp = cp->next) {
+		if (cp->msgnum < 0 || cp->msgnum >= thread_size)
+		    continue;
+		r = thread_root[cp->msgnum];
+		if (r >= 0 && !redone[r]) {
+		    redone[r] = 1;
+		    roots[nroots++] = r;
+		}
+	    }
+	}
+    }
+    stats_count("rethread_threads", nroots);
+
+    /* take the redone threads out, and free their nodes */
+    redo = (struct emailinfo **)emalloc(thread_size
+					* sizeof(struct emailinfo *));
+    for (rp = threadlist; rp != NULL; rp = end) {
+	r = rp->msgnum;
+	end = thread_last[r]->next;
+	if (!redone[r]) {
+	    keep[nkeep++] = r;
+	    continue;
+	}
+	while (rp != end) {
+	    cp = rp->next;
+	    if (rp->data) {
+		rp->data->flags &= ~USED_THREAD;
+		threadlist_by_msgnum[rp->msgnum] = NULL;
+		thread_root[rp->msgnum] = -1;
+		if (date_rank[rp->msgnum] >= 0)
+		    redo[nredo++] = rp->data;
+	    }
+	    free(rp);
+	    rp = cp;
+	}
+    }
+
+    /* and merge the kept threads with the new ones, by date */
+    qsort(redo, nredo, sizeof(struct emailinfo *), compare_rank);
+    threadlist = NULL;
+    threadlist_end = NULL;
+    for (i = k = 0; i < nkeep || k < nredo;) {
+	if (k < nredo && (i == nkeep || date_rank[redo[k]->msgnum]
+			  < date_rank[keep[i]])) {
+	    if (!redo[k]->isreply && !(redo[k]->flags & USED_THREAD))
+		thread_start(redo[k]);
+	    k++;
+	    continue;
+	}
+	r = keep[i++];
+	if (threadlist_end) {
+	    threadlist_end->next = thread_first[r];
+	    threadlist_by_msgnum[r] = threadlist_end;
+	}
+	else {
+	    threadlist = thread_first[r];
+	    threadlist_by_msgnum[r] = threadlist;
+	}
+	threadlist_end = thread_last[r];
+	threadlist_end->next = NULL;
+    }
+    free(redone);
+    free(roots);
+    free(keep);
+    free(redo);
+}
+#else
+static void rethread_touched(void)
+{
+    int i;
+
+    for (i = 0; i < thread_size; i++) {
+	struct emailinfo *ep;
+	if (hashnumlookup(i, &ep))
+	    ep->flags &= ~USED_THREAD;
+    }
+    threadlist = NULL;
+    threadlist_end = NULL;
+    printedthreadlist = NULL;
+    next_rank = 0;
+    crossindexthread1(datelist);
+}
+#endif
+
+/*
+** Brings threadlist up to date with the replies linkquotes found
+** while the messages were written, and adds a "Next in thread" link
+** to each page that has a new next message in its thread. Only the
+** messages whose next message changed while threadlist was built are
+** looked at.
+*/
+
+void thread_update(int max_update)
+{
+    int i;
+
+    if (!thread_size)
+	thread_build();
+    if (ntouched)
+	rethread_touched();
+    for (i = 0; i < ntouched; i++)
+	thread_flags[touched[i]] &= ~THREAD_TOUCHED;
+    ntouched = 0;
+
+    for (i = 0; i < nchanged; i++) {
+	struct emailinfo *ep, *etmp;
+
+	thread_flags[changed[i]] &= ~THREAD_CHANGED;
+	if (!hashnumlookup(changed[i], &ep))
+	    continue;
+	etmp = nextinthread(changed[i]);
+	if (etmp && ep->initial_next_in_thread != etmp->msgnum)
+	    fixthreadheader(set_dir, etmp->msgnum, max_update);
+    }
+    stats_count("thread_pages_checked", nchanged);
+    nchanged = 0;
+}
+
+static char *state_name(char *dir)
+{
+    char *name;
+
+    trio_asprintf(&name, (dir[strlen(dir) - 1] == PATH_SEPARATOR)
+		  ? "%s%s" : "%s/%s", dir, THREAD_STATE);
+    return name;
+}
+
+/*
+** Reads which message each page's "Next in thread" link points to, as
+** saved by the last run. Without the file every page is taken to have
+** none, so any that should have one gets it.
+*/
+
+void thread_load(char *dir)
+{
+    char *filename;
+    FILE *fp;
+    char line[MAXLINE];
+
+    if (!set_linkquotes)
+	return;
+    filename = state_name(dir);
+    fp = fopen(filename, "r");
+    free(filename);
+    if (fp == NULL)
+	return;
+    if (fgets(line, sizeof(line), fp) && !strcmp(line, STATE_HEADER)) {
+	while (fgets(line, sizeof(line), fp)) {
+	    struct emailinfo *ep;
+	    int num, next;
+
+	    if (sscanf(line, "%d\t%d", &num, &next) == 2
+		&& hashnumlookup(num, &ep))
+		ep->initial_next_in_thread = next;
+	}
+    }
+    fclose(fp);
+}
+
+/*
+** Saves which message each page's "Next in thread" link points to, or
+** removes the file when it isn't kept up to date.
+*/
+
+void thread_save(char *dir)
+{
+    char *filename = state_name(dir);
+    struct Push buff;
+    char numbuf[64];
+    int i, rc;
+
+    if (!set_linkquotes) {
+	unlink(filename);
+	free(filename);
+	return;
+    }
+
+    INIT_PUSH(buff);
+    PushString(&buff, STATE_HEADER);
+    for (i = 0; i <= max_msgnum; i++) {
+	struct emailinfo *ep;
+
+	if (hashnumlookup(i, &ep) && ep->initial_next_in_thread != -1) {
+	    sprintf(numbuf, "%d\t%d\n", i, ep->initial_next_in_thread);
+	    PushString(&buff, numbuf);
+	}
+    }
+    rc = output_replace(filename, PUSH_STRING(buff), PUSH_STRLEN(buff),
+			set_filemode);
+    if (rc) {
+	snprintf(errmsg, sizeof(errmsg), "%s \"%s\": %s.",
+		 lang[MSG_COULD_NOT_WRITE], filename, strerror(rc));
+	progerr(errmsg);
+    }
+    free(PUSH_STRING(buff));
+    free(filename);
+}
@@ -0,0 +1,19 @@
+/*
+** thread.c functions
+*/
+
+void thread_add_message(struct emailinfo *);
+void thread_reset(void);
+
+struct emailinfo *hashreplylookup(int, char *, char *, int *);
+int hashreplynumlookup(int, char *, char *, int *);
+struct emailinfo *thread_parent(struct emailinfo *, int *);
+
+void crossindex(void);
+void thread_build(void);
+void thread_touch(struct emailinfo *);
+int thread_root_num(int);
+void thread_update(int);
+
+void thread_load(char *);
+void thread_save(char *);
@@ -4,6 +4,9 @@
 #include "threadprint.h"
 #include "printfile.h"
 #include "print.h"
+#include "compress.h"
+#include "output.h"
+#include "thread.h"
 
 static void format_thread_info(FILE *, struct emailinfo *, int, int *,
 			       struct emailinfo *, FILE *, int, bool);
@@ -23,10 +26,13 @@ static int num_open_li[MAXSTACK + 1];
 
 /*
 ** If year and/or month are != -1, only messages within the specified time
-** period will be printed.
+** period will be printed. If page is != -1, only the threads on that page
+** of the thread index are. threadnum counts the threads given a file of
+** their own with files_by_thread.
 */
 
-void print_all_threads(FILE *fp, int year, int month, struct emailinfo *email)
+static void print_threads(FILE *fp, int year, int month,
+			  struct emailinfo *email, int page, int *threadnum)
 {
     int level = 0;
     int newlevel;
@@ -45,8 +51,8 @@ void print_all_threads(FILE *fp, int year, int month, struct emailinfo *email)
     struct emailinfo *last_email;
     FILE *fp_body = NULL;
     char *filenameb = NULL;
-    int threadnum = 0;
     bool is_first = TRUE;
+    bool at_root = TRUE;
 
     struct reply *rp = threadlist;
     last_email = rp->data;
@@ -70,12 +76,22 @@ void print_all_threads(FILE *fp, int year, int month, struct emailinfo *email)
 				     filenameb, fp_body);
 	    filenameb = NULL;
 	    rp = rp->next;
+	    at_root = TRUE;
 	    continue;
 	}
 	else if(level == 0 && subdir && rp->data->subdir != subdir) {
 	    rp = rp->next;
 	    continue;
 	}
+	else if (page != -1 && at_root && thread_page_num(rp->msgnum) != page) {
+	    /* a thread on another page: skip to its end marker */
+	    while (rp != NULL && rp->msgnum != -1)
+		rp = rp->next;
+	    if (rp != NULL)
+		rp = rp->next;
+	    continue;
+	}
+	at_root = FALSE;
 
 #if DEBUG_THREAD
 	fprintf(stderr, "print_all_threads: %d: %s\n", rp->msgnum,
@@ -113,10 +129,8 @@ void print_all_threads(FILE *fp, int year, int month, struct emailinfo *email)
 				  "%u%s", reply_list_count,
 				  index_name[subdir != NULL][THREAD_INDEX]);
 		    filename = htmlfilename(filename_stack[level], email, "");
-                    /* AUDIT biege: What about using remove() to handle direc.c too? */
-		    unlink(filename);	/* so chmod won't fail if someone else owned it */
 		    fp_stack[level - 1] = fp;
-		    if ((fp = fopen(filename, "w")) == NULL) {
+		    if ((fp = output_open(filename)) == NULL) {
                         snprintf(errmsg,sizeof(errmsg),"Couldn't write \"%s\".",
 				 filename);
 			progerr(errmsg);
@@ -201,9 +215,9 @@ void print_all_threads(FILE *fp, int year, int month, struct emailinfo *email)
 	            finish_thread_file(fp_body, last_email, filenameb);
 		    filenameb = NULL;
 	    }
-	    sprintf(thread_id, "thread_body%d", ++threadnum);
+	    sprintf(thread_id, "thread_body%d", ++*threadnum);
 	    filenameb = htmlfilename(thread_id, email, set_htmlsuffix);
-	    if ((fp_body = fopen(filenameb, "w")) == NULL) {
+	    if ((fp_body = output_open(filenameb)) == NULL) {
                  snprintf(errmsg, sizeof(errmsg), "Couldn't write \"%s\".", 
                           filenameb);
 		progerr(errmsg);
@@ -217,7 +231,7 @@ void print_all_threads(FILE *fp, int year, int month, struct emailinfo *email)
 	    && (month == -1 || month_of_datenum(rp->data->date) == month)
 	    && !rp->data->is_deleted) {
 	    format_thread_info(fp, rp->data, level, num_replies,
-			       email, fp_body, threadnum, is_first);
+			       email, fp_body, *threadnum, is_first);
 	    if (is_first)
 	      is_first = FALSE;
 	}
@@ -237,6 +251,33 @@ void print_all_threads(FILE *fp, int year, int month, struct emailinfo *email)
     }
 }
 
+void print_all_threads(FILE *fp, int year, int month, struct emailinfo *email)
+{
+    int threadnum = 0;
+
+    print_threads(fp, year, month, email, -1, &threadnum);
+}
+
+/*
+** With msgsperindexpage, a thread goes on the page of the thread index
+** of its first message.
+*/
+
+int thread_page_num(int msgnum)
+{
+    return thread_root_num(msgnum) / set_msgsperindexpage;
+}
+
+/*
+** Prints the threads on one page of the thread index. threadnum goes
+** on from the pages before it.
+*/
+
+void print_thread_page(FILE *fp, int page, int *threadnum)
+{
+    print_threads(fp, -1, -1, NULL, page, threadnum);
+}
+
 static void format_thread_info(FILE *fp, struct emailinfo *email,
 			       int level, int *num_replies,
 			       struct emailinfo* subdir_email, FILE *fp_body,
@@ -326,7 +367,7 @@ finish_thread_file(FILE *fp_body, struct emailinfo *email, char *filenameb)
 	fprint_menu0(fp_body, email, PAGE_BOTTOM);
 	printfooter(fp_body, mhtmlfooterfile, set_label, set_dir,
 		    email->subject, filenameb, TRUE);
-	fclose(fp_body);
+	output_close(fp_body);
 	if (chmod(filenameb, set_filemode) == -1) {
             snprintf(errmsg, sizeof(errmsg), "Couldn't chmod \"%s\" to %o.", 
                      filenameb, set_filemode);
@@ -374,7 +415,10 @@ static int finish_thread_levels(FILE **fp, int level, int newlevel,
 		    fprintf (*fp, "</ul>");
 		    printfooter(*fp, ihtmlfooterfile, set_label, set_dir,
 				subject_stack[level], filename, TRUE);
-		    fclose(*fp);
+		    if (num_replies[level])
+			output_close(*fp);
+		    else
+			output_discard(*fp);
 		    *fp = fp_stack[level - 1];
 		    if (num_replies[level]) {
 			fprintf(*fp,
@@ -388,8 +432,10 @@ static int finish_thread_levels(FILE **fp, int level, int newlevel,
 			}
 			num_open_li[level]++;
 		    }
-		    else
+		    else {
 			remove(filename);
+			compress_remove(filename);
+		    }
 		    free(filename_stack[level]);
 		    free(filename);
 		}
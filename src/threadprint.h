@@ -1,2 +1,4 @@
 void print_all_threads(FILE *, int, int, struct emailinfo *);
+int thread_page_num(int);
+void print_thread_page(FILE *, int, int *);
 int isreplyto(int, int);
@@ -90,7 +90,7 @@ static int find_vertical_repeats(const struct body *bp)
     if (!bp->next) {
 	return 0;
     }
-    i = (isquote(bp->line) ? strlen(get_quote_prefix()) : 0);
+    i = (body_isquote(bp) ? strlen(get_quote_prefix()) : 0);
     if (i > strlen(bp->line))
 	return 0;
 	for (; i < MAXLINE; ++i) {
@@ -112,9 +112,10 @@ static int find_vertical_repeats(const struct body *bp)
     return 0;
 }
 
-static int find_repetition(const struct body *bp)
+/* a run of more than preformat_repeated_chars_min of the same char */
+
+static int has_repeated_chars(const char *line)
 {
-    const char *line = bp->line;
     int i = 0;
     while (line[i]) {
 	int count_repeated_chars = 0;
@@ -122,17 +123,88 @@ static int find_repetition(const struct body *bp)
 	    if (++count_repeated_chars > preformat_repeated_chars_min) {
 		while (isspace(line[i]))
 		    ++i;	/* if trailing whitespace, return 0 */
-		if (!line[i])
-		    return find_vertical_repeats(bp);
-		return 1;
+		return line[i] != '\0';
 	    }
 	    ++i;
 	}
 	++i;
     }
+    return 0;
+}
+
+static int find_repetition(const struct body *bp)
+{
+    if (bp->repetition_set)
+	return bp->repetition;
+    if (has_repeated_chars(bp->line))
+	return 1;
     return find_vertical_repeats(bp);
 }
 
+/*
+** find_repetition() of every line of a body at once, from the last line
+** up, so that each column is only scanned once: down[i] is the number of
+** lines from this one on that have the same punctuation char in column
+** i, as find_vertical_repeats() counts them, and next_down[] is the same
+** for the line below.
+*/
+
+static void find_body_repetitions(struct body *bp)
+{
+    struct body **lines;
+    struct body *lp;
+    int *down, *next_down, *tmp;
+    int count = 0, n, i, j, len, next_len = 0;
+
+    for (lp = bp; lp; lp = lp->next)
+	++count;
+    if (!count)
+	return;
+    lines = (struct body **)emalloc(count * sizeof(struct body *));
+    for (n = 0, lp = bp; lp; lp = lp->next)
+	lines[n++] = lp;
+    down = (int *)emalloc(MAXLINE * sizeof(int));
+    next_down = (int *)emalloc(MAXLINE * sizeof(int));
+
+    for (n = count - 1; n >= 0; --n) {
+	const char *line = lines[n]->line;
+	const char *next = n + 1 < count ? lines[n + 1]->line : NULL;
+
+	len = strlen(line);
+	for (i = 0; i < len && i < MAXLINE; ++i) {
+	    if (!ispunct(line[i]))
+		down[i] = 0;
+	    else if (next && i < next_len && next[i] == line[i])
+		down[i] = 1 + next_down[i];
+	    else
+		down[i] = 1;
+	}
+
+	lines[n]->repetition = 0;
+	if (has_repeated_chars(line))
+	    lines[n]->repetition = 1;
+	else if (next) {
+	    i = (body_isquote(lines[n]) ? strlen(get_quote_prefix()) : 0);
+	    for (; i < len && i < next_len && i < MAXLINE; ++i) {
+		j = ispunct(line[i]) ? down[i] : 1;
+		if (j >= preformat_vertical_chars_min) {
+		    lines[n]->repetition = j;
+		    break;
+		}
+	    }
+	}
+	lines[n]->repetition_set = TRUE;
+
+	tmp = next_down;
+	next_down = down;
+	down = tmp;
+	next_len = len;
+    }
+    free(down);
+    free(next_down);
+    free(lines);
+}
+
 static int has_many_carets(const char *line)
 {
     return strstr(line, preformat_carets) != NULL;
@@ -606,7 +678,7 @@ void txt2html(FILE *fp, struct emailinfo *email, const struct body *bp, bool rep
     prior_was_hrule = was_hrule;
     if (!is_blank_line) {
 	was_hrule = 0;
-	if (!was_quote_prefix || !isquote(next_line))
+	if (!was_quote_prefix || !(bp->next && body_isquote(bp->next)))
 	    was_break = 0;
 	was_par = 0;
 	was_caps = is_caps_line;
@@ -617,8 +689,9 @@ void txt2html(FILE *fp, struct emailinfo *email, const struct body *bp, bool rep
     free(line);
 }
 
-void init_txt2html()
+void init_txt2html(struct body *bp)
 {
+    find_body_repetitions(bp);
     in_pre_block = 0;
     insig = 0;
     islist = 0;
@@ -1,5 +1,5 @@
 
 void
 txt2html(FILE *, struct emailinfo *, const struct body *, bool, int);
-void init_txt2html(void);
+void init_txt2html(struct body *);
 void end_txt2html(FILE *fp);
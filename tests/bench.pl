@@ -0,0 +1,138 @@
+#!/usr/bin/perl
+
+# bench
+#
+# Times hypermail on a synthetic mailbox made by mkmbox.pl, in a few
+# typical setups, and prints the messages per second and the peak
+# memory use of each. Run it with "make bench" from the top directory.
+#
+# usage: bench.pl [-h hypermail] [-n messages] [-r runs] [-g "mkmbox options"]
+#                 [-s scenario,...] [-k]
+#
+#   -h  the hypermail to time (../src/hypermail)
+#   -n  number of messages in the mailbox (5000)
+#   -r  run each scenario this many times and keep the fastest (1)
+#   -g  more options for mkmbox.pl, e.g. "-a 0.2 -c utf-8"
+#   -s  only run these scenarios
+#   -k  keep the mailbox and archives in bench-out/ afterwards
+#
+# The scenarios are:
+#
+#   full            build a new archive from the whole mailbox
+#   incremental     append the last tenth of the mailbox, one run, to an
+#                   archive of the rest
+#   linkquotes      full, with linkquotes = 1
+#   folder_by_date  full, with folder_by_date = %Y/%m
+#   code            full, with showhtml = 2, on a mailbox where half the
+#                   messages carry code, tables or ASCII art (mkmbox.pl -p)
+#
+# The times and memory use come from hypermail's --stats output.
+
+use strict;
+use warnings;
+
+use Getopt::Std;
+use File::Path qw( rmtree );
+use FindBin '$Bin';
+
+our %opt;
+getopts('h:n:r:g:s:k', \%opt) || die "usage: $0 [-h hypermail] [-n messages] [-r runs] [-g \"mkmbox options\"] [-s scenario,...] [-k]\n";
+
+my $hypermail = $opt{h} // "$Bin/../src/hypermail";
+my $messages = $opt{n} // 5000;
+my $runs = $opt{r} // 1;
+my $genopts = $opt{g} // "";
+my $outdir = "bench-out";
+
+die "$hypermail: not found, build it first\n" unless -x $hypermail;
+
+# name, hypermail options, whether it appends to an archive of the
+# first messages, more mkmbox.pl options for its own mailbox
+my @scenarios = (
+    ["full", "", 0, ""],
+    ["incremental", "", 1, ""],
+    ["linkquotes", "-o linkquotes=1", 0, ""],
+    ["folder_by_date", "-o folder_by_date=%Y/%m", 0, ""],
+    ["code", "-o showhtml=2", 0, "-p 0.5"],
+);
+if ($opt{s}) {
+    my %want = map { $_ => 1 } split /,/, $opt{s};
+    @scenarios = grep { $want{$_->[0]} } @scenarios;
+    die "no such scenario: $opt{s}\n" unless @scenarios;
+}
+
+sub run {
+    my $cmd = shift;
+    system($cmd) == 0 || die "failed: $cmd\n";
+}
+
+sub mkmbox {
+    my ($file, $range) = @_;
+    run("perl $Bin/mkmbox.pl -n $messages $genopts $range > $file");
+}
+
+# the mailbox of a scenario with more mkmbox.pl options
+sub scenario_mbox {
+    my ($name, $extra) = @_;
+    return "$outdir/bench.mbox" if $extra eq "";
+    my $file = "$outdir/$name.mbox";
+    run("perl $Bin/mkmbox.pl -n $messages $genopts $extra > $file")
+	unless -f $file;
+    return $file;
+}
+
+# the wall clock time and peak memory use of one hypermail run
+sub hypermail {
+    my ($args, $dir) = @_;
+    my $stats = "$outdir/stats.json";
+    run("$hypermail -c /dev/null $args -d $dir --stats=$stats >/dev/null 2>&1");
+    open(my $fh, "<", $stats) || die "$stats: $!\n";
+    my $json = do { local $/; <$fh> };
+    close($fh);
+    my ($wall) = $json =~ /^  "wall_seconds": ([\d.e+-]+)/m;
+    my ($rss) = $json =~ /^  "max_rss_kb": (\d+)/m;
+    die "$stats: no statistics, does $hypermail know --stats?\n"
+	unless defined $wall && defined $rss;
+    return ($wall, $rss);
+}
+
+rmtree($outdir);
+mkdir($outdir) || die "$outdir: $!\n";
+
+my $split = $messages - int($messages / 10);
+mkmbox("$outdir/bench.mbox", "");
+mkmbox("$outdir/head.mbox", "-l $split");
+mkmbox("$outdir/tail.mbox", "-f $split");
+
+printf("hypermail benchmark: %d messages, %.1f MB%s\n", $messages,
+       (-s "$outdir/bench.mbox") / 1048576, $genopts ne "" ? " ($genopts)" : "");
+printf("%-16s %8s %9s %10s %10s\n", "scenario", "messages", "seconds",
+       "msgs/sec", "peak RSS");
+
+for my $s (@scenarios) {
+    my ($name, $args, $append, $extra) = @$s;
+    my $dir = "$outdir/$name";
+    my $mbox = scenario_mbox($name, $extra);
+    my $count = $append ? $messages - $split : $messages;
+    my ($best, $rss);
+
+    for (1 .. $runs) {
+	my ($wall, $kb);
+	rmtree($dir);
+	if ($append) {
+	    hypermail("$args -m $outdir/head.mbox", $dir);
+	    ($wall, $kb) = hypermail("$args -u -m $outdir/tail.mbox", $dir);
+	}
+	else {
+	    ($wall, $kb) = hypermail("$args -m $mbox", $dir);
+	}
+	if (!defined $best || $wall < $best) {
+	    $best = $wall;
+	    $rss = $kb;
+	}
+    }
+    printf("%-16s %8d %9.3f %10.0f %7.1f MB\n", $name, $count, $best,
+	   $best > 0 ? $count / $best : 0, $rss / 1024);
+}
+
+rmtree($outdir) unless $opt{k};
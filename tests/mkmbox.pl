@@ -0,0 +1,398 @@
+#!/usr/bin/perl
+
+# mkmbox
+#
+# Writes a synthetic mailbox to standard output, for benchmarking
+# hypermail on archives larger than the ones under mboxes/.
+#
+# The output only depends on the options: the same options always give
+# the same mailbox, byte for byte, on any machine. Messages form threads
+# up to a given depth, replies quote their parent, and some messages are
+# MIME: quoted-printable or base64 text in various charsets, HTML
+# alternatives and binary attachments.
+#
+# usage: mkmbox.pl [-n messages] [-s seed] [-t depth] [-q quoteratio]
+#                  [-m mimeratio] [-a attachratio] [-p coderatio]
+#                  [-c charsets] [-y years] [-f first] [-l last]
+#
+#   -n  number of messages (1000)
+#   -s  seed of the random generator (1)
+#   -t  deepest thread, in replies (6)
+#   -q  fraction of replies that quote their parent (0.5)
+#   -m  fraction of messages that are MIME encoded (0.2)
+#   -a  fraction of messages with an attachment (0.05)
+#   -p  fraction of messages with code, tables or ASCII art in them (0),
+#       like the traffic of a development list
+#   -c  comma separated charsets (us-ascii,iso-8859-1,utf-8)
+#   -y  years the messages are spread over, starting in 2000 (3)
+#   -f  only print the messages from this number on (0)
+#   -l  only print the messages up to, but not including, this one
+#
+# -f and -l cut a mailbox in parts without changing its messages, for
+# instance to append the last ones to an archive built from the others.
+
+use strict;
+use warnings;
+
+use Getopt::Std;
+
+our %opt;
+getopts('n:s:t:q:m:a:p:c:y:f:l:', \%opt) || die "usage: $0 [-n messages] [-s seed] [-t depth] [-q quoteratio] [-m mimeratio] [-a attachratio] [-p coderatio] [-c charsets] [-y years] [-f first] [-l last]\n";
+
+my $messages = $opt{n} // 1000;
+my $seed = $opt{s} // 1;
+my $max_depth = $opt{t} // 6;
+my $quote_ratio = $opt{q} // 0.5;
+my $mime_ratio = $opt{m} // 0.2;
+my $attach_ratio = $opt{a} // 0.05;
+my $code_ratio = $opt{p} // 0;
+my @charsets = split /,/, ($opt{c} // "us-ascii,iso-8859-1,utf-8");
+my $years = $opt{y} // 3;
+my $first = $opt{f} // 0;
+my $last = $opt{l} // $messages;
+
+##
+## Random numbers
+##
+
+# our own generator rather than rand(), whose sequence depends on the
+# platform and the perl version
+my $state = ($seed * 2654435761 + 1) & 0xffffffff;
+
+sub rnd {
+    my $n = shift;
+    $state = ($state * 1103515245 + 12345) & 0xffffffff;
+    return (($state >> 8) * $n) >> 24;
+}
+
+# 32 random bits
+sub rnd_word {
+    $state = ($state * 1103515245 + 12345) & 0xffffffff;
+    return $state;
+}
+
+sub chance {
+    my $ratio = shift;
+    return rnd(1000000) < $ratio * 1000000;
+}
+
+sub pick {
+    return $_[rnd(scalar @_)];
+}
+
+##
+## Words, names and dates
+##
+
+my @words = qw(the of and to a in is it you that he was for on are with
+    as I his they be at one have this from or had by hot word but what
+    some we can out other were all there when up use your how said an
+    each she which do their time if will way about many then them write
+    would like so these her long make thing see him two has look more
+    day could go come did number sound no most people my over know water
+    than call first who may down side been now find archive message
+    mailbox thread reply index header server patch build release list
+    configure option compile kernel memory buffer parser socket
+    bug fix test version stable branch merge review commit);
+
+# a few words each charset can't do without
+my %accented = (
+    'iso-8859-1' => ["caf\xe9", "na\xefve", "r\xe9sum\xe9", "\xfcber",
+		     "se\xf1or", "fa\xe7ade"],
+    'utf-8' => ["caf\xc3\xa9", "na\xc3\xafve", "\xc3\xbcber",
+		"\xe2\x82\xac", "\xe6\x97\xa5\xe6\x9c\xac",
+		"\xd0\xbc\xd0\xb8\xd1\x80"],
+);
+
+my @first_names = qw(Alice Bob Carol Dave Erin Frank Grace Heidi Ivan
+    Judy Mallory Niaj Olivia Peggy Rupert Sybil Trent Victor Walter Zoe);
+my @last_names = qw(Smith Jones Garcia Miller Davis Lopez Wilson Moore
+    Taylor Thomas Martin Lee Clark Lewis Walker Young King Wright Hill);
+my @domains = qw(example.com example.org example.net mail.example.com
+    lists.example.org);
+
+my @authors;
+for my $i (0 .. 199) {
+    my $first = $first_names[$i % @first_names];
+    my $last = $last_names[int($i / @first_names) % @last_names];
+    push @authors, ["$first $last",
+		    lc("$first.$last") . "\@" . $domains[$i % @domains]];
+}
+
+my @days = qw(Sun Mon Tue Wed Thu Fri Sat);
+my @months = qw(Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec);
+
+# 2000-01-01 00:00:00 UTC
+my $epoch = 946684800;
+
+sub date_fields {
+    my @t = gmtime(shift);
+    return ($days[$t[6]], $months[$t[4]], $t[3], $t[5] + 1900,
+	    sprintf("%02d:%02d:%02d", $t[2], $t[1], $t[0]));
+}
+
+sub from_date {
+    my ($wday, $mon, $mday, $year, $hms) = date_fields(shift);
+    return sprintf("%s %s %2d %s %d", $wday, $mon, $mday, $hms, $year);
+}
+
+sub rfc822_date {
+    my ($wday, $mon, $mday, $year, $hms) = date_fields(shift);
+    return "$wday, $mday $mon $year $hms +0000";
+}
+
+##
+## Text
+##
+
+sub sentence {
+    my $charset = shift;
+    my $n = 4 + rnd(12);
+    my @s;
+    for (1 .. $n) {
+	if ($accented{$charset} && chance(0.08)) {
+	    push @s, pick(@{$accented{$charset}});
+	} else {
+	    push @s, pick(@words);
+	}
+    }
+    return ucfirst(join(" ", @s)) . ".";
+}
+
+# paragraphs of sentences wrapped at 72 columns
+sub body_text {
+    my $charset = shift;
+    my @lines;
+    for (0 .. rnd(4)) {
+	my $line = "";
+	for (1 .. 2 + rnd(5)) {
+	    for my $w (split / /, sentence($charset)) {
+		if (length($line) + length($w) >= 72) {
+		    push @lines, $line;
+		    $line = "";
+		}
+		$line .= ($line eq "" ? "" : " ") . $w;
+	    }
+	}
+	push @lines, $line, "";
+    }
+    return @lines;
+}
+
+# preformatted text: a table drawn with +---+ and |, a bit of C, or a
+# diagram, all of which txt2html has to tell from prose
+sub code_text {
+    my @lines;
+    my $kind = rnd(3);
+    if ($kind == 0) {
+	my @widths = map { 4 + rnd(10) } 0 .. 1 + rnd(6);
+	my $rule = "+" . join("+", map { "-" x ($_ + 2) } @widths) . "+";
+	my $row = sub {
+	    return "| " . join(" | ", map { sprintf("%-*s", $widths[$_],
+		substr($_[$_ + 0] // "", 0, $widths[$_])) } 0 .. $#widths) . " |";
+	};
+	push @lines, $rule, $row->(map { pick(@words) } @widths), $rule;
+	push @lines, $row->(map { rnd(2) ? pick(@words) : rnd(100000) } @widths)
+	    for 0 .. 4 + rnd(60);
+	push @lines, $rule;
+    }
+    elsif ($kind == 1) {
+	for (0 .. rnd(6)) {
+	    my $f = pick(@words) . "_" . pick(@words);
+	    push @lines, "static int $f(struct " . pick(@words) . " *p, int n)", "{";
+	    for (0 .. 2 + rnd(10)) {
+		my $v = pick(@words);
+		if (rnd(2)) {
+		    push @lines, "    if (p->$v >= n) {",
+			"\treturn -1;\t\t/* " . pick(@words) . " */", "    }";
+		}
+		else {
+		    push @lines, "    p->$v = n * " . rnd(64) . ";";
+		}
+	    }
+	    push @lines, "    return 0;", "}", "";
+	}
+    }
+    else {
+	my $w = 8 + rnd(50);
+	for (0 .. 3 + rnd(30)) {
+	    push @lines, join("", map { pick(" ", " ", "|", "/", "\\", "-", "*", ".") } 1 .. $w);
+	}
+	push @lines, "=" x $w;
+    }
+    return (@lines, "");
+}
+
+sub encode_qp {
+    my $line = shift;
+    $line =~ s/([=\x80-\xff])/sprintf("=%02X", ord($1))/ge;
+    $line =~ s/ $/=20/;
+    return $line;
+}
+
+my @b64 = ('A' .. 'Z', 'a' .. 'z', '0' .. '9', '+', '/');
+
+sub encode_base64 {
+    my $data = shift;
+    my $out = "";
+    my $line = "";
+    for (my $i = 0; $i < length($data); $i += 3) {
+	my $chunk = substr($data, $i, 3);
+	my $pad = 3 - length($chunk);
+	my $n = unpack("N", $chunk . "\0" x (4 - length($chunk)));
+	my $quad = join("", map { $b64[($n >> (26 - 6 * $_)) & 63] } 0 .. 3);
+	substr($quad, 4 - $pad) = "=" x $pad if $pad;
+	$line .= $quad;
+	if (length($line) == 76) {
+	    $out .= "$line\n";
+	    $line = "";
+	}
+    }
+    $out .= "$line\n" if $line ne "";
+    return $out;
+}
+
+sub encoded_word {
+    my ($text, $charset) = @_;
+    return $text if $text !~ /[\x80-\xff]/;
+    $text =~ s/([=?_\x80-\xff])/sprintf("=%02X", ord($1))/ge;
+    $text =~ s/ /_/g;
+    return "=?$charset?Q?$text?=";
+}
+
+sub html_escape {
+    my $s = shift;
+    $s =~ s/&/&amp;/g;
+    $s =~ s/</&lt;/g;
+    $s =~ s/>/&gt;/g;
+    return $s;
+}
+
+sub mime_text {
+    my ($charset, $body) = @_;
+    my $encoding = pick("quoted-printable", "base64", "8bit");
+    $encoding = "7bit" if $charset eq "us-ascii" && $encoding eq "8bit";
+    my $text = join("", map { "$_\n" } @$body);
+    return "Content-Type: text/plain; charset=$charset\n"
+	. "Content-Transfer-Encoding: $encoding\n\n"
+	. ($encoding eq "base64" ? encode_base64($text)
+	   : $encoding eq "quoted-printable"
+	   ? join("", map { encode_qp($_) . "\n" } @$body)
+	   : $text);
+}
+
+sub format_message {
+    my ($m, $num, $author, $charset, $parent, $time, $body) = @_;
+    my $subject = ($m->{depth} ? "Re: " : "") . $m->{subject};
+    my $out = "From $author->[1] " . from_date($time) . "\n"
+	. "Date: " . rfc822_date($time) . "\n"
+	. "From: " . encoded_word($author->[0], $charset) . " <$author->[1]>\n"
+	. "To: bench\@lists.example.org\n"
+	. "Subject: " . encoded_word($subject, $charset) . "\n"
+	. "Message-ID: $m->{id}\n";
+    if ($parent) {
+	$out .= "In-Reply-To: $parent->{id}\n"
+	    . "References: " . join("\n\t", @{$m->{refs}}) . "\n";
+    }
+
+    my $attach = chance($attach_ratio);
+    if (!$attach && !chance($mime_ratio)) {
+	return $out . "\n" . join("", map { "$_\n" } @$body) . "\n";
+    }
+
+    $out .= "MIME-Version: 1.0\n";
+    my $boundary = sprintf("=_bench_%d_%x", $num, rnd(1 << 30));
+    my $textpart = mime_text($charset, $body);
+    if ($attach) {
+	my $size = 1024 + rnd(32 * 1024);
+	my $data = pack("N*", map { rnd_word() } 1 .. $size / 4);
+	my $name = sprintf("data-%d.%s", $num, pick("bin", "dat", "tar.gz"));
+	$out .= "Content-Type: multipart/mixed; boundary=\"$boundary\"\n\n"
+	    . "This is a multi-part message in MIME format.\n\n"
+	    . "--$boundary\n$textpart\n"
+	    . "--$boundary\n"
+	    . "Content-Type: application/octet-stream; name=\"$name\"\n"
+	    . "Content-Transfer-Encoding: base64\n"
+	    . "Content-Disposition: attachment; filename=\"$name\"\n\n"
+	    . encode_base64($data) . "\n"
+	    . "--$boundary--\n\n";
+    }
+    elsif (chance(0.5)) {
+	my $html = "<html><body>\n"
+	    . join("", map { $_ eq "" ? "<p>\n" : html_escape($_) . "<br>\n" }
+		   @$body)
+	    . "</body></html>\n";
+	$out .= "Content-Type: multipart/alternative; boundary=\"$boundary\"\n\n"
+	    . "--$boundary\n$textpart\n"
+	    . "--$boundary\n"
+	    . "Content-Type: text/html; charset=$charset\n"
+	    . "Content-Transfer-Encoding: quoted-printable\n\n"
+	    . join("", map { encode_qp($_) . "\n" } split /\n/, $html) . "\n"
+	    . "--$boundary--\n\n";
+    }
+    else {
+	$out .= $textpart . "\n";
+    }
+    return $out;
+}
+
+##
+## Messages
+##
+
+my @subjects = map { my $s = sentence("us-ascii"); $s =~ s/\.$//;
+		     join(" ", (split / /, $s)[0 .. 3]) } 1 .. 50;
+
+my @msgs;			# what replies need of their parent
+my $time = $epoch;
+my $step = int($years * 365 * 86400 / ($messages || 1)) || 1;
+
+for my $num (0 .. $messages - 1) {
+    my $author = $authors[rnd(scalar @authors)];
+    my $charset = pick(@charsets);
+    my %m = (id => sprintf("<%d.%08x\@bench.example.com>", $num, rnd(1 << 30)),
+	     depth => 0, subject => pick(@subjects), refs => []);
+    my $parent;
+
+    # most messages answer one of the recent ones
+    if ($num && chance(0.7)) {
+	my $p = $msgs[$num - 1 - rnd($num < 50 ? $num : 50)];
+	$parent = $p if $p->{depth} < $max_depth;
+    }
+    if ($parent) {
+	$m{depth} = $parent->{depth} + 1;
+	$m{subject} = $parent->{subject};
+	$m{refs} = [@{$parent->{refs}}, $parent->{id}];
+	shift @{$m{refs}} while @{$m{refs}} > 10;
+    }
+    elsif (chance(0.3)) {
+	$m{subject} .= " " . sentence($charset);
+	$m{subject} =~ s/\.$//;
+    }
+
+    my @body;
+    if ($parent && chance($quote_ratio)) {
+	push @body, "$parent->{author} wrote:";
+	my @q = @{$parent->{body}};
+	my $from = rnd(scalar @q);
+	push @body, map({ $_ eq "" ? ">" : "> $_" }
+			@q[$from .. ($from + 5 < $#q ? $from + 5 : $#q)]), "";
+    }
+    push @body, body_text($charset);
+    push @body, code_text(), body_text($charset)
+	if $code_ratio && chance($code_ratio);
+    $m{body} = [grep { !/^>/ && !/ wrote:$/ } @body];
+    s/^From />From / for @body;
+    $m{author} = $author->[0];
+
+    $time += int($step / 2) + rnd($step);
+    push @msgs, \%m;
+    # keep what later replies might need, and no more
+    $msgs[$num - 60] = undef if $num >= 60;
+
+    # format it even when it is not printed, so that the messages
+    # after it don't change
+    my $text = format_message(\%m, $num, $author, $charset, $parent, $time,
+			      \@body);
+    print $text if $num >= $first && $num < $last;
+}